@@ -0,0 +1,504 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include "Chip8.h"
+#include "opcodes.h"
+#include "Chip8Debugger.h"
+#include "Chip8Cfg.h"
+#include "Chip8Aot.h"
+
+void C8InitialiseImage(C8Image* image)
+{
+    memset(image->memory, 0, sizeof(image->memory));
+    memset(image->decoded, C8_DECODE_NONE, sizeof(image->decoded));
+    
+    // Setup fonts
+    for(int i = 0; i < 80; ++i)
+        image->memory[i] = chip8_fontset[i];
+}
+
+uint32_t LoadROM(C8Image* image, const char* file_name)
+{
+    // Load ROM into the memory (starting at 0x200)
+    uint32_t size = 0;
+    FILE* f = fopen(file_name, "rb");
+    if(f)
+    {
+        // Read directly into memory, anything that doesn't fit is dropped
+        size = fread(&image->memory[0x200], 1, MEMSIZE - 0x200, f);
+        
+        if(fgetc(f) != EOF)
+        {
+            printf("ROM %s is too large, truncated to %d bytes\n", file_name, MEMSIZE - 0x200);
+        }
+        
+        fclose(f);
+        
+        C8PredecodeROM(image, size);
+    }
+    else
+    {
+        // Failed to load
+        printf("Failed to load ROM %s\n", file_name);
+        exit(1);
+    }
+    
+    return size;
+}
+
+// Pages allocated at a time when the pool runs dry
+#define C8_PAGES_PER_CHUNK 64
+
+static uint8_t* C8AllocatePage(C8PagePool* pool)
+{
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    
+    if(pool->free_pages.empty())
+    {
+        void* chunk = nullptr;
+        if(posix_memalign(&chunk, 64, C8_PAGES_PER_CHUNK * C8_PAGE_SIZE) != 0)
+        {
+            printf("Failed to allocate memory pages\n");
+            exit(1);
+        }
+        
+        pool->chunks.push_back((uint8_t*)chunk);
+        for(int i = 0; i < C8_PAGES_PER_CHUNK; ++i)
+        {
+            pool->free_pages.push_back((uint8_t*)chunk + (i * C8_PAGE_SIZE));
+        }
+    }
+    
+    uint8_t* page = pool->free_pages.back();
+    pool->free_pages.pop_back();
+    
+    return page;
+}
+
+static void C8FreePage(C8PagePool* pool, uint8_t* page)
+{
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->free_pages.push_back(page);
+}
+
+void C8DestroyPagePool(C8PagePool* pool)
+{
+    for(uint8_t* chunk : pool->chunks)
+    {
+        free(chunk);
+    }
+    
+    pool->chunks.clear();
+    pool->free_pages.clear();
+}
+
+void C8MakePagePrivate(Chip8* chip8, uint32_t page)
+{
+    // Copy on write, this instance now owns the page
+    uint8_t* private_page = C8AllocatePage(chip8->pool);
+    memcpy(private_page, chip8->pages[page], C8_PAGE_SIZE);
+    
+    chip8->pages[page] = private_page;
+    chip8->private_pages |= (1 << page);
+}
+
+void C8Initialise(Chip8* chip8, const C8Image* image, C8PagePool* pool)
+{
+    // Setup default program counter
+    chip8->pc = 0x200;
+    
+    chip8->opcode = 0;
+    
+    // Every page starts out shared with the image, the page table is never
+    // written through without making the page private first
+    chip8->image = image;
+    chip8->pool = pool;
+    chip8->private_pages = 0;
+    for(int page = 0; page < C8_PAGE_TABLE_SIZE; ++page)
+    {
+        chip8->pages[page] = const_cast<uint8_t*>(&image->memory[page * C8_PAGE_SIZE]);
+    }
+}
+
+void C8ReleasePages(Chip8* chip8)
+{
+    // Hand private pages back to the pool and share the image again
+    for(int page = 0; page < C8_PAGE_TABLE_SIZE; ++page)
+    {
+        if(chip8->private_pages & (1 << page))
+        {
+            C8FreePage(chip8->pool, chip8->pages[page]);
+            chip8->pages[page] = const_cast<uint8_t*>(&chip8->image->memory[page * C8_PAGE_SIZE]);
+        }
+    }
+    
+    chip8->private_pages = 0;
+}
+
+void C8CopyInstance(Chip8* to, const Chip8* from)
+{
+    *to = *from;
+    
+    // Never share a page either of them can write to
+    for(int page = 0; page < C8_PAGE_TABLE_SIZE; ++page)
+    {
+        if(from->private_pages & (1 << page))
+        {
+            to->pages[page] = C8AllocatePage(from->pool);
+            memcpy(to->pages[page], from->pages[page], C8_PAGE_SIZE);
+        }
+    }
+}
+
+Chip8* C8CreateInstances(uint32_t count, const C8Image* image, C8PagePool* pool)
+{
+    // Instances are cache line aligned which new doesn't honour before C++17
+    void* instances = nullptr;
+    if(posix_memalign(&instances, alignof(Chip8), sizeof(Chip8) * count) != 0)
+    {
+        printf("Failed to allocate %u instances\n", count);
+        exit(1);
+    }
+    
+    memset(instances, 0, sizeof(Chip8) * count);
+    
+    Chip8* chip8 = (Chip8*)instances;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        C8Initialise(&chip8[i], image, pool);
+    }
+    
+    return chip8;
+}
+
+void C8DestroyInstances(Chip8* instances, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        C8ReleasePages(&instances[i]);
+    }
+    
+    free(instances);
+}
+
+void C8GetOpcode(Chip8* chip8)
+{
+    // Get opcode at current program counter location, the two bytes can sit
+    // on different pages and the guard page covers the top of memory
+    uint16_t pc = chip8->pc & MEMMASK;
+    chip8->opcode = (C8ReadMemory(chip8, pc) << 8) | C8ReadMemory(chip8, pc + 1);
+}
+
+// Runs one instruction without counting it, the cycle counters sit outside of
+// the CPU block so C8EmulateFrame only updates them once a frame. With Fuse a
+// sequence fused at pc runs whole when there are enough cycles left for it.
+// Returns how many instructions ran
+template<bool Fuse>
+static inline uint32_t C8Step(Chip8* chip8, uint32_t remaining)
+{
+    uint16_t pc = chip8->pc;
+    
+    // Get the current opcode, decoded at load time unless this instance has
+    // written to the page since
+    const C8Decoded* decoded = &chip8->image->decoded[pc & MEMMASK];
+    uint8_t id = Fuse ? decoded->dispatch : decoded->id;
+    if(id == C8_DECODE_NONE || (chip8->private_pages & (1 << ((pc & MEMMASK) >> C8_PAGE_SHIFT))))
+    {
+        C8GetOpcode(chip8);
+        id = C8Decode(chip8->opcode);
+    }
+    else if(!Fuse || id < C8_DISPATCH_FUSED)
+    {
+        chip8->opcode = decoded->opcode;
+    }
+    else
+    {
+        // A fused sequence starts here, near the end of the frame it runs an
+        // instruction at a time instead
+        uint8_t fused = id - C8_DISPATCH_FUSED;
+        if(remaining >= fused_info[fused].length)
+        {
+            return fused_table[fused](chip8, decoded);
+        }
+        
+        chip8->opcode = decoded->opcode;
+        id = decoded->id;
+    }
+    
+    // Increment the PC
+    chip8->pc = (pc + 2) & MEMMASK;
+
+#ifdef C8_CHECKED
+    // BNNN and returns can leave the pc anywhere, trap before running
+    // whatever was masked into range
+    if(pc >= MEMSIZE - 1)
+    {
+        C8RaiseFault(chip8, C8_FAULT_PC, pc);
+        return 1;
+    }
+#endif
+    
+    // Opcode is now decoded, run it
+    //printf("Opcode: 0x%X\n", chip8->opcode);
+    opcode_table[id](chip8);
+    return 1;
+}
+
+void C8EmulateCycle(Chip8* chip8)
+{
+    C8Step<false>(chip8, 1);
+    ++chip8->cycles;
+}
+
+void C8TickTimers(Chip8* chip8)
+{
+    if(chip8->delay_timer != 0)
+        --chip8->delay_timer;
+    
+    if(chip8->sound_timer != 0)
+        --chip8->sound_timer;
+}
+
+uint16_t C8ReadOpcode(Chip8* chip8, uint16_t address)
+{
+    return (C8ReadMemory(chip8, address) << 8) | C8ReadMemory(chip8, address + 1);
+}
+
+bool C8SkipTimerLoop(Chip8* chip8, uint32_t cycles)
+{
+    /*
+    Looks for a loop at the program counter that does nothing but poll the
+    delay timer, eg.
+        
+        FX07    VX = delay timer
+        3XKK    skip the jump once VX == KK (or 4XKK, once VX != KK)
+        1NNN    jump back to the FX07
+    
+    None of these have side effects beyond VX, and the delay timer only
+    changes between frames, so if the loop won't exit on this pass it won't
+    exit for the rest of the frame. In that case put the chip in the state it
+    would be in after running the loop for the remaining cycles.
+    */
+    uint16_t address = chip8->pc;
+    if(address + 6 > MEMSIZE)
+    {
+        return false;
+    }
+    
+    uint16_t read_timer = C8ReadOpcode(chip8, address);
+    uint16_t skip = C8ReadOpcode(chip8, address + 2);
+    uint16_t jump = C8ReadOpcode(chip8, address + 4);
+    
+    uint8_t x = (read_timer & 0x0F00) >> 8;
+    uint8_t kk = skip & 0x00FF;
+    
+    if((read_timer & 0xF0FF) != 0xF007 ||
+       (skip & 0x0F00) >> 8 != x ||
+       jump != (0x1000 | address))
+    {
+        return false;
+    }
+    
+    bool loops;
+    switch(skip & 0xF000)
+    {
+        case 0x3000:
+        loops = chip8->delay_timer != kk;
+        break;
+        
+        case 0x4000:
+        loops = chip8->delay_timer == kk;
+        break;
+        
+        default:
+        loops = false;
+        break;
+    }
+    
+    if(!loops || cycles == 0)
+    {
+        return false;
+    }
+    
+    // Work out where in the loop the remaining cycles leave us
+    static const uint16_t last_opcode_offset[3] = { 4, 0, 2 };
+    uint32_t position = cycles % 3;
+    
+    chip8->V[x] = chip8->delay_timer;
+    chip8->opcode = C8ReadOpcode(chip8, address + last_opcode_offset[position]);
+    chip8->pc = address + (position * 2);
+    chip8->idle = C8_IDLE_TIMER;
+    
+    return true;
+}
+
+bool C8AotInterpret(Chip8* chip8, uint32_t remaining)
+{
+    uint16_t pc = chip8->pc;
+    C8Step<false>(chip8, 1);
+    
+    // The same idle checks as C8RunFrame
+    if((chip8->opcode & 0xF000) == 0x1000 && C8SkipTimerLoop(chip8, remaining))
+    {
+        chip8->cycles_skipped += remaining;
+        return true;
+    }
+    
+    if((chip8->opcode & 0xF0FF) == 0xF00A && chip8->pc == pc)
+    {
+        chip8->idle = C8_IDLE_KEY;
+        chip8->cycles_skipped += remaining;
+        return true;
+    }
+    
+    return false;
+}
+
+// Hooks for the release frame loop, they compile away to nothing
+struct C8NoHooks
+{
+    static const bool idle_skip = true;
+    static const bool fuse = true;
+    
+    bool Stop(const Chip8*) { return false; }
+    void Stepped(const Chip8*) {}
+};
+
+// Runs a frame from the given cycle. Hooks::Stop can stop it before any
+// instruction, in which case the cycle to resume from is returned, otherwise
+// the frame completes, the timers tick and cycles is returned
+template<typename Hooks>
+static inline uint32_t C8RunFrame(Chip8* chip8, uint32_t cycle, uint32_t cycles, Hooks* hooks)
+{
+    if(cycle == 0)
+    {
+        chip8->idle = C8_IDLE_NONE;
+        chip8->keys_read = false;
+    }
+    
+    uint32_t skipped = 0;
+    
+    for(; cycle < cycles; ++cycle)
+    {
+        if(hooks->Stop(chip8))
+        {
+            return cycle;
+        }
+        
+        uint16_t pc = chip8->pc;
+        
+        // A fused sequence counts as every instruction it ran, the checks
+        // below only need to see the last as none of the others jump or wait.
+        // Hooks that look at every instruction turn fusion off
+        uint32_t executed = C8Step<Hooks::fuse>(chip8, cycles - cycle);
+        hooks->Stepped(chip8);
+        cycle += executed - 1;
+
+#ifdef C8_CHECKED
+        // Trap at the instruction that faulted
+        if(chip8->fault != C8_FAULT_NONE)
+        {
+            chip8->cycles += cycle + 1;
+            return cycles;
+        }
+#endif
+        
+        if(!Hooks::idle_skip)
+        {
+            continue;
+        }
+        
+        // Idle loops always jump back to their start so only look for one
+        // after a jump
+        if((chip8->opcode & 0xF000) == 0x1000 &&
+           C8SkipTimerLoop(chip8, cycles - cycle - 1))
+        {
+            skipped = cycles - cycle - 1;
+            break;
+        }
+        
+        // FX0A repeats until a key is down, the keys can't change until the
+        // next frame so neither can the outcome
+        if((chip8->opcode & 0xF0FF) == 0xF00A && chip8->pc == pc)
+        {
+            skipped = cycles - cycle - 1;
+            chip8->idle = C8_IDLE_KEY;
+            break;
+        }
+    }
+    
+    // Every cycle of the frame counts whether it ran or was skipped
+    chip8->cycles += cycles;
+    chip8->cycles_skipped += skipped;
+    
+    // The frame is over, tick the 60Hz timers
+    C8TickTimers(chip8);
+    
+    return cycles;
+}
+
+void C8EmulateFrame(Chip8* chip8, uint32_t cycles)
+{
+    // A faulted chip stays halted
+    if(chip8->fault != C8_FAULT_NONE)
+    {
+        return;
+    }
+    
+    C8NoHooks hooks;
+    C8RunFrame(chip8, 0, cycles, &hooks);
+}
+
+bool C8DebugFrame(Chip8* chip8, C8Debugger* debugger, uint32_t cycles)
+{
+    if(chip8->fault != C8_FAULT_NONE)
+    {
+        return true;
+    }
+    
+    C8DebugHooks hooks;
+    hooks.debugger = debugger;
+    debugger->frame_cycle = C8RunFrame(chip8, debugger->frame_cycle, cycles, &hooks);
+    
+    if(debugger->frame_cycle < cycles)
+    {
+        return false;
+    }
+    
+    debugger->frame_cycle = 0;
+    return true;
+}
+
+void C8SkipKeyWaitFrames(Chip8* chip8, uint32_t frames, uint32_t cycles)
+{
+    // Each frame spent in FX0A runs it once, skips the rest of the frame and
+    // ticks the timers, nothing else changes until a key is down
+    uint32_t delay_ticks = frames < chip8->delay_timer ? frames : chip8->delay_timer;
+    uint32_t sound_ticks = frames < chip8->sound_timer ? frames : chip8->sound_timer;
+    chip8->delay_timer -= delay_ticks;
+    chip8->sound_timer -= sound_ticks;
+    
+    chip8->cycles += (uint64_t)frames * cycles;
+    chip8->cycles_skipped += (uint64_t)frames * (cycles ? cycles - 1 : 0);
+}
+
+void C8ReportFault(Chip8* chip8)
+{
+    static const char* fault_names[] = {
+        "None",
+        "Bad opcode",
+        "Memory access out of range",
+        "Program counter out of range",
+        "Stack overflow",
+        "Stack underflow",
+        "Key out of range",
+    };
+    
+    // The address is the opcode itself for bad opcodes
+    printf("Fault: %s at 0x%X (0x%X)\n",
+           fault_names[chip8->fault], chip8->fault_pc, chip8->fault_address);
+    
+    DumpRegisters(chip8);
+}
\ No newline at end of file
@@ -2,10 +2,14 @@
 #define _CHIP8_H
 
 #include <stdint.h>
+#include <cstddef>
+#include <cstdio>
 
-#include "Screen.h"
 #include "Chip8Input.h"
 
+#include <mutex>
+#include <vector>
+
 #include <chrono>
 typedef std::chrono::high_resolution_clock Clock;
 typedef std::chrono::time_point<Clock> Clock_Time;
@@ -14,6 +18,34 @@ typedef std::chrono::duration<int64_t, std::nano> PerfNano_Counter;
 // The Chip-8's memory size
 #define MEMSIZE 4096
 
+// Addresses are masked to 12 bits before use, the guard page after memory
+// soaks up the largest offset any instruction adds to a masked address
+// (FX55/FX65 with X = F, DXYN with N = F) so no access can leave the page table
+#define MEMMASK (MEMSIZE - 1)
+
+// Memory is paged so instances of the same ROM can share everything they
+// don't write to
+#define C8_PAGE_SHIFT 8
+#define C8_PAGE_SIZE (1 << C8_PAGE_SHIFT)
+#define C8_PAGE_MASK (C8_PAGE_SIZE - 1)
+#define C8_PAGE_COUNT (MEMSIZE / C8_PAGE_SIZE)
+
+// Pages in the page table, including the guard page
+#define C8_PAGE_TABLE_SIZE (C8_PAGE_COUNT + 1)
+
+#define STACKSIZE 16
+
+// Instructions per 60Hz frame, ~2160Hz which is roughly the speed the old
+// usleep(400) per instruction gave
+#define DEFAULT_CYCLES_PER_FRAME 36
+
+// The Chip-8's display size
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+
+// Bytes per row of the packed display
+#define SCREEN_PITCH (SCREEN_WIDTH / 8)
+
 enum GPRegisters
 {
     V0,
@@ -55,40 +87,141 @@ const unsigned char chip8_fontset[] =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-struct Chip8
+// Why the chip stopped doing useful work during the last frame
+enum C8Idle
+{
+    C8_IDLE_NONE,
+    C8_IDLE_TIMER, // Polling the delay timer
+    C8_IDLE_KEY,   // Waiting for a key press in FX0A
+};
+
+// Faults, only bad opcodes are reported unless built with CHECKEDMEMORY, which
+// also traps out of range accesses that are otherwise masked
+enum C8Fault
+{
+    C8_FAULT_NONE,
+    C8_FAULT_BAD_OPCODE,
+    C8_FAULT_MEMORY,
+    C8_FAULT_PC,
+    C8_FAULT_STACK_OVERFLOW,
+    C8_FAULT_STACK_UNDERFLOW,
+    C8_FAULT_KEY,
+};
+
+// Marks an address that wasn't decoded ahead of time
+#define C8_DECODE_NONE 0xFF
+
+// An instruction decoded when the ROM was loaded
+struct C8Decoded
 {
     uint16_t opcode;
-    uint8_t memory[MEMSIZE];
+    uint8_t id; // Index into opcode_table, or C8_DECODE_NONE
     
-    // Registers
+    // What the fusing frame loop runs, id unless a sequence starts here when
+    // it is C8_DISPATCH_FUSED plus its index into fused_table
+    uint8_t dispatch;
+};
+
+// Font, ROM and a zeroed guard page, shared read only by every instance
+// running the ROM. The code found in the ROM is decoded alongside, it stays
+// valid for an instance until it writes to the page the code is on
+struct C8Image
+{
+    uint8_t memory[C8_PAGE_TABLE_SIZE * C8_PAGE_SIZE];
+    C8Decoded decoded[MEMSIZE];
+};
+
+// Hands out private pages to instances the first time they write to a shared
+// page. Pages are carved out of larger chunks and recycled through a free list
+struct C8PagePool
+{
+    std::mutex mutex;
+    std::vector<uint8_t*> chunks;
+    std::vector<uint8_t*> free_pages;
+};
+
+// Laid out in three blocks so that densely packed instances only pull in what
+// they use. The CPU block holds everything an instruction touches besides
+// memory and fits a single cache line, memory and the display each start on
+// their own line and the rarely touched bookkeeping goes last. Anything that
+// only the frontend needs (keymap, wall clock, screen) lives in the frontend
+struct alignas(64) Chip8
+{
+    // CPU block
     uint8_t V[REGISTERCOUNT]; // GP Registers
+    uint16_t stack[STACKSIZE];
+    uint16_t opcode;
     uint16_t I; // Index register
     uint16_t pc; // Program counter
-    uint8_t gfx[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t sp;
     
     // Timers
     uint8_t delay_timer;
     uint8_t sound_timer;
     
-    // System clock
-    Clock_Time start_time;
+    // Set by C8EmulateFrame, one of C8Idle
+    uint8_t idle;
+    
+    // Do we need to update the texture
+    bool draw_flag;
     
-    uint16_t stack[16];
-    uint16_t sp;
+    // First fault hit, one of C8Fault
+    uint8_t fault;
     
-    // Gamepad
-    uint8_t keys[16];
+    // Gamepad, a bit per key set while it is held
+    uint16_t keys;
     
-    // Create a keymap to mapt Chip8 Keys to keyboard keys
-    uint32_t keymap[MAX_KEYS];
+    // Memory block, a page table over the shared image. A page is copied
+    // into a private page from the pool on the first write to it
+    alignas(64) uint8_t* pages[C8_PAGE_TABLE_SIZE];
+    uint32_t private_pages; // A bit per page
+    const C8Image* image;
+    C8PagePool* pool;
     
-    // Do we need to update the texture
-    bool draw_flag;
+    // Display block, 1 bit per pixel with the leftmost pixel in the most
+    // significant bit so it can be uploaded as is
+    alignas(64) uint8_t gfx[SCREEN_PITCH * SCREEN_HEIGHT];
     
-    // Ptr to configured screen object
-    Screen* screen;
+    // Instructions emulated, including those skipped by idle loop detection
+    uint64_t cycles;
+    uint64_t cycles_skipped;
+    
+    // The pc of the instruction that faulted and the address (or opcode)
+    // involved
+    uint16_t fault_pc;
+    uint16_t fault_address;
+    
+    // Set when EX9E, EXA1 or FX0A reads the keypad, cleared at the start of
+    // every frame so the frontend can tell which frame first saw a key change
+    bool keys_read;
 };
 
+static_assert(offsetof(Chip8, keys) + sizeof(uint16_t) <= 64, "Chip8 CPU block must fit one cache line");
+
+// Address is a masked address plus an offset of at most 15
+inline uint8_t C8ReadMemory(const Chip8* chip8, uint32_t address)
+{
+    return chip8->pages[address >> C8_PAGE_SHIFT][address & C8_PAGE_MASK];
+}
+
+void C8MakePagePrivate(Chip8* chip8, uint32_t page);
+
+inline void C8WriteMemory(Chip8* chip8, uint32_t address, uint8_t value)
+{
+    uint32_t page = address >> C8_PAGE_SHIFT;
+    if(!(chip8->private_pages & (1 << page)))
+    {
+        C8MakePagePrivate(chip8, page);
+    }
+    
+    chip8->pages[page][address & C8_PAGE_MASK] = value;
+}
+
+inline bool C8GetPixel(const Chip8* chip8, uint32_t x, uint32_t y)
+{
+    return (chip8->gfx[(y * SCREEN_PITCH) + (x / 8)] >> (7 - (x % 8))) & 0x01;
+}
+
 inline void DumpRegisters(Chip8* chip8)
 {
     printf("Register Dump\n");
@@ -114,11 +247,36 @@ inline void DumpRegisters(Chip8* chip8)
     printf("Program Counter\t\t%X\n", chip8->pc);
 }
 
+inline void C8RaiseFault(Chip8* chip8, C8Fault fault, uint32_t address)
+{
+    // Keep the first fault, that is the one worth reporting
+    if(chip8->fault == C8_FAULT_NONE)
+    {
+        chip8->fault = fault;
+        chip8->fault_pc = (chip8->pc - 2) & MEMMASK;
+        chip8->fault_address = address;
+    }
+}
+
 // Functions
-void C8Initialise(Chip8*);
-void C8SetupInput(Chip8*);
-void C8GetInput(Chip8*);
+void C8InitialiseImage(C8Image*);
+// Pre-decodes the ROM and returns the bytes loaded
+uint32_t LoadROM(C8Image*, const char*);
+void C8DestroyPagePool(C8PagePool*);
+void C8ReportFault(Chip8*);
+void C8Initialise(Chip8*, const C8Image*, C8PagePool*);
+void C8ReleasePages(Chip8*);
+// Copies an instance holding no private pages of its own, the copy gets its
+// own copies of the private pages
+void C8CopyInstance(Chip8* to, const Chip8* from);
+Chip8* C8CreateInstances(uint32_t count, const C8Image*, C8PagePool*);
+void C8DestroyInstances(Chip8*, uint32_t count);
 void C8EmulateCycle(Chip8*);
-void C8DecrementCounters(Chip8*);
+void C8EmulateFrame(Chip8*, uint32_t cycles);
+void C8TickTimers(Chip8*);
+
+// Same as running C8EmulateFrame for each frame while the chip waits in FX0A
+// with no key down
+void C8SkipKeyWaitFrames(Chip8*, uint32_t frames, uint32_t cycles);
 
 #endif
\ No newline at end of file
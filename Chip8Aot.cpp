@@ -0,0 +1,423 @@
+#include <cstring>
+#include <cstdio>
+
+#include "Chip8Aot.h"
+#include "Chip8Cfg.h"
+#include "opcodes.h"
+
+#include <vector>
+
+bool C8AotMatches(const Chip8* chip8, uint16_t address, const uint8_t* bytes, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; ++i)
+    {
+        if(C8ReadMemory(chip8, address + i) != bytes[i])
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+struct C8AotBlock
+{
+    uint16_t start;
+    uint16_t end;
+};
+
+// Leaves the block for target, straight to its label when it has one
+static void C8EmitGoto(FILE* file, const std::vector<bool>& is_block, uint32_t target, const char* indent)
+{
+    if(target < MEMSIZE && is_block[target])
+        fprintf(file, "%sgoto block_%03X;\n", indent, target);
+    else
+        fprintf(file, "%s{ pc = 0x%03X; goto dispatch; }\n", indent, target);
+}
+
+// True for a jump at address back to FX07 then 3XKK or 4XKK at target, the
+// timer waits C8SkipTimerLoop skips in the interpreter
+static bool C8AotIsTimerWait(const uint8_t* memory, uint32_t target, uint32_t address)
+{
+    if(target < ROM_START || target + 4 != address)
+    {
+        return false;
+    }
+    
+    uint16_t read_timer = C8ReadImageOpcode(memory, target);
+    uint16_t skip = C8ReadImageOpcode(memory, target + 2);
+    return (read_timer & 0xF0FF) == 0xF007 &&
+           ((skip & 0xF000) == 0x3000 || (skip & 0xF000) == 0x4000) &&
+           (skip & 0x0F00) == (read_timer & 0x0F00);
+}
+
+// Translates the instruction at address, the last one in a block is the only
+// one allowed to leave it
+static void C8EmitInstruction(FILE* file, const uint8_t* memory, const std::vector<bool>& is_block, uint32_t address, uint16_t opcode, bool last)
+{
+    uint32_t x = (opcode & 0x0F00) >> 8;
+    uint32_t y = (opcode & 0x00F0) >> 4;
+    uint32_t n = opcode & 0x000F;
+    uint32_t nn = opcode & 0x00FF;
+    uint32_t nnn = opcode & 0x0FFF;
+    uint32_t next = address + 2;
+    uint8_t id = C8Decode(opcode);
+    
+    char text[32];
+    C8FormatInstruction(text, sizeof(text), opcode);
+    fprintf(file, "    // 0x%03X  %s\n", address, text);
+    
+    switch(id)
+    {
+        case C8_OP_CLS:
+        fprintf(file, "    memset(chip8->gfx, 0, sizeof(chip8->gfx));\n");
+        break;
+        
+        case C8_OP_RET:
+        fprintf(file, "    --chip8->sp;\n");
+        fprintf(file, "    pc = chip8->stack[chip8->sp & (STACKSIZE - 1)];\n");
+        fprintf(file, "    chip8->stack[chip8->sp & (STACKSIZE - 1)] = 0;\n");
+        fprintf(file, "    goto dispatch;\n");
+        break;
+        
+        case C8_OP_SYS:
+        break;
+        
+        case C8_OP_JP:
+        if(C8AotIsTimerWait(memory, nnn, address))
+        {
+            // Back to the top of a loop polling the delay timer. The timer only
+            // changes between frames, so once it won't exit skip the rest of
+            // the frame leaving the chip where the interpreter's skip does
+            uint16_t skip = C8ReadImageOpcode(memory, nnn + 2);
+            uint32_t pages = (1 << (nnn >> C8_PAGE_SHIFT)) | (1 << ((nnn + 5) >> C8_PAGE_SHIFT));
+            fprintf(file, "    if(budget != 0 && chip8->delay_timer %s 0x%02X &&\n", (skip & 0xF000) == 0x3000 ? "!=" : "==", skip & 0x00FF);
+            fprintf(file, "       (!(chip8->private_pages & 0x%X) || C8AotMatches(chip8, 0x%03X, &c8_aot_rom[0x%03X], 6)))\n",
+                    pages, nnn, nnn - ROM_START);
+            fprintf(file, "    {\n");
+            fprintf(file, "        v%x = chip8->delay_timer;\n", (skip & 0x0F00) >> 8);
+            fprintf(file, "        pc = 0x%03X + (budget %% 3) * 2;\n", nnn);
+            fprintf(file, "        chip8->idle = C8_IDLE_TIMER;\n");
+            fprintf(file, "        chip8->cycles_skipped += budget;\n");
+            fprintf(file, "        budget = 0;\n");
+            fprintf(file, "        goto done;\n");
+            fprintf(file, "    }\n");
+        }
+        C8EmitGoto(file, is_block, nnn, "    ");
+        break;
+        
+        case C8_OP_CALL:
+        fprintf(file, "    chip8->stack[chip8->sp & (STACKSIZE - 1)] = 0x%03X;\n", next & MEMMASK);
+        fprintf(file, "    ++chip8->sp;\n");
+        C8EmitGoto(file, is_block, nnn, "    ");
+        break;
+        
+        case C8_OP_SE_VX_NN:
+        case C8_OP_SNE_VX_NN:
+        case C8_OP_SE_VX_VY:
+        case C8_OP_SNE_VX_VY:
+        case C8_OP_SKP:
+        case C8_OP_SKNP:
+        if(id == C8_OP_SE_VX_NN)
+            fprintf(file, "    if(v%x == 0x%02X)\n", x, nn);
+        else if(id == C8_OP_SNE_VX_NN)
+            fprintf(file, "    if(v%x != 0x%02X)\n", x, nn);
+        else if(id == C8_OP_SE_VX_VY)
+            fprintf(file, "    if(v%x == v%x)\n", x, y);
+        else if(id == C8_OP_SNE_VX_VY)
+            fprintf(file, "    if(v%x != v%x)\n", x, y);
+        else
+        {
+            fprintf(file, "    chip8->keys_read = true;\n");
+            fprintf(file, "    if(%s(chip8->keys & (1 << (v%x & (MAX_KEYS - 1)))))\n", id == C8_OP_SKP ? "" : "!", x);
+        }
+        C8EmitGoto(file, is_block, next + 2, "        ");
+        C8EmitGoto(file, is_block, next, "    ");
+        break;
+        
+        case C8_OP_LD_VX_NN:
+        fprintf(file, "    v%x = 0x%02X;\n", x, nn);
+        break;
+        
+        case C8_OP_ADD_VX_NN:
+        fprintf(file, "    v%x += 0x%02X;\n", x, nn);
+        break;
+        
+        // The flag is set before the result is written, as the interpreter
+        // does, so the same thing happens when X or Y is F
+        case C8_OP_LD_VX_VY:
+        fprintf(file, "    v%x = v%x;\n", x, y);
+        break;
+        
+        case C8_OP_OR:
+        fprintf(file, "    v%x |= v%x;\n", x, y);
+        break;
+        
+        case C8_OP_AND:
+        fprintf(file, "    v%x &= v%x;\n", x, y);
+        break;
+        
+        case C8_OP_XOR:
+        fprintf(file, "    v%x ^= v%x;\n", x, y);
+        break;
+        
+        case C8_OP_ADD_VX_VY:
+        fprintf(file, "    vf = v%x > (0xFF - v%x) ? 1 : 0;\n", x, y);
+        fprintf(file, "    v%x += v%x;\n", x, y);
+        break;
+        
+        case C8_OP_SUB:
+        fprintf(file, "    vf = v%x <= v%x ? 0 : 1;\n", x, y);
+        fprintf(file, "    v%x -= v%x;\n", x, y);
+        break;
+        
+        case C8_OP_SHR:
+        fprintf(file, "    vf = v%x & 0x01;\n", y);
+        fprintf(file, "    v%x = v%x >> 1;\n", x, y);
+        break;
+        
+        case C8_OP_SUBN:
+        fprintf(file, "    vf = v%x < v%x ? 0 : 1;\n", y, x);
+        fprintf(file, "    v%x = v%x - v%x;\n", x, y, x);
+        break;
+        
+        case C8_OP_SHL:
+        fprintf(file, "    vf = v%x >> 7;\n", y);
+        fprintf(file, "    v%x = v%x << 1;\n", y, y);
+        fprintf(file, "    v%x = v%x;\n", x, y);
+        break;
+        
+        case C8_OP_LD_I:
+        fprintf(file, "    i = 0x%03X;\n", nnn);
+        break;
+        
+        case C8_OP_JP_V0:
+        fprintf(file, "    pc = 0x%03X + v0;\n", nnn);
+        fprintf(file, "    goto dispatch;\n");
+        break;
+        
+        case C8_OP_RND:
+        fprintf(file, "    v%x = 0x%02X & (rand() %% 255);\n", x, nn);
+        break;
+        
+        case C8_OP_DRW:
+        // VF is cleared before VX and VY are read
+        fprintf(file, "    vf = 0;\n");
+        fprintf(file, "    vf = C8DrawSprite(chip8, v%x, v%x, i, %u);\n", x, y, n);
+        break;
+        
+        case C8_OP_LD_VX_DT:
+        fprintf(file, "    v%x = chip8->delay_timer;\n", x);
+        break;
+        
+        case C8_OP_LD_VX_K:
+        // With no key down it repeats for the rest of the frame
+        fprintf(file, "    chip8->keys_read = true;\n");
+        fprintf(file, "    if(!chip8->keys)\n");
+        fprintf(file, "    {\n");
+        fprintf(file, "        pc = 0x%03X;\n", address);
+        fprintf(file, "        chip8->idle = C8_IDLE_KEY;\n");
+        fprintf(file, "        chip8->cycles_skipped += budget;\n");
+        fprintf(file, "        budget = 0;\n");
+        fprintf(file, "        goto done;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    v%x = __builtin_ctz(chip8->keys);\n", x);
+        break;
+        
+        case C8_OP_LD_DT_VX:
+        fprintf(file, "    chip8->delay_timer = v%x;\n", x);
+        break;
+        
+        case C8_OP_LD_ST_VX:
+        fprintf(file, "    chip8->sound_timer = v%x;\n", x);
+        break;
+        
+        case C8_OP_ADD_I_VX:
+        fprintf(file, "    vf = ((uint32_t)i + v%x) > 0xFFF ? 1 : 0;\n", x);
+        fprintf(file, "    i += v%x;\n", x);
+        break;
+        
+        case C8_OP_LD_F_VX:
+        fprintf(file, "    i = v%x * 5;\n", x);
+        break;
+        
+        case C8_OP_LD_B_VX:
+        fprintf(file, "    C8WriteMemory(chip8, (i & MEMMASK) + 0, v%x / 100);\n", x);
+        fprintf(file, "    C8WriteMemory(chip8, (i & MEMMASK) + 1, (v%x / 10) %% 10);\n", x);
+        fprintf(file, "    C8WriteMemory(chip8, (i & MEMMASK) + 2, (v%x %% 100) %% 10);\n", x);
+        break;
+        
+        case C8_OP_LD_MEM_VX:
+        for(uint32_t v = 0; v <= x; ++v)
+            fprintf(file, "    C8WriteMemory(chip8, (i & MEMMASK) + %u, v%x);\n", v, v);
+        break;
+        
+        case C8_OP_LD_VX_MEM:
+        for(uint32_t v = 0; v <= x; ++v)
+            fprintf(file, "    v%x = C8ReadMemory(chip8, (i & MEMMASK) + %u);\n", v, v);
+        break;
+        
+        default:
+        // Not an instruction, let the interpreter raise the fault. It is
+        // always last in its block, give its cycle back first
+        fprintf(file, "    budget += 1;\n");
+        fprintf(file, "    pc = 0x%03X;\n", address);
+        fprintf(file, "    goto interpret;\n");
+        return;
+    }
+    
+    // Blocks that end without leaving carry on to the next
+    if(last && opcode_info[id].flow == C8_FLOW_NEXT)
+    {
+        C8EmitGoto(file, is_block, next, "    ");
+    }
+}
+
+void C8TranslateROM(FILE* file, const uint8_t* memory, uint32_t rom_size, const char* name)
+{
+    C8Analysis analysis;
+    C8AnalyseROM(&analysis, memory, rom_size);
+    
+    C8Cfg cfg;
+    C8BuildCfg(&cfg, &analysis, memory);
+    
+    // Blocks from the graph, split after every memory write so the next
+    // block checks it is still running the code it was translated from, and
+    // after every key wait so a wait leaves the rest of the budget unspent
+    std::vector<C8AotBlock> blocks;
+    std::vector<bool> is_block(MEMSIZE, false);
+    for(const C8Block& block : cfg.blocks)
+    {
+        C8AotBlock current;
+        current.start = block.start;
+        for(uint32_t address = block.start; address < block.end; address += 2)
+        {
+            uint8_t id = C8Decode(C8ReadImageOpcode(memory, address));
+            if((id == C8_OP_LD_B_VX || id == C8_OP_LD_MEM_VX || id == C8_OP_LD_VX_K) && address + 2 < block.end)
+            {
+                current.end = address + 2;
+                blocks.push_back(current);
+                current.start = address + 2;
+            }
+        }
+        current.end = block.end;
+        blocks.push_back(current);
+    }
+    
+    for(const C8AotBlock& block : blocks)
+    {
+        is_block[block.start] = true;
+    }
+    
+    fprintf(file, "// Translated from %s by Chip8Aot\n\n", name);
+    fprintf(file, "#include <cstring>\n");
+    fprintf(file, "#include <cstdlib>\n\n");
+    fprintf(file, "#include \"Chip8Aot.h\"\n");
+    fprintf(file, "#include \"opcodes.h\"\n\n");
+    
+    fprintf(file, "const char* const c8_aot_rom_name = \"");
+    for(const char* c = name; *c; ++c)
+    {
+        fprintf(file, (*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+    }
+    fprintf(file, "\";\n");
+    fprintf(file, "const uint32_t c8_aot_rom_size = %u;\n", rom_size);
+    fprintf(file, "const uint8_t c8_aot_rom[] =\n{");
+    for(uint32_t i = 0; i < rom_size; ++i)
+    {
+        fprintf(file, "%s0x%02X,", (i % 16) ? " " : "\n    ", memory[ROM_START + i]);
+    }
+    fprintf(file, "\n};\n\n");
+    
+    // One bit per address, set where a block starts
+    fprintf(file, "// Where the interpreter hands back to translated code\n");
+    fprintf(file, "static const uint8_t c8_aot_block_starts[MEMSIZE / 8] =\n{");
+    for(uint32_t byte = 0; byte < MEMSIZE / 8; ++byte)
+    {
+        uint8_t bits = 0;
+        for(uint32_t bit = 0; bit < 8; ++bit)
+        {
+            if(is_block[byte * 8 + bit])
+                bits |= 1 << bit;
+        }
+        fprintf(file, "%s0x%02X,", (byte % 16) ? " " : "\n    ", bits);
+    }
+    fprintf(file, "\n};\n\n");
+    
+    fprintf(file, "#define SPILL() \\\n");
+    for(uint32_t v = 0; v < REGISTERCOUNT; ++v)
+        fprintf(file, "    chip8->V[0x%X] = v%x; \\\n", v, v);
+    fprintf(file, "    chip8->I = i; \\\n    chip8->pc = pc;\n\n");
+    
+    fprintf(file, "#define RELOAD() \\\n");
+    for(uint32_t v = 0; v < REGISTERCOUNT; ++v)
+        fprintf(file, "    v%x = chip8->V[0x%X]; \\\n", v, v);
+    fprintf(file, "    i = chip8->I; \\\n    pc = chip8->pc;\n\n");
+    
+    fprintf(file, "// Runs exactly cycles instructions\n");
+    fprintf(file, "static void C8AotRun(Chip8* chip8, uint32_t cycles)\n{\n");
+    fprintf(file, "    uint8_t v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, va, vb, vc, vd, ve, vf;\n");
+    fprintf(file, "    uint16_t i;\n");
+    fprintf(file, "    uint16_t pc;\n");
+    fprintf(file, "    uint32_t budget = cycles;\n");
+    fprintf(file, "    RELOAD();\n\n");
+    
+    fprintf(file, "dispatch:\n");
+    fprintf(file, "    if(budget == 0)\n        goto done;\n\n");
+    fprintf(file, "    switch(pc)\n    {\n");
+    for(const C8AotBlock& block : blocks)
+    {
+        fprintf(file, "        case 0x%03X: goto block_%03X;\n", block.start, block.start);
+    }
+    fprintf(file, "        default: goto interpret;\n");
+    fprintf(file, "    }\n\n");
+    
+    fprintf(file, "fallback:\n");
+    fprintf(file, "    if(budget == 0)\n        goto done;\n\n");
+    fprintf(file, "interpret:\n");
+    fprintf(file, "    // Stays in the interpreter until it reaches a block\n");
+    fprintf(file, "    SPILL();\n");
+    fprintf(file, "    do\n    {\n");
+    fprintf(file, "        --budget;\n");
+    fprintf(file, "        if(C8AotInterpret(chip8, budget))\n");
+    fprintf(file, "            budget = 0;\n");
+    fprintf(file, "    } while(budget != 0 && !(c8_aot_block_starts[(chip8->pc & MEMMASK) >> 3] & (1 << (chip8->pc & 7))));\n");
+    fprintf(file, "    RELOAD();\n");
+    fprintf(file, "    goto dispatch;\n\n");
+    
+    for(const C8AotBlock& block : blocks)
+    {
+        uint32_t length = (block.end - block.start) / 2;
+        uint32_t pages = 0;
+        for(uint32_t page = block.start >> C8_PAGE_SHIFT; page <= (uint32_t)(block.end - 1) >> C8_PAGE_SHIFT; ++page)
+        {
+            pages |= 1 << page;
+        }
+        
+        fprintf(file, "block_%03X:\n", block.start);
+        fprintf(file, "    if(budget < %u || ((chip8->private_pages & 0x%X) && !C8AotMatches(chip8, 0x%03X, &c8_aot_rom[0x%03X], %u)))\n",
+                length, pages, block.start, block.start - ROM_START, block.end - block.start);
+        fprintf(file, "    {\n        pc = 0x%03X;\n        goto fallback;\n    }\n", block.start);
+        fprintf(file, "    budget -= %u;\n", length);
+        
+        for(uint32_t address = block.start; address < block.end; address += 2)
+        {
+            C8EmitInstruction(file, memory, is_block, address, C8ReadImageOpcode(memory, address), address + 2 >= block.end);
+        }
+        fprintf(file, "\n");
+    }
+    
+    fprintf(file, "done:\n");
+    fprintf(file, "    SPILL();\n");
+    fprintf(file, "}\n\n");
+    
+    fprintf(file, "void C8AotEmulateFrame(Chip8* chip8, uint32_t cycles)\n{\n");
+    fprintf(file, "    // A faulted chip stays halted\n");
+    fprintf(file, "    if(chip8->fault != C8_FAULT_NONE)\n        return;\n\n");
+    fprintf(file, "    chip8->idle = C8_IDLE_NONE;\n");
+    fprintf(file, "    chip8->keys_read = false;\n\n");
+    fprintf(file, "    C8AotRun(chip8, cycles);\n\n");
+    fprintf(file, "    chip8->cycles += cycles;\n");
+    fprintf(file, "    C8TickTimers(chip8);\n");
+    fprintf(file, "}\n");
+}
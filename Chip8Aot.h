@@ -0,0 +1,43 @@
+#ifndef _CHIP8AOT_H
+#define _CHIP8AOT_H
+
+#include <stdint.h>
+#include <cstdio>
+
+#include "Chip8.h"
+
+// Ahead of time translation of a ROM into C++. Each basic block of the
+// control flow graph becomes a label, with the registers held in locals and
+// gotos between blocks. A block only runs translated while there are enough
+// cycles left in the frame for all of it and memory still holds the code it
+// was translated from, otherwise its instructions go through the interpreter
+// one at a time. Computed jumps and returns go through a switch over the
+// block addresses, anything that isn't a block start is interpreted until it
+// reaches one.
+// Translated code follows the unchecked build, out of range accesses are
+// masked rather than trapped. chip8->opcode is only updated by instructions
+// that go through the interpreter, translated blocks leave it as it was
+
+// Writes the translation of a ROM loaded at 0x200 in memory
+void C8TranslateROM(FILE* file, const uint8_t* memory, uint32_t rom_size, const char* name);
+
+// Helpers the translated code calls into
+
+// Runs the instruction at pc through the interpreter without counting it.
+// Returns true if it left the chip waiting on the delay timer or a key for
+// the remaining cycles of the frame, with idle and cycles_skipped set as
+// C8EmulateFrame sets them
+bool C8AotInterpret(Chip8* chip8, uint32_t remaining);
+
+// True if memory still holds the bytes given at address
+bool C8AotMatches(const Chip8* chip8, uint16_t address, const uint8_t* bytes, uint32_t length);
+
+// Defined by the translated source
+extern const uint8_t c8_aot_rom[];
+extern const uint32_t c8_aot_rom_size;
+extern const char* const c8_aot_rom_name;
+
+// Same as C8EmulateFrame, running the translated code
+void C8AotEmulateFrame(Chip8* chip8, uint32_t cycles);
+
+#endif
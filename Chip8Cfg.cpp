@@ -0,0 +1,292 @@
+#include <cstring>
+#include <cstdio>
+
+#include "Chip8Cfg.h"
+#include "opcodes.h"
+
+static void C8AddEdge(C8Block* block, uint32_t target, uint8_t kind)
+{
+    block->edges[block->edge_count].target = target & MEMMASK;
+    block->edges[block->edge_count].kind = kind;
+    ++block->edge_count;
+}
+
+void C8BuildCfg(C8Cfg* cfg, const C8Analysis* analysis, const uint8_t* memory)
+{
+    cfg->blocks.clear();
+    cfg->subroutines.clear();
+    cfg->loops = 0;
+    cfg->computed_jumps = analysis->computed_jumps;
+    
+    // Blocks start at the ROM start, labels and after anything that isn't
+    // straight line code
+    bool leader[MEMSIZE] = {};
+    leader[ROM_START] = true;
+    for(uint32_t address = ROM_START; address < analysis->rom_end; ++address)
+    {
+        if(!(analysis->flags[address] & C8_BYTE_CODE))
+            continue;
+        
+        if(analysis->flags[address] & C8_BYTE_LABEL)
+            leader[address] = true;
+        
+        uint8_t flow = opcode_info[C8Decode(C8ReadImageOpcode(memory, address))].flow;
+        if(flow != C8_FLOW_NEXT && address + 2 < MEMSIZE)
+            leader[address + 2] = true;
+    }
+    
+    std::vector<int32_t> block_at(MEMSIZE, -1);
+    for(uint32_t address = ROM_START; address < analysis->rom_end; ++address)
+    {
+        if(!leader[address] || !(analysis->flags[address] & C8_BYTE_CODE))
+            continue;
+        
+        C8Block block = {};
+        block.start = address;
+        block.subroutine = ROM_START;
+        
+        uint32_t end = address;
+        for(;;)
+        {
+            uint16_t opcode = C8ReadImageOpcode(memory, end);
+            block.exit = opcode_info[C8Decode(opcode)].flow;
+            end += 2;
+            
+            if(block.exit != C8_FLOW_NEXT || end >= analysis->rom_end ||
+               leader[end] || !(analysis->flags[end] & C8_BYTE_CODE))
+            {
+                break;
+            }
+        }
+        block.end = end;
+        
+        uint16_t last = C8ReadImageOpcode(memory, end - 2);
+        switch(block.exit)
+        {
+            case C8_FLOW_NEXT:
+            // Runs into the next block, unless it ran off the code
+            if(end < analysis->rom_end && (analysis->flags[end] & C8_BYTE_CODE))
+                C8AddEdge(&block, end, C8_EDGE_NEXT);
+            break;
+            
+            case C8_FLOW_SKIP:
+            C8AddEdge(&block, end, C8_EDGE_NEXT);
+            C8AddEdge(&block, end + 2, C8_EDGE_SKIP);
+            break;
+            
+            case C8_FLOW_JUMP:
+            C8AddEdge(&block, last & 0x0FFF, C8_EDGE_JUMP);
+            break;
+            
+            case C8_FLOW_CALL:
+            C8AddEdge(&block, last & 0x0FFF, C8_EDGE_CALL);
+            C8AddEdge(&block, end, C8_EDGE_NEXT);
+            break;
+            
+            default:
+            break;
+        }
+        
+        block_at[address] = cfg->blocks.size();
+        cfg->blocks.push_back(block);
+    }
+    
+    // Edges can point outside the ROM or at code that was never decoded,
+    // drop those so every edge leads to a block
+    for(C8Block& block : cfg->blocks)
+    {
+        uint8_t kept = 0;
+        for(uint8_t e = 0; e < block.edge_count; ++e)
+        {
+            if(block_at[block.edges[e].target] >= 0)
+                block.edges[kept++] = block.edges[e];
+        }
+        block.edge_count = kept;
+    }
+    
+    if(cfg->blocks.empty())
+    {
+        return;
+    }
+    
+    // Depth first from the start, an edge back to a block still on the stack
+    // closes a loop
+    std::vector<uint8_t> state(cfg->blocks.size(), 0); // 0 unseen, 1 on the stack, 2 done
+    std::vector<std::pair<int32_t, uint8_t> > stack;
+    stack.push_back(std::make_pair(block_at[ROM_START], 0));
+    state[block_at[ROM_START]] = 1;
+    while(!stack.empty())
+    {
+        int32_t index = stack.back().first;
+        uint8_t edge = stack.back().second;
+        C8Block* block = &cfg->blocks[index];
+        
+        if(edge == block->edge_count)
+        {
+            state[index] = 2;
+            stack.pop_back();
+            continue;
+        }
+        
+        ++stack.back().second;
+        int32_t target = block_at[block->edges[edge].target];
+        if(state[target] == 0)
+        {
+            state[target] = 1;
+            stack.push_back(std::make_pair(target, 0));
+        }
+        else if(state[target] == 1 && !cfg->blocks[target].loop_header)
+        {
+            cfg->blocks[target].loop_header = true;
+            ++cfg->loops;
+        }
+    }
+    
+    // Subroutines own the blocks they reach without following calls, the
+    // main program claims first then each subroutine in address order
+    cfg->subroutines.push_back(ROM_START);
+    for(const C8Block& block : cfg->blocks)
+    {
+        if((analysis->flags[block.start] & C8_BYTE_SUBROUTINE) && block.start != ROM_START)
+            cfg->subroutines.push_back(block.start);
+    }
+    
+    std::vector<bool> owned(cfg->blocks.size(), false);
+    for(uint16_t entry : cfg->subroutines)
+    {
+        std::vector<int32_t> pending;
+        pending.push_back(block_at[entry]);
+        while(!pending.empty())
+        {
+            int32_t index = pending.back();
+            pending.pop_back();
+            if(owned[index])
+                continue;
+            
+            owned[index] = true;
+            C8Block* block = &cfg->blocks[index];
+            block->subroutine = entry;
+            
+            for(uint8_t e = 0; e < block->edge_count; ++e)
+            {
+                if(block->edges[e].kind != C8_EDGE_CALL)
+                    pending.push_back(block_at[block->edges[e].target]);
+            }
+        }
+    }
+}
+
+void C8WriteDot(FILE* file, const C8Cfg* cfg, const uint8_t* memory, const char* name)
+{
+    fprintf(file, "digraph \"%s\" {\n", name);
+    fprintf(file, "    node [shape=box fontname=\"monospace\"];\n");
+    
+    char text[32];
+    for(uint16_t entry : cfg->subroutines)
+    {
+        fprintf(file, "    subgraph cluster_%03X {\n", entry);
+        if(entry == ROM_START)
+            fprintf(file, "        label=\"main\";\n");
+        else
+            fprintf(file, "        label=\"sub_%03X\";\n", entry);
+        
+        for(const C8Block& block : cfg->blocks)
+        {
+            if(block.subroutine != entry)
+                continue;
+            
+            // One line per instruction, left aligned
+            fprintf(file, "        b%03X [label=\"", block.start);
+            for(uint32_t address = block.start; address < block.end; address += 2)
+            {
+                C8FormatInstruction(text, sizeof(text), C8ReadImageOpcode(memory, address));
+                fprintf(file, "0x%03X  %s\\l", address, text);
+            }
+            fprintf(file, "\"");
+            
+            if(block.loop_header)
+                fprintf(file, " peripheries=2");
+            if(block.exit == C8_FLOW_COMPUTED)
+                fprintf(file, " color=red");
+            fprintf(file, "];\n");
+        }
+        
+        fprintf(file, "    }\n");
+    }
+    
+    static const char* edge_styles[] =
+    {
+        "",                              // C8_EDGE_NEXT
+        " [style=dashed label=\"skip\"]", // C8_EDGE_SKIP
+        "",                              // C8_EDGE_JUMP
+        " [style=dotted label=\"call\"]", // C8_EDGE_CALL
+    };
+    
+    for(const C8Block& block : cfg->blocks)
+    {
+        for(uint8_t e = 0; e < block.edge_count; ++e)
+        {
+            fprintf(file, "    b%03X -> b%03X%s;\n", block.start, block.edges[e].target, edge_styles[block.edges[e].kind]);
+        }
+    }
+    
+    fprintf(file, "}\n");
+}
+
+void C8PredecodeImage(C8Image* image, const C8Cfg* cfg)
+{
+    for(const C8Block& block : cfg->blocks)
+    {
+        for(uint32_t address = block.start; address < block.end; address += 2)
+        {
+            // Validity is tracked per page, an instruction split across two
+            // is always fetched
+            if((address & C8_PAGE_MASK) == C8_PAGE_MASK)
+                continue;
+            
+            uint16_t opcode = C8ReadImageOpcode(image->memory, address);
+            image->decoded[address].opcode = opcode;
+            image->decoded[address].id = C8Decode(opcode);
+            image->decoded[address].dispatch = image->decoded[address].id;
+        }
+    }
+    
+    static_assert(C8_DISPATCH_FUSED + C8_FUSED_COUNT <= C8_DECODE_NONE, "Fused dispatch values overlap C8_DECODE_NONE");
+    
+    // Fuse sequences whose instructions were all decoded and sit on the same
+    // page, the ones inside are still decoded alone for anything jumping in
+    for(uint32_t address = ROM_START; address < MEMSIZE; ++address)
+    {
+        C8Decoded* decoded = &image->decoded[address];
+        if(decoded->id == C8_DECODE_NONE)
+            continue;
+        
+        for(uint8_t fused = 0; fused < C8_FUSED_COUNT; ++fused)
+        {
+            const C8FusedInfo* info = &fused_info[fused];
+            uint32_t last = address + info->length * 2 - 1;
+            if(last >= MEMSIZE || (last >> C8_PAGE_SHIFT) != (address >> C8_PAGE_SHIFT))
+                continue;
+            
+            uint8_t matched = 0;
+            while(matched < info->length && decoded[matched * 2].id == info->ids[matched])
+                ++matched;
+            
+            if(matched == info->length)
+            {
+                decoded->dispatch = C8_DISPATCH_FUSED + fused;
+                break;
+            }
+        }
+    }
+}
+
+void C8PredecodeROM(C8Image* image, uint32_t rom_size)
+{
+    C8Analysis analysis;
+    C8AnalyseROM(&analysis, image->memory, rom_size);
+    
+    C8Cfg cfg;
+    C8BuildCfg(&cfg, &analysis, image->memory);
+    C8PredecodeImage(image, &cfg);
+}
@@ -0,0 +1,74 @@
+#ifndef _CHIP8CFG_H
+#define _CHIP8CFG_H
+
+#include <stdint.h>
+#include <cstdio>
+
+#include "Chip8.h"
+#include "Chip8Disasm.h"
+
+#include <vector>
+
+// Control flow graph recovered from the code C8AnalyseROM finds. Blocks end
+// at any instruction that can pass control anywhere but the next one, skips
+// included, and at the start of any other block. BNNN targets depend on V0 so
+// blocks ending in one have no successors and are flagged instead
+enum C8EdgeKind
+{
+    C8_EDGE_NEXT, // Falls through, or returns from a call
+    C8_EDGE_SKIP, // Skips the next instruction
+    C8_EDGE_JUMP,
+    C8_EDGE_CALL,
+};
+
+struct C8Edge
+{
+    uint16_t target;
+    uint8_t kind; // One of C8EdgeKind
+};
+
+struct C8Block
+{
+    uint16_t start;
+    uint16_t end; // One past the last instruction
+    
+    C8Edge edges[2];
+    uint8_t edge_count;
+    
+    // C8Flow of the last instruction
+    uint8_t exit;
+    
+    // The target of a back edge
+    bool loop_header;
+    
+    // Entry of the subroutine the block was first reached from, 0x200 for
+    // the main program
+    uint16_t subroutine;
+};
+
+struct C8Cfg
+{
+    // In address order
+    std::vector<C8Block> blocks;
+    
+    // Entries, the main program first
+    std::vector<uint16_t> subroutines;
+    
+    uint32_t loops;
+    uint32_t computed_jumps;
+};
+
+void C8BuildCfg(C8Cfg* cfg, const C8Analysis* analysis, const uint8_t* memory);
+
+// Graphviz DOT, a cluster per subroutine, loop headers have a double border
+// and computed jumps are red
+void C8WriteDot(FILE* file, const C8Cfg* cfg, const uint8_t* memory, const char* name);
+
+// Decodes every instruction in the graph into the image so instances can skip
+// fetching and decoding them while they share the page
+void C8PredecodeImage(C8Image* image, const C8Cfg* cfg);
+
+// Analyses a ROM already in the image and pre-decodes it, run at load time
+void C8PredecodeROM(C8Image* image, uint32_t rom_size);
+
+#endif
@@ -0,0 +1,303 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8Debugger.h"
+#include "Chip8Disasm.h"
+
+void C8InitialiseDebugger(C8Debugger* debugger)
+{
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    debugger->memory_watches.clear();
+    debugger->register_watch = 0;
+    debugger->frame_cycle = 0;
+    debugger->steps = 0;
+    debugger->stopped = true;
+    debugger->resuming = false;
+    snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "Stopped at start");
+}
+
+void C8SetBreakpoint(C8Debugger* debugger, uint16_t address, bool set)
+{
+    address &= MEMMASK;
+    if(set)
+        debugger->breakpoints[address / 64] |= (1ULL << (address % 64));
+    else
+        debugger->breakpoints[address / 64] &= ~(1ULL << (address % 64));
+}
+
+void C8WatchMemory(C8Debugger* debugger, const Chip8* chip8, uint16_t address, uint16_t length)
+{
+    C8MemoryWatch watch;
+    watch.address = address & MEMMASK;
+    
+    for(uint32_t i = 0; i < length && (watch.address + i) < MEMSIZE; ++i)
+    {
+        watch.snapshot.push_back(C8ReadMemory(chip8, watch.address + i));
+    }
+    
+    debugger->memory_watches.push_back(watch);
+}
+
+void C8WatchRegister(C8Debugger* debugger, const Chip8* chip8, uint32_t reg)
+{
+    debugger->register_watch |= (1 << reg);
+    memcpy(debugger->V, chip8->V, sizeof(debugger->V));
+    debugger->I = chip8->I;
+}
+
+void C8DebugContinue(C8Debugger* debugger)
+{
+    debugger->stopped = false;
+    debugger->resuming = true;
+    debugger->steps = 0;
+}
+
+void C8DebugStep(C8Debugger* debugger, uint32_t steps)
+{
+    debugger->stopped = false;
+    debugger->resuming = true;
+    debugger->steps = steps;
+}
+
+bool C8DebugShouldStop(C8Debugger* debugger, const Chip8* chip8)
+{
+    if(debugger->stopped)
+    {
+        return true;
+    }
+    
+    if(debugger->resuming)
+    {
+        debugger->resuming = false;
+        return false;
+    }
+    
+    uint16_t pc = chip8->pc & MEMMASK;
+    if(debugger->breakpoints[pc / 64] & (1ULL << (pc % 64)))
+    {
+        debugger->stopped = true;
+        snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "Breakpoint at 0x%03X", pc);
+    }
+    
+    return debugger->stopped;
+}
+
+void C8DebugStepped(C8Debugger* debugger, const Chip8* chip8)
+{
+    if(debugger->steps && --debugger->steps == 0)
+    {
+        debugger->stopped = true;
+        snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "Stepped");
+    }
+    
+    // Watches stop after the instruction that changed them
+    for(C8MemoryWatch& watch : debugger->memory_watches)
+    {
+        for(uint32_t i = 0; i < watch.snapshot.size(); ++i)
+        {
+            uint8_t value = C8ReadMemory(chip8, watch.address + i);
+            if(value != watch.snapshot[i])
+            {
+                debugger->stopped = true;
+                snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "Memory 0x%03X changed 0x%02X -> 0x%02X",
+                         watch.address + i, watch.snapshot[i], value);
+                watch.snapshot[i] = value;
+            }
+        }
+    }
+    
+    if(debugger->register_watch)
+    {
+        for(uint32_t reg = 0; reg < REGISTERCOUNT; ++reg)
+        {
+            if((debugger->register_watch & (1 << reg)) && chip8->V[reg] != debugger->V[reg])
+            {
+                debugger->stopped = true;
+                snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "V%X changed 0x%02X -> 0x%02X",
+                         reg, debugger->V[reg], chip8->V[reg]);
+            }
+        }
+        
+        if((debugger->register_watch & (1 << C8_DEBUG_WATCH_I)) && chip8->I != debugger->I)
+        {
+            debugger->stopped = true;
+            snprintf(debugger->stop_reason, sizeof(debugger->stop_reason), "I changed 0x%03X -> 0x%03X",
+                     debugger->I, chip8->I);
+        }
+        
+        memcpy(debugger->V, chip8->V, sizeof(debugger->V));
+        debugger->I = chip8->I;
+    }
+}
+
+void C8PrintCallStack(const Chip8* chip8)
+{
+    // Each entry is the return address pushed by 2NNN, the call was just
+    // before it
+    printf("#0 0x%03X\n", chip8->pc);
+    
+    uint32_t depth = chip8->sp < STACKSIZE ? chip8->sp : STACKSIZE;
+    for(uint32_t frame = 0; frame < depth; ++frame)
+    {
+        uint16_t return_address = chip8->stack[depth - frame - 1];
+        printf("#%u 0x%03X (called from 0x%03X)\n", frame + 1, return_address, (return_address - 2) & MEMMASK);
+    }
+}
+
+static void C8DebugPrintMemory(const Chip8* chip8, uint16_t address, uint32_t length)
+{
+    for(uint32_t offset = 0; offset < length; offset += 16)
+    {
+        printf("0x%03X:", (address + offset) & MEMMASK);
+        for(uint32_t i = offset; i < offset + 16 && i < length; ++i)
+        {
+            printf(" %02X", C8ReadMemory(chip8, (address + i) & MEMMASK));
+        }
+        printf("\n");
+    }
+}
+
+static void C8DebugPrintInstructions(const Chip8* chip8, uint16_t address, uint32_t count)
+{
+    char text[32];
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t opcode = (C8ReadMemory(chip8, address & MEMMASK) << 8) | C8ReadMemory(chip8, (address + 1) & MEMMASK);
+        C8FormatInstruction(text, sizeof(text), opcode);
+        printf("%s0x%03X  %04X  %s\n", address == chip8->pc ? "> " : "  ", address, opcode, text);
+        address = (address + 2) & MEMMASK;
+    }
+}
+
+// Counts are decimal and at least 1, false for anything else
+static bool C8DebugParseCount(const char* text, uint32_t* count)
+{
+    char* end;
+    unsigned long value = strtoul(text, &end, 10);
+    if(text[0] < '0' || text[0] > '9' || *end != '\0' || value == 0 || value > UINT32_MAX)
+    {
+        printf("Bad count %s, counts are decimal and at least 1\n", text);
+        return false;
+    }
+    
+    *count = (uint32_t)value;
+    return true;
+}
+
+static void C8DebugPrintHelp()
+{
+    printf("s [N]         step N instructions (1)\n");
+    printf("c             continue\n");
+    printf("b ADDR        set a breakpoint\n");
+    printf("d ADDR        delete a breakpoint\n");
+    printf("w ADDR [LEN]  stop when memory changes (1 byte)\n");
+    printf("wv X          stop when VX changes\n");
+    printf("wi            stop when I changes\n");
+    printf("r             registers\n");
+    printf("bt            call stack\n");
+    printf("m ADDR [LEN]  show memory (16 bytes)\n");
+    printf("l [ADDR] [N]  list N instructions (8 from pc)\n");
+    printf("q             quit\n");
+}
+
+bool C8DebugRepl(Chip8* chip8, C8Debugger* debugger)
+{
+    char text[32];
+    uint16_t opcode = (C8ReadMemory(chip8, chip8->pc & MEMMASK) << 8) | C8ReadMemory(chip8, (chip8->pc + 1) & MEMMASK);
+    C8FormatInstruction(text, sizeof(text), opcode);
+    printf("%s, pc 0x%03X: %04X  %s\n", debugger->stop_reason, chip8->pc, opcode, text);
+    
+    char line[128];
+    for(;;)
+    {
+        printf("(chip8) ");
+        fflush(stdout);
+        
+        if(!fgets(line, sizeof(line), stdin))
+        {
+            return false;
+        }
+        
+        char command[8] = {};
+        char args[2][32] = {};
+        int count = sscanf(line, "%7s %31s %31s", command, args[0], args[1]);
+        if(count <= 0)
+        {
+            continue;
+        }
+        
+        // Addresses are hex, as everywhere else in the output, counts and
+        // lengths are decimal
+        uint32_t arg0 = count > 1 ? strtoul(args[0], nullptr, 16) : 0;
+        uint32_t arg1 = 0;
+        if(count > 2 && !C8DebugParseCount(args[1], &arg1))
+        {
+            continue;
+        }
+        
+        if(strcmp(command, "s") == 0)
+        {
+            // A count of 0 would run freely
+            uint32_t steps = 1;
+            if(count > 1 && !C8DebugParseCount(args[0], &steps))
+            {
+                continue;
+            }
+            
+            C8DebugStep(debugger, steps);
+            return true;
+        }
+        else if(strcmp(command, "c") == 0)
+        {
+            C8DebugContinue(debugger);
+            return true;
+        }
+        else if(strcmp(command, "b") == 0 && count > 1)
+        {
+            C8SetBreakpoint(debugger, arg0, true);
+        }
+        else if(strcmp(command, "d") == 0 && count > 1)
+        {
+            C8SetBreakpoint(debugger, arg0, false);
+        }
+        else if(strcmp(command, "w") == 0 && count > 1)
+        {
+            C8WatchMemory(debugger, chip8, arg0, count > 2 ? arg1 : 1);
+        }
+        else if(strcmp(command, "wv") == 0 && count > 1)
+        {
+            C8WatchRegister(debugger, chip8, arg0 & 0xF);
+        }
+        else if(strcmp(command, "wi") == 0)
+        {
+            C8WatchRegister(debugger, chip8, C8_DEBUG_WATCH_I);
+        }
+        else if(strcmp(command, "r") == 0)
+        {
+            DumpRegisters(chip8);
+            printf("Delay timer\t\t%X\n", chip8->delay_timer);
+            printf("Sound timer\t\t%X\n", chip8->sound_timer);
+        }
+        else if(strcmp(command, "bt") == 0)
+        {
+            C8PrintCallStack(chip8);
+        }
+        else if(strcmp(command, "m") == 0 && count > 1)
+        {
+            C8DebugPrintMemory(chip8, arg0, count > 2 ? arg1 : 16);
+        }
+        else if(strcmp(command, "l") == 0)
+        {
+            C8DebugPrintInstructions(chip8, count > 1 ? arg0 : chip8->pc, count > 2 ? arg1 : 8);
+        }
+        else if(strcmp(command, "q") == 0)
+        {
+            return false;
+        }
+        else
+        {
+            C8DebugPrintHelp();
+        }
+    }
+}
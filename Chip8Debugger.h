@@ -0,0 +1,86 @@
+#ifndef _CHIP8DEBUGGER_H
+#define _CHIP8DEBUGGER_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Chip8.h"
+
+// Interactive debugger for a single instance. C8DebugFrame runs the same
+// frame loop as C8EmulateFrame instantiated with hooks that check for
+// breakpoints before each instruction and watchpoints after, C8EmulateFrame
+// itself is instantiated without them so runs not under the debugger pay
+// nothing. Idle loop skipping is off under the debugger so every instruction
+// runs and can be stopped on
+#define C8_DEBUG_WATCH_I 16 // Register watch bit for I, V0-VF are bits 0-15
+
+struct C8MemoryWatch
+{
+    uint16_t address;
+    std::vector<uint8_t> snapshot;
+};
+
+struct C8Debugger
+{
+    // A bit per address
+    uint64_t breakpoints[MEMSIZE / 64];
+    
+    std::vector<C8MemoryWatch> memory_watches;
+    
+    // A bit per watched register, with their values after the last step
+    uint32_t register_watch;
+    uint8_t V[REGISTERCOUNT];
+    uint16_t I;
+    
+    // Instructions of the current frame already run
+    uint32_t frame_cycle;
+    
+    // Instructions left to single step, 0 to run freely
+    uint32_t steps;
+    
+    bool stopped;
+    char stop_reason[64];
+    
+    // Set on resuming so the breakpoint we are stopped on isn't hit again
+    bool resuming;
+};
+
+// Starts stopped before the first instruction
+void C8InitialiseDebugger(C8Debugger* debugger);
+
+void C8SetBreakpoint(C8Debugger* debugger, uint16_t address, bool set);
+void C8WatchMemory(C8Debugger* debugger, const Chip8* chip8, uint16_t address, uint16_t length);
+void C8WatchRegister(C8Debugger* debugger, const Chip8* chip8, uint32_t reg);
+
+void C8DebugContinue(C8Debugger* debugger);
+void C8DebugStep(C8Debugger* debugger, uint32_t steps);
+
+// Runs the rest of the frame unless the debugger stops it first. Returns true
+// once the frame is complete and the timers have ticked, false if it stopped
+bool C8DebugFrame(Chip8* chip8, C8Debugger* debugger, uint32_t cycles);
+
+void C8PrintCallStack(const Chip8* chip8);
+
+// Reads commands from stdin while stopped, returns once the chip should run
+// again or false when asked to quit
+bool C8DebugRepl(Chip8* chip8, C8Debugger* debugger);
+
+// Called by the frame loop, a stop before the instruction at pc
+bool C8DebugShouldStop(C8Debugger* debugger, const Chip8* chip8);
+void C8DebugStepped(C8Debugger* debugger, const Chip8* chip8);
+
+struct C8DebugHooks
+{
+    static const bool idle_skip = false;
+    
+    // Breakpoints can sit part way through a fused sequence
+    static const bool fuse = false;
+    
+    C8Debugger* debugger;
+    
+    bool Stop(const Chip8* chip8) { return C8DebugShouldStop(debugger, chip8); }
+    void Stepped(const Chip8* chip8) { C8DebugStepped(debugger, chip8); }
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include <cstring>
+#include <cstdio>
+
+#include "Chip8Disasm.h"
+#include "opcodes.h"
+
+#include <vector>
+
+static void C8AddTarget(C8Analysis* analysis, std::vector<uint16_t>* pending, uint32_t address, uint8_t flag)
+{
+    address &= MEMMASK;
+    analysis->flags[address] |= flag;
+    
+    if(!(analysis->flags[address] & C8_BYTE_CODE))
+    {
+        pending->push_back(address);
+    }
+}
+
+static void C8MarkData(C8Analysis* analysis, int32_t address, uint32_t length, uint8_t flag)
+{
+    // I is unknown
+    if(address < 0)
+    {
+        return;
+    }
+    
+    for(uint32_t i = 0; i < length && (address + i) < MEMSIZE; ++i)
+    {
+        analysis->flags[address + i] |= flag;
+    }
+}
+
+void C8AnalyseROM(C8Analysis* analysis, const uint8_t* memory, uint32_t rom_size)
+{
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->rom_end = ROM_START + rom_size < MEMSIZE ? ROM_START + rom_size : MEMSIZE;
+    
+    std::vector<uint16_t> pending;
+    C8AddTarget(analysis, &pending, ROM_START, C8_BYTE_LABEL);
+    
+    while(!pending.empty())
+    {
+        uint32_t address = pending.back();
+        pending.pop_back();
+        
+        // I as set by LD I earlier in this run of code, -1 when unknown
+        int32_t i = -1;
+        
+        // Run on until control leaves, the ROM ends or we meet code we have
+        // already been through
+        while(address >= ROM_START && address + 1 < analysis->rom_end &&
+              !(analysis->flags[address] & C8_BYTE_CODE))
+        {
+            analysis->flags[address] |= C8_BYTE_CODE;
+            analysis->flags[address + 1] |= C8_BYTE_OPERAND;
+            ++analysis->instructions;
+            
+            uint16_t opcode = C8ReadImageOpcode(memory, address);
+            uint8_t id = C8Decode(opcode);
+            uint16_t nnn = opcode & 0x0FFF;
+            uint8_t x = (opcode & 0x0F00) >> 8;
+            
+            switch(id)
+            {
+                case C8_OP_LD_I:
+                i = nnn;
+                analysis->flags[nnn] |= C8_BYTE_DATA_REF;
+                break;
+                
+                case C8_OP_ADD_I_VX:
+                case C8_OP_LD_F_VX:
+                i = -1;
+                break;
+                
+                case C8_OP_DRW:
+                C8MarkData(analysis, i, opcode & 0x000F, C8_BYTE_SPRITE);
+                break;
+                
+                case C8_OP_LD_B_VX:
+                C8MarkData(analysis, i, 3, C8_BYTE_DATA);
+                break;
+                
+                case C8_OP_LD_MEM_VX:
+                case C8_OP_LD_VX_MEM:
+                C8MarkData(analysis, i, x + 1, C8_BYTE_DATA);
+                break;
+                
+                default:
+                break;
+            }
+            
+            bool stop = false;
+            switch(opcode_info[id].flow)
+            {
+                case C8_FLOW_SKIP:
+                C8AddTarget(analysis, &pending, address + 4, C8_BYTE_LABEL);
+                break;
+                
+                case C8_FLOW_JUMP:
+                C8AddTarget(analysis, &pending, nnn, C8_BYTE_LABEL);
+                stop = true;
+                break;
+                
+                case C8_FLOW_CALL:
+                C8AddTarget(analysis, &pending, nnn, C8_BYTE_LABEL | C8_BYTE_SUBROUTINE);
+                break;
+                
+                case C8_FLOW_COMPUTED:
+                // Where it lands depends on V0, only the base is known
+                analysis->flags[nnn] |= C8_BYTE_LABEL;
+                ++analysis->computed_jumps;
+                stop = true;
+                break;
+                
+                case C8_FLOW_RETURN:
+                stop = true;
+                break;
+                
+                case C8_FLOW_STOP:
+                ++analysis->bad_opcodes;
+                stop = true;
+                break;
+                
+                default:
+                break;
+            }
+            
+            if(stop)
+            {
+                break;
+            }
+            
+            address += 2;
+        }
+    }
+}
+
+int C8FormatInstruction(char* buffer, size_t size, uint16_t opcode)
+{
+    const C8OpcodeInfo* info = &opcode_info[C8Decode(opcode)];
+    
+    uint32_t x = (opcode & 0x0F00) >> 8;
+    uint32_t y = (opcode & 0x00F0) >> 4;
+    
+    switch(info->operands)
+    {
+        case C8_OPERANDS_NNN:
+        return snprintf(buffer, size, info->format, opcode & 0x0FFF);
+        
+        case C8_OPERANDS_X:
+        return snprintf(buffer, size, info->format, x);
+        
+        case C8_OPERANDS_XNN:
+        return snprintf(buffer, size, info->format, x, opcode & 0x00FF);
+        
+        case C8_OPERANDS_XY:
+        return snprintf(buffer, size, info->format, x, y);
+        
+        case C8_OPERANDS_XYN:
+        return snprintf(buffer, size, info->format, x, y, opcode & 0x000F);
+        
+        case C8_OPERANDS_OPCODE:
+        return snprintf(buffer, size, info->format, opcode);
+        
+        default:
+        return snprintf(buffer, size, "%s", info->format);
+    }
+}
+
+static void C8WriteLabel(FILE* file, uint8_t flags, uint32_t address)
+{
+    if(flags & C8_BYTE_SUBROUTINE)
+        fprintf(file, "sub_%03X:\n", address);
+    else if(flags & C8_BYTE_LABEL)
+        fprintf(file, "L%03X:\n", address);
+    else if(flags & C8_BYTE_DATA_REF)
+        fprintf(file, "D%03X:\n", address);
+}
+
+void C8WriteListing(FILE* file, const C8Analysis* analysis, const uint8_t* memory)
+{
+    fprintf(file, "; %u bytes, %u instructions, %u computed jumps, %u bad opcodes\n",
+            analysis->rom_end - ROM_START, analysis->instructions,
+            analysis->computed_jumps, analysis->bad_opcodes);
+    
+    char text[32];
+    uint32_t address = ROM_START;
+    while(address < analysis->rom_end)
+    {
+        uint8_t flags = analysis->flags[address];
+        C8WriteLabel(file, flags, address);
+        
+        if(flags & C8_BYTE_CODE)
+        {
+            uint16_t opcode = C8ReadImageOpcode(memory, address);
+            uint8_t id = C8Decode(opcode);
+            C8FormatInstruction(text, sizeof(text), opcode);
+            
+            const char* note = "";
+            if(id == C8_OP_LD_I && (analysis->flags[opcode & 0x0FFF] & C8_BYTE_SPRITE))
+                note = "; sprite";
+            else if(id == C8_OP_LD_I && (analysis->flags[opcode & 0x0FFF] & C8_BYTE_DATA))
+                note = "; data";
+            else if(id == C8_OP_JP_V0)
+                note = "; computed jump";
+            else if(id == C8_OP_BAD)
+                note = "; not an instruction";
+            
+            if(*note)
+                fprintf(file, "0x%03X  %04X  %-20s%s\n", address, opcode, text, note);
+            else
+                fprintf(file, "0x%03X  %04X  %s\n", address, opcode, text);
+            address += 2;
+        }
+        else
+        {
+            // Sprite rows are drawn out to make them easy to pick out
+            uint8_t value = memory[address];
+            fprintf(file, "0x%03X  %02X    DB 0x%02X", address, value, value);
+            if(flags & C8_BYTE_SPRITE)
+            {
+                fprintf(file, "             ; ");
+                for(int bit = 7; bit >= 0; --bit)
+                {
+                    fputc((value >> bit) & 1 ? '#' : '.', file);
+                }
+            }
+            fprintf(file, "\n");
+            address += 1;
+        }
+    }
+}
+
+void C8CountSequences(C8SequenceCounts* counts, const C8Analysis* analysis, const uint8_t* memory)
+{
+    counts->pairs.resize(C8_OP_COUNT * C8_OP_COUNT);
+    counts->triples.resize(C8_OP_COUNT * C8_OP_COUNT * C8_OP_COUNT);
+    
+    for(uint32_t address = ROM_START; address + 4 <= analysis->rom_end; ++address)
+    {
+        // Each instruction but the last has to be able to run on into the
+        // next, bad opcodes are never part of one
+        uint8_t ids[3];
+        uint32_t length = 0;
+        while(length < 3 && address + length * 2 + 1 < analysis->rom_end &&
+              (analysis->flags[address + length * 2] & C8_BYTE_CODE))
+        {
+            uint8_t id = C8Decode(C8ReadImageOpcode(memory, address + length * 2));
+            if(id == C8_OP_BAD)
+                break;
+            
+            ids[length++] = id;
+            
+            uint8_t flow = opcode_info[id].flow;
+            if(flow != C8_FLOW_NEXT && flow != C8_FLOW_SKIP)
+                break;
+        }
+        
+        if(length >= 2)
+            ++counts->pairs[ids[0] * C8_OP_COUNT + ids[1]];
+        if(length >= 3)
+            ++counts->triples[(ids[0] * C8_OP_COUNT + ids[1]) * C8_OP_COUNT + ids[2]];
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _CHIP8DISASM_H
+#define _CHIP8DISASM_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdio>
+
+#include "Chip8.h"
+
+#include <vector>
+
+// First byte a ROM is loaded at
+#define ROM_START 0x200
+
+// Big endian opcode at address in a ROM image, memory is at least MEMSIZE
+// bytes
+inline uint16_t C8ReadImageOpcode(const uint8_t* memory, uint32_t address)
+{
+    return (memory[address] << 8) | memory[address + 1];
+}
+
+// Disassembler driven by the same opcode table as the interpreter. Code is
+// told apart from data by following control flow from 0x200, anything never
+// reached is listed as data. Sprites are found from LD I followed by DRW in
+// the same run of code, which covers how almost every ROM draws
+enum C8ByteFlags
+{
+    C8_BYTE_CODE = 0x01,       // First byte of a reachable instruction
+    C8_BYTE_OPERAND = 0x02,    // Second byte of a reachable instruction
+    C8_BYTE_LABEL = 0x04,      // Jumped or skipped to
+    C8_BYTE_SUBROUTINE = 0x08, // Called
+    C8_BYTE_DATA_REF = 0x10,   // Loaded into I
+    C8_BYTE_SPRITE = 0x20,     // Drawn by DRW
+    C8_BYTE_DATA = 0x40,       // Read or written through I by FX33, FX55 or FX65
+};
+
+struct C8Analysis
+{
+    uint8_t flags[MEMSIZE];
+    
+    // One past the last byte of the ROM
+    uint32_t rom_end;
+    
+    uint32_t instructions;
+    uint32_t computed_jumps;
+    uint32_t bad_opcodes;
+};
+
+// Follows control flow through a ROM loaded at 0x200, memory is at least
+// MEMSIZE bytes, eg. a C8Image
+void C8AnalyseROM(C8Analysis* analysis, const uint8_t* memory, uint32_t rom_size);
+
+// Writes the instruction as text, returns the length as snprintf does
+int C8FormatInstruction(char* buffer, size_t size, uint16_t opcode);
+
+// Listing of the whole ROM, instructions where code was found and bytes
+// everywhere else
+void C8WriteListing(FILE* file, const C8Analysis* analysis, const uint8_t* memory);
+
+// How often each run of two and three instructions appears in straight line
+// code, indexed by opcode_table entry, eg. pairs[first * C8_OP_COUNT + second].
+// Used to pick the sequences the pre-decoder fuses
+struct C8SequenceCounts
+{
+    std::vector<uint64_t> pairs;
+    std::vector<uint64_t> triples;
+};
+
+// Adds the ROM's sequences to the counts, which start empty
+void C8CountSequences(C8SequenceCounts* counts, const C8Analysis* analysis, const uint8_t* memory);
+
+#endif
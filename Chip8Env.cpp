@@ -0,0 +1,450 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Chip8Env.h"
+#include "Chip8.h"
+#include "Chip8Pool.h"
+#include "Chip8Cfg.h"
+
+// Size of the first C8EnvConfig, the smallest one accepted
+#define C8_ENV_CONFIG_SIZE_V1 (offsetof(C8EnvConfig, frame_stack) + sizeof(uint32_t))
+
+// What the workers do with the next batch
+enum C8EnvJob
+{
+    C8_ENV_JOB_STEP,
+    C8_ENV_JOB_RESET,
+    C8_ENV_JOB_EXIT,
+};
+
+struct C8Env
+{
+    C8EnvConfig config;
+    uint32_t count;
+    uint32_t observation_size;
+    uint32_t frame_size;
+    
+    // Every environment shares the ROM image and comes from the one pool
+    C8Image image;
+    C8PagePool page_pool;
+    C8InstancePool pool;
+    Chip8** chips;
+    
+    // Reward value at the end of the last step
+    int32_t* reward_values;
+    
+    // Display before the last frame of a step, for max pooling
+    uint8_t* pool_displays;
+    
+    // Ring of the last frame_stack frames per environment
+    uint8_t* rings;
+    uint32_t* ring_heads;
+    
+    // The current batch, written before the workers are started
+    uint32_t job;
+    const uint16_t* actions;
+    uint32_t frames_per_step;
+    const uint8_t* reset;
+    uint8_t* observations;
+    float* rewards;
+    uint8_t* dones;
+    
+    // Thread pool, the calling thread takes the first slice of every batch
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_condition;
+    std::condition_variable done_condition;
+    uint64_t generation;
+    uint32_t running;
+};
+
+static int32_t C8EnvRewardValue(C8Env* env, Chip8* chip8)
+{
+    int32_t value = 0;
+    for(uint32_t i = 0; i < env->config.reward_bytes; ++i)
+    {
+        value = (value << 8) | C8ReadMemory(chip8, (env->config.reward_address + i) & MEMMASK);
+    }
+    
+    return value;
+}
+
+// Halves a byte of packed pixels to a nibble, a pixel is set if either of the
+// pair it covers is
+static inline uint8_t C8EnvHalvePixels(uint8_t pixels)
+{
+    uint8_t pairs = (pixels | (pixels << 1)) & 0xAA;
+    return ((pairs >> 4) & 0x8) | ((pairs >> 3) & 0x4) | ((pairs >> 2) & 0x2) | ((pairs >> 1) & 0x1);
+}
+
+static void C8EnvDownsample(const uint8_t* packed, uint8_t* half)
+{
+    const uint32_t half_pitch = SCREEN_PITCH / 2;
+    
+    for(uint32_t y = 0; y < SCREEN_HEIGHT / 2; ++y)
+    {
+        const uint8_t* top = &packed[(y * 2) * SCREEN_PITCH];
+        const uint8_t* bottom = top + SCREEN_PITCH;
+        
+        for(uint32_t x = 0; x < half_pitch; ++x)
+        {
+            uint8_t left = top[x * 2] | bottom[x * 2];
+            uint8_t right = top[(x * 2) + 1] | bottom[(x * 2) + 1];
+            half[(y * half_pitch) + x] = (C8EnvHalvePixels(left) << 4) | C8EnvHalvePixels(right);
+        }
+    }
+}
+
+// Expands packed pixels to a byte each, 0 or 255
+static void C8EnvUnpackPixels(const uint8_t* packed, uint32_t size, uint8_t* pixels)
+{
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    // Two packed bytes at a time, each is spread across 8 lanes and every
+    // lane tests its own bit
+    const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                       (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    
+    for(; i + 2 <= size; i += 2)
+    {
+        __m128i v = _mm_cvtsi32_si128(packed[i] | (packed[i + 1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+        _mm_storeu_si128((__m128i*)&pixels[i * 8], v);
+    }
+#endif
+    
+    for(; i < size; ++i)
+    {
+        for(uint32_t bit = 0; bit < 8; ++bit)
+        {
+            pixels[(i * 8) + bit] = (packed[i] & (0x80 >> bit)) ? 255 : 0;
+        }
+    }
+}
+
+// Converts a display to the configured frame layout
+static void C8EnvConvertFrame(C8Env* env, const uint8_t* display, uint8_t* frame)
+{
+    uint8_t half[(SCREEN_PITCH / 2) * (SCREEN_HEIGHT / 2)];
+    uint32_t size = SCREEN_PITCH * SCREEN_HEIGHT;
+    
+    if(env->config.downsample)
+    {
+        C8EnvDownsample(display, half);
+        display = half;
+        size = sizeof(half);
+    }
+    
+    if(env->config.observation == C8_ENV_OBSERVATION_BITS)
+    {
+        memcpy(frame, display, size);
+    }
+    else
+    {
+        C8EnvUnpackPixels(display, size, frame);
+    }
+}
+
+static void C8EnvObserve(C8Env* env, uint32_t i, const uint8_t* display, bool reset)
+{
+    uint8_t* observation = env->observations + ((size_t)i * env->observation_size);
+    uint32_t stack = env->config.frame_stack;
+    
+    if(stack == 1)
+    {
+        C8EnvConvertFrame(env, display, observation);
+        return;
+    }
+    
+    // Every frame is written twice, at head and head + stack, so the newest
+    // stack frames are always contiguous starting at the next head
+    uint8_t* ring = env->rings + ((size_t)i * stack * 2 * env->frame_size);
+    uint32_t head = env->ring_heads[i];
+    
+    uint8_t* frame = &ring[head * env->frame_size];
+    C8EnvConvertFrame(env, display, frame);
+    
+    if(reset)
+    {
+        // Start the stack out full of the first frame
+        for(uint32_t slot = 0; slot < stack * 2; ++slot)
+        {
+            if(slot != head)
+            {
+                memcpy(&ring[slot * env->frame_size], frame, env->frame_size);
+            }
+        }
+    }
+    else
+    {
+        memcpy(&ring[(head + stack) * env->frame_size], frame, env->frame_size);
+    }
+    
+    head = (head + 1) % stack;
+    env->ring_heads[i] = head;
+    
+    memcpy(observation, &ring[head * env->frame_size], env->observation_size);
+}
+
+static void C8EnvRunSlice(C8Env* env, uint32_t slice)
+{
+    // Contiguous slices so each thread works through its own instances
+    uint32_t slices = env->workers.size() + 1;
+    uint32_t begin = (uint64_t)env->count * slice / slices;
+    uint32_t end = (uint64_t)env->count * (slice + 1) / slices;
+    
+    for(uint32_t i = begin; i < end; ++i)
+    {
+        Chip8* chip8 = env->chips[i];
+        uint8_t* pool_display = &env->pool_displays[i * sizeof(chip8->gfx)];
+        
+        if(env->job == C8_ENV_JOB_RESET)
+        {
+            if(env->reset && !env->reset[i])
+            {
+                continue;
+            }
+            
+            C8ResetInstance(&env->pool, chip8);
+            env->reward_values[i] = C8EnvRewardValue(env, chip8);
+            memcpy(pool_display, chip8->gfx, sizeof(chip8->gfx));
+            C8EnvObserve(env, i, chip8->gfx, true);
+            continue;
+        }
+        
+        // A faulted chip doesn't run, C8EmulateFrame leaves it as it is
+        chip8->keys = env->actions[i];
+        for(uint32_t frame = 0; frame < env->frames_per_step; ++frame)
+        {
+            if(frame + 1 == env->frames_per_step)
+            {
+                memcpy(pool_display, chip8->gfx, sizeof(chip8->gfx));
+            }
+            
+            C8EmulateFrame(chip8, env->config.cycles_per_frame);
+        }
+        
+        int32_t value = C8EnvRewardValue(env, chip8);
+        env->rewards[i] = (float)(value - env->reward_values[i]);
+        env->reward_values[i] = value;
+        
+        env->dones[i] = chip8->fault != C8_FAULT_NONE;
+        
+        const uint8_t* display = chip8->gfx;
+        
+        uint8_t pooled[sizeof(chip8->gfx)];
+        if(env->config.max_pool)
+        {
+            for(uint32_t p = 0; p < sizeof(pooled); ++p)
+            {
+                pooled[p] = chip8->gfx[p] | pool_display[p];
+            }
+            
+            display = pooled;
+        }
+        
+        C8EnvObserve(env, i, display, false);
+    }
+}
+
+static void C8EnvWorker(C8Env* env, uint32_t slice)
+{
+    uint64_t generation = 0;
+    
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(env->mutex);
+            env->start_condition.wait(lock, [env, generation] { return env->generation != generation; });
+            generation = env->generation;
+        }
+        
+        if(env->job == C8_ENV_JOB_EXIT)
+        {
+            return;
+        }
+        
+        C8EnvRunSlice(env, slice);
+        
+        std::lock_guard<std::mutex> lock(env->mutex);
+        if(--env->running == 0)
+        {
+            env->done_condition.notify_one();
+        }
+    }
+}
+
+static void C8EnvRun(C8Env* env, uint32_t job)
+{
+    {
+        std::lock_guard<std::mutex> lock(env->mutex);
+        env->job = job;
+        env->running = env->workers.size();
+        ++env->generation;
+    }
+    
+    env->start_condition.notify_all();
+    
+    if(job == C8_ENV_JOB_EXIT)
+    {
+        return;
+    }
+    
+    C8EnvRunSlice(env, 0);
+    
+    // Wait for the rest of the batch
+    std::unique_lock<std::mutex> lock(env->mutex);
+    env->done_condition.wait(lock, [env] { return env->running == 0; });
+}
+
+C8Env* C8EnvCreate(const uint8_t* rom, uint32_t rom_size, uint32_t count, const C8EnvConfig* config)
+{
+    if(!rom || count == 0 || !config || config->size < C8_ENV_CONFIG_SIZE_V1 ||
+       config->size > sizeof(C8EnvConfig))
+    {
+        return nullptr;
+    }
+    
+    // Fields past the caller's size are left 0, the defaults
+    C8EnvConfig settings = {};
+    memcpy(&settings, config, config->size);
+    
+    if(settings.reward_bytes > 2 || settings.frame_stack > C8_ENV_MAX_FRAME_STACK)
+    {
+        return nullptr;
+    }
+    
+    // The instance pool inside is cache line aligned
+    void* memory = nullptr;
+    if(posix_memalign(&memory, alignof(C8Env), sizeof(C8Env)) != 0)
+    {
+        return nullptr;
+    }
+    
+    C8Env* env = new(memory) C8Env();
+    env->config = settings;
+    env->count = count;
+    
+    if(env->config.cycles_per_frame == 0)
+    {
+        env->config.cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    }
+    
+    if(env->config.frame_stack == 0)
+    {
+        env->config.frame_stack = 1;
+    }
+    
+    env->frame_size = env->config.observation == C8_ENV_OBSERVATION_BITS ?
+        SCREEN_PITCH * SCREEN_HEIGHT : SCREEN_WIDTH * SCREEN_HEIGHT;
+    
+    if(env->config.downsample)
+    {
+        env->frame_size /= 4;
+    }
+    
+    env->observation_size = env->frame_size * env->config.frame_stack;
+    
+    // Load the ROM (starting at 0x200), anything that doesn't fit is dropped
+    C8InitialiseImage(&env->image);
+    memcpy(&env->image.memory[0x200], rom, rom_size < MEMSIZE - 0x200 ? rom_size : MEMSIZE - 0x200);
+    C8PredecodeROM(&env->image, rom_size < MEMSIZE - 0x200 ? rom_size : MEMSIZE - 0x200);
+    
+    if(!C8CreateInstancePool(&env->pool, count, &env->image, &env->page_pool))
+    {
+        env->~C8Env();
+        free(memory);
+        return nullptr;
+    }
+    
+    env->chips = new Chip8*[count];
+    env->reward_values = new int32_t[count];
+    env->pool_displays = new uint8_t[(size_t)count * SCREEN_PITCH * SCREEN_HEIGHT]();
+    env->rings = new uint8_t[(size_t)count * env->config.frame_stack * 2 * env->frame_size]();
+    env->ring_heads = new uint32_t[count]();
+    
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        env->chips[i] = C8AcquireInstance(&env->pool);
+        env->reward_values[i] = C8EnvRewardValue(env, env->chips[i]);
+    }
+    
+    // No more threads than environments
+    uint32_t threads = env->config.threads ? env->config.threads : std::thread::hardware_concurrency();
+    threads = threads > count ? count : threads;
+    threads = threads ? threads : 1;
+    
+    for(uint32_t slice = 1; slice < threads; ++slice)
+    {
+        env->workers.push_back(std::thread(C8EnvWorker, env, slice));
+    }
+    
+    return env;
+}
+
+void C8EnvDestroy(C8Env* env)
+{
+    if(!env)
+    {
+        return;
+    }
+    
+    C8EnvRun(env, C8_ENV_JOB_EXIT);
+    for(std::thread& worker : env->workers)
+    {
+        worker.join();
+    }
+    
+    C8DestroyInstancePool(&env->pool);
+    C8DestroyPagePool(&env->page_pool);
+    
+    delete[] env->chips;
+    delete[] env->reward_values;
+    delete[] env->pool_displays;
+    delete[] env->rings;
+    delete[] env->ring_heads;
+    
+    env->~C8Env();
+    free(env);
+}
+
+uint32_t C8EnvObservationSize(const C8Env* env)
+{
+    return env->observation_size;
+}
+
+void C8EnvReset(C8Env* env, const uint8_t* reset, uint8_t* observations)
+{
+    env->reset = reset;
+    env->observations = observations;
+    
+    C8EnvRun(env, C8_ENV_JOB_RESET);
+}
+
+void C8EnvStep(C8Env* env, const uint16_t* actions, uint32_t frames_per_step,
+               uint8_t* observations, float* rewards, uint8_t* dones)
+{
+    env->actions = actions;
+    env->frames_per_step = frames_per_step;
+    env->observations = observations;
+    env->rewards = rewards;
+    env->dones = dones;
+    
+    C8EnvRun(env, C8_ENV_JOB_STEP);
+}
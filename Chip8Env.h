@@ -0,0 +1,88 @@
+#ifndef _CHIP8ENV_H
+#define _CHIP8ENV_H
+
+#include <stdint.h>
+
+// C interface for stepping batches of environments, eg. from Python through
+// ctypes. Every environment runs the same ROM, the caller owns the buffers
+// that actions go in and observations, rewards and dones come out of, so a
+// step makes no allocations
+
+// The library is built with hidden visibility, only these functions are
+// exported
+#if defined(__GNUC__)
+#define C8ENV_API __attribute__((visibility("default")))
+#else
+#define C8ENV_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Observation layouts
+enum C8EnvObservation
+{
+    C8_ENV_OBSERVATION_BYTES, // 64x32 bytes, 0 or 255
+    C8_ENV_OBSERVATION_BITS,  // 8x32 bytes, leftmost pixel in the top bit
+};
+
+// Largest frame stack an environment keeps
+#define C8_ENV_MAX_FRAME_STACK 16
+
+typedef struct C8EnvConfig
+{
+    // sizeof(C8EnvConfig), checked by C8EnvCreate. New fields only ever go on
+    // the end, callers built against an older header pass a smaller size and
+    // get the defaults for the fields they don't know about
+    uint32_t size;
+    
+    // 0 for the defaults
+    uint32_t cycles_per_frame;
+    uint32_t threads;
+    
+    // One of C8EnvObservation
+    uint32_t observation;
+    
+    // The reward for a step is how much the big endian value at this address
+    // changed, reward_bytes is 1 or 2, or 0 for no reward
+    uint16_t reward_address;
+    uint8_t reward_bytes;
+    
+    // Observe the pixelwise max of the last two frames of a step instead of
+    // the last one, games flicker sprites by drawing them every other frame
+    uint8_t max_pool;
+    
+    // Halve the observation to 32x16, a pixel is set if any of the 2x2 it
+    // covers is
+    uint8_t downsample;
+    
+    // Observations are the last frame_stack frames, oldest first. 0 or 1 for
+    // just the newest
+    uint32_t frame_stack;
+} C8EnvConfig;
+
+typedef struct C8Env C8Env;
+
+// Returns NULL on failure, including a config size this library doesn't know
+C8ENV_API C8Env* C8EnvCreate(const uint8_t* rom, uint32_t rom_size, uint32_t count, const C8EnvConfig* config);
+C8ENV_API void C8EnvDestroy(C8Env* env);
+
+// Bytes of observation per environment, including the whole frame stack
+C8ENV_API uint32_t C8EnvObservationSize(const C8Env* env);
+
+// Resets the environments with a non zero entry in reset, or all of them if
+// reset is NULL, and writes their observations
+C8ENV_API void C8EnvReset(C8Env* env, const uint8_t* reset, uint8_t* observations);
+
+// actions holds the keypad for each environment, a bit per key held. Runs
+// frames_per_step frames and writes count observations, rewards and dones. An
+// environment is done once it faults, it stays done until it is reset
+C8ENV_API void C8EnvStep(C8Env* env, const uint16_t* actions, uint32_t frames_per_step,
+                         uint8_t* observations, float* rewards, uint8_t* dones);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
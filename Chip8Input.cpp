@@ -1,49 +1,105 @@
 #include "Chip8Input.h"
 #include "Chip8.h"
 
-void C8SetupInput(Chip8* chip8)
+// For the keyboard key codes
+#include <GLFW/glfw3.h>
+
+void C8SetupInput(InputQueue* queue)
 {
-    C8SetKeyMap(chip8, KEY_0, GLFW_KEY_0);
-    C8SetKeyMap(chip8, KEY_1, GLFW_KEY_1);
-    C8SetKeyMap(chip8, KEY_2, GLFW_KEY_2);
-    C8SetKeyMap(chip8, KEY_3, GLFW_KEY_3);
-    C8SetKeyMap(chip8, KEY_4, GLFW_KEY_4);
-    C8SetKeyMap(chip8, KEY_5, GLFW_KEY_5);
-    C8SetKeyMap(chip8, KEY_6, GLFW_KEY_6);
-    C8SetKeyMap(chip8, KEY_7, GLFW_KEY_7);
-    C8SetKeyMap(chip8, KEY_8, GLFW_KEY_8);
-    C8SetKeyMap(chip8, KEY_9, GLFW_KEY_9);
-    C8SetKeyMap(chip8, KEY_A, GLFW_KEY_A);
-    C8SetKeyMap(chip8, KEY_B, GLFW_KEY_B);
-    C8SetKeyMap(chip8, KEY_C, GLFW_KEY_C);
-    C8SetKeyMap(chip8, KEY_D, GLFW_KEY_D);
-    C8SetKeyMap(chip8, KEY_E, GLFW_KEY_E);
-    C8SetKeyMap(chip8, KEY_F, GLFW_KEY_F);
+    C8SetKeyMap(queue, KEY_0, GLFW_KEY_0);
+    C8SetKeyMap(queue, KEY_1, GLFW_KEY_1);
+    C8SetKeyMap(queue, KEY_2, GLFW_KEY_2);
+    C8SetKeyMap(queue, KEY_3, GLFW_KEY_3);
+    C8SetKeyMap(queue, KEY_4, GLFW_KEY_4);
+    C8SetKeyMap(queue, KEY_5, GLFW_KEY_5);
+    C8SetKeyMap(queue, KEY_6, GLFW_KEY_6);
+    C8SetKeyMap(queue, KEY_7, GLFW_KEY_7);
+    C8SetKeyMap(queue, KEY_8, GLFW_KEY_8);
+    C8SetKeyMap(queue, KEY_9, GLFW_KEY_9);
+    C8SetKeyMap(queue, KEY_A, GLFW_KEY_A);
+    C8SetKeyMap(queue, KEY_B, GLFW_KEY_B);
+    C8SetKeyMap(queue, KEY_C, GLFW_KEY_C);
+    C8SetKeyMap(queue, KEY_D, GLFW_KEY_D);
+    C8SetKeyMap(queue, KEY_E, GLFW_KEY_E);
+    C8SetKeyMap(queue, KEY_F, GLFW_KEY_F);
 }
 
-void C8GetInput(Chip8* chip8)
+void C8QueueKey(InputQueue* queue, uint32_t key_code, bool pressed)
 {
-    // Loop over the key array and get the current input state
     for(int key=0; key<MAX_KEYS; ++key)
     {
-        if (glfwGetKey(chip8->screen->window, chip8->keymap[key]) == GLFW_PRESS)
+        if(queue->keymap[key] != key_code)
+        {
+            continue;
+        }
+        
+        uint32_t head = queue->head.load(std::memory_order_relaxed);
+        uint32_t tail = queue->tail.load(std::memory_order_acquire);
+        
+        // If the emulation thread has fallen this far behind drop the event
+        // rather than wait for it
+        if(head - tail == INPUT_QUEUE_SIZE)
+        {
+            return;
+        }
+        
+        int64_t time_ns = PerfNano_Counter(Clock::now().time_since_epoch()).count();
+        queue->events[head & (INPUT_QUEUE_SIZE - 1)] = { (uint8_t)key, (uint8_t)pressed, time_ns };
+        queue->head.store(head + 1, std::memory_order_release);
+    }
+}
+
+void C8ProcessInput(Chip8* chip8, InputQueue* queue)
+{
+    uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+    uint32_t head = queue->head.load(std::memory_order_acquire);
+    
+    // Apply every pending event to the key state
+    for(; tail != head; ++tail)
+    {
+        const KeyEvent& event = queue->events[tail & (INPUT_QUEUE_SIZE - 1)];
+        if(event.pressed)
         {
-            // Set the key to 1
-            chip8->keys[key] = 1;
+            chip8->keys |= (1 << event.key);
         }
         else
         {
-            chip8->keys[key] = 0;
+            chip8->keys &= ~(1 << event.key);
         }
+        
+        if(queue->unobserved_ns == 0)
+        {
+            queue->unobserved_ns = event.time_ns;
+        }
+    }
+    
+    queue->tail.store(tail, std::memory_order_release);
+}
+
+int64_t C8ObserveInput(Chip8* chip8, InputQueue* queue)
+{
+    if(!chip8->keys_read)
+    {
+        return 0;
     }
+    
+    int64_t time_ns = queue->unobserved_ns;
+    queue->unobserved_ns = 0;
+    
+    return time_ns;
+}
+
+bool C8InputPending(InputQueue* queue)
+{
+    return queue->head.load(std::memory_order_acquire) != queue->tail.load(std::memory_order_relaxed);
 }
 
-void C8SetKeyMap(Chip8* chip8, Chip8Keypad key, uint32_t key_code)
+void C8SetKeyMap(InputQueue* queue, Chip8Keypad key, uint32_t key_code)
 {
-    chip8->keymap[key] = key_code;
+    queue->keymap[key] = key_code;
 }
 
-uint32_t C8GetKeyMap(Chip8* chip8, Chip8Keypad key)
+uint32_t C8GetKeyMap(InputQueue* queue, Chip8Keypad key)
 {
-    return chip8->keymap[key];
+    return queue->keymap[key];
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include <atomic>
+
 // Predef
 struct Chip8;
 
@@ -27,10 +29,49 @@ enum Chip8Keypad
     MAX_KEYS
 };
 
-void C8SetupInput(Chip8* chip8);
-void C8GetInput(Chip8* chip8);
-uint32_t C8GetKeyMap(Chip8* chip8, Chip8Keypad key);
-void C8SetKeyMap(Chip8* chip8, Chip8Keypad key, uint32_t key_code);
+// A change in state of one of the keypad keys
+struct KeyEvent
+{
+    uint8_t key;
+    uint8_t pressed;
+    
+    // When the event arrived, nanoseconds on Clock
+    int64_t time_ns;
+};
+
+// Must be a power of 2
+#define INPUT_QUEUE_SIZE 64
+
+// Single producer, single consumer queue carrying key events from the render
+// thread to the emulation thread
+struct InputQueue
+{
+    // Keyboard key code for each keypad key, only used by the producer
+    uint32_t keymap[MAX_KEYS];
+    
+    KeyEvent events[INPUT_QUEUE_SIZE];
+    
+    // Written by the producer
+    std::atomic<uint32_t> head;
+    
+    // Written by the consumer
+    std::atomic<uint32_t> tail;
+    
+    // Consumer only, arrival time of the oldest event applied to the keys that
+    // the program hasn't read the keypad since, 0 if none
+    int64_t unobserved_ns;
+};
+
+void C8SetupInput(InputQueue* queue);
+void C8QueueKey(InputQueue* queue, uint32_t key_code, bool pressed);
+void C8ProcessInput(Chip8* chip8, InputQueue* queue);
+
+// Call after a frame, returns the arrival time of the oldest event the chip
+// has now seen by reading the keypad, or 0
+int64_t C8ObserveInput(Chip8* chip8, InputQueue* queue);
+bool C8InputPending(InputQueue* queue);
+uint32_t C8GetKeyMap(InputQueue* queue, Chip8Keypad key);
+void C8SetKeyMap(InputQueue* queue, Chip8Keypad key, uint32_t key_code);
 
 #endif
 
@@ -0,0 +1,107 @@
+#include <cstring>
+#include <cstdio>
+
+#include <string>
+
+#include "Chip8Metrics.h"
+
+void C8RegisterCounter(C8MetricsRegistry* registry, C8Counter* counter, const char* name, const char* help)
+{
+    counter->name = name;
+    counter->help = help;
+    counter->value.store(0, std::memory_order_relaxed);
+    
+    uint32_t index = registry->counter_count.fetch_add(1, std::memory_order_relaxed);
+    if(index >= C8_METRICS_MAX)
+    {
+        printf("Too many counters, %s won't be exported\n", name);
+        return;
+    }
+    
+    registry->counters[index].store(counter, std::memory_order_release);
+}
+
+void C8RegisterHistogram(C8MetricsRegistry* registry, C8Histogram* histogram, const char* name, const char* help)
+{
+    histogram->name = name;
+    histogram->help = help;
+    for(uint32_t bucket = 0; bucket < C8_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        histogram->buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+    histogram->sum_ns.store(0, std::memory_order_relaxed);
+    
+    uint32_t index = registry->histogram_count.fetch_add(1, std::memory_order_relaxed);
+    if(index >= C8_METRICS_MAX)
+    {
+        printf("Too many histograms, %s won't be exported\n", name);
+        return;
+    }
+    
+    registry->histograms[index].store(histogram, std::memory_order_release);
+}
+
+void C8WriteMetrics(C8MetricsRegistry* registry, FILE* file)
+{
+    // A slot can still be empty while another thread is registering into it
+    uint32_t counter_count = registry->counter_count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < counter_count && i < C8_METRICS_MAX; ++i)
+    {
+        C8Counter* counter = registry->counters[i].load(std::memory_order_acquire);
+        if(!counter)
+            continue;
+        
+        fprintf(file, "# HELP %s %s\n", counter->name, counter->help);
+        fprintf(file, "# TYPE %s counter\n", counter->name);
+        fprintf(file, "%s %llu\n", counter->name,
+                (unsigned long long)counter->value.load(std::memory_order_relaxed));
+    }
+    
+    uint32_t histogram_count = registry->histogram_count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < histogram_count && i < C8_METRICS_MAX; ++i)
+    {
+        C8Histogram* histogram = registry->histograms[i].load(std::memory_order_acquire);
+        if(!histogram)
+            continue;
+        
+        fprintf(file, "# HELP %s %s\n", histogram->name, histogram->help);
+        fprintf(file, "# TYPE %s histogram\n", histogram->name);
+        
+        // Prometheus buckets are cumulative and in seconds, the last bucket
+        // has no upper bound so it only shows up in +Inf. The buckets are read
+        // one at a time so a dump taken mid update can be off by one
+        uint64_t cumulative = 0;
+        for(uint32_t bucket = 0; bucket < C8_HISTOGRAM_BUCKETS - 1; ++bucket)
+        {
+            cumulative += histogram->buckets[bucket].load(std::memory_order_relaxed);
+            fprintf(file, "%s_bucket{le=\"%g\"} %llu\n", histogram->name,
+                    (double)(1ULL << bucket) / 1000000.0, (unsigned long long)cumulative);
+        }
+        cumulative += histogram->buckets[C8_HISTOGRAM_BUCKETS - 1].load(std::memory_order_relaxed);
+        fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", histogram->name, (unsigned long long)cumulative);
+        
+        fprintf(file, "%s_sum %.9f\n", histogram->name,
+                histogram->sum_ns.load(std::memory_order_relaxed) / 1000000000.0);
+        fprintf(file, "%s_count %llu\n", histogram->name, (unsigned long long)cumulative);
+    }
+}
+
+bool C8DumpMetrics(C8MetricsRegistry* registry, const char* path, C8MetricsWriter write_extra, void* context)
+{
+    std::string temp_path = std::string(path) + ".tmp";
+    
+    FILE* file = fopen(temp_path.c_str(), "w");
+    if(!file)
+    {
+        return false;
+    }
+    
+    C8WriteMetrics(registry, file);
+    if(write_extra)
+    {
+        write_extra(file, context);
+    }
+    
+    bool written = (fclose(file) == 0);
+    return written && rename(temp_path.c_str(), path) == 0;
+}
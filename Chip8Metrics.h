@@ -0,0 +1,72 @@
+#ifndef _CHIP8METRICS_H
+#define _CHIP8METRICS_H
+
+#include <stdint.h>
+#include <cstdio>
+
+#include <atomic>
+
+// Counters and histograms updated from hot paths with relaxed atomics and
+// written out in the Prometheus text format. Metrics are registered once up
+// front, registering only ever appends so writing them out takes no locks.
+// Histograms are of durations with log2 buckets, bucket n counts those under
+// 2^n us
+#define C8_METRICS_MAX 32
+#define C8_HISTOGRAM_BUCKETS 24
+
+struct C8Counter
+{
+    const char* name;
+    const char* help;
+    std::atomic<uint64_t> value;
+};
+
+struct C8Histogram
+{
+    const char* name;
+    const char* help;
+    std::atomic<uint64_t> buckets[C8_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> sum_ns;
+};
+
+struct C8MetricsRegistry
+{
+    std::atomic<C8Counter*> counters[C8_METRICS_MAX];
+    std::atomic<uint32_t> counter_count;
+    
+    std::atomic<C8Histogram*> histograms[C8_METRICS_MAX];
+    std::atomic<uint32_t> histogram_count;
+};
+
+void C8RegisterCounter(C8MetricsRegistry* registry, C8Counter* counter, const char* name, const char* help);
+void C8RegisterHistogram(C8MetricsRegistry* registry, C8Histogram* histogram, const char* name, const char* help);
+
+inline void C8AddCounter(C8Counter* counter, uint64_t value)
+{
+    counter->value.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void C8ObserveDuration(C8Histogram* histogram, int64_t duration_ns)
+{
+    uint64_t us = duration_ns > 0 ? (uint64_t)duration_ns / 1000 : 0;
+    uint32_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if(bucket >= C8_HISTOGRAM_BUCKETS)
+    {
+        bucket = C8_HISTOGRAM_BUCKETS - 1;
+    }
+    
+    histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram->sum_ns.fetch_add(duration_ns > 0 ? duration_ns : 0, std::memory_order_relaxed);
+}
+
+void C8WriteMetrics(C8MetricsRegistry* registry, FILE* file);
+
+// Appends metrics that don't fit the registry, eg. labelled per instance
+typedef void (*C8MetricsWriter)(FILE* file, void* context);
+
+// Writes to a temporary file and renames it over path so a scraper never
+// reads half a file, write_extra can be nullptr. Returns false if the file
+// can't be written
+bool C8DumpMetrics(C8MetricsRegistry* registry, const char* path, C8MetricsWriter write_extra, void* context);
+
+#endif
@@ -0,0 +1,147 @@
+#include <cstring>
+#include <cstdio>
+
+#include <time.h>
+
+#include "Chip8Pacer.h"
+
+// Bounds on the spin window, the low end covers a well behaved kernel
+#define PACER_MIN_SPIN_NS 50000
+#define PACER_MAX_SPIN_NS 2000000
+
+// Falling this many frames behind restarts the grid instead of running the
+// missed frames back to back
+#define PACER_MAX_FRAMES_BEHIND 4
+
+static int64_t C8MonotonicNow()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t)now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+static int64_t C8PacerDeadline(const C8Pacer* pacer, uint64_t frame)
+{
+    return pacer->start_ns + (int64_t)((frame * 1000000000ULL) / pacer->frame_rate);
+}
+
+void C8InitialisePacer(C8Pacer* pacer, uint64_t instructions_per_second, uint32_t frame_rate)
+{
+    memset(pacer, 0, sizeof(C8Pacer));
+    pacer->frame_rate = frame_rate;
+    pacer->instructions_per_second = instructions_per_second;
+    pacer->spin_ns = PACER_MIN_SPIN_NS;
+    
+    C8ResetPacer(pacer);
+}
+
+void C8ResetPacer(C8Pacer* pacer)
+{
+    pacer->start_ns = C8MonotonicNow();
+    pacer->frame = 0;
+}
+
+uint32_t C8PacerFrameCycles(C8Pacer* pacer)
+{
+    pacer->cycle_remainder += pacer->instructions_per_second;
+    uint32_t cycles = (uint32_t)(pacer->cycle_remainder / pacer->frame_rate);
+    pacer->cycle_remainder %= pacer->frame_rate;
+    
+    return cycles;
+}
+
+void C8PacerWait(C8Pacer* pacer)
+{
+    ++pacer->frame;
+    int64_t deadline = C8PacerDeadline(pacer, pacer->frame);
+    int64_t now = C8MonotonicNow();
+    
+    if(now < deadline - pacer->spin_ns)
+    {
+        // Sleep most of the way, the deadline is absolute so a signal or an
+        // early wake just goes back to sleep
+        int64_t wake = deadline - pacer->spin_ns;
+        timespec wake_time;
+        wake_time.tv_sec = wake / 1000000000LL;
+        wake_time.tv_nsec = wake % 1000000000LL;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, nullptr) != 0)
+        {
+        }
+        
+        now = C8MonotonicNow();
+        
+        // Woke past the deadline, spin for longer next time. Otherwise creep
+        // back so we don't burn more time spinning than the kernel needs
+        int64_t oversleep = now - wake;
+        if(oversleep > pacer->spin_ns)
+        {
+            pacer->spin_ns = oversleep + (oversleep / 4);
+            if(pacer->spin_ns > PACER_MAX_SPIN_NS)
+                pacer->spin_ns = PACER_MAX_SPIN_NS;
+        }
+        else
+        {
+            pacer->spin_ns -= pacer->spin_ns / 64;
+            if(pacer->spin_ns < PACER_MIN_SPIN_NS)
+                pacer->spin_ns = PACER_MIN_SPIN_NS;
+        }
+    }
+    
+    while(now < deadline)
+    {
+        now = C8MonotonicNow();
+    }
+    
+    int64_t late_ns = now - deadline;
+    
+    uint32_t bucket = 0;
+    for(int64_t us = late_ns / 1000; us > 0 && bucket < (C8_PACER_JITTER_BUCKETS - 1); us >>= 1)
+    {
+        ++bucket;
+    }
+    ++pacer->jitter[bucket];
+    ++pacer->frames_waited;
+    
+    if(late_ns > pacer->max_late_ns)
+        pacer->max_late_ns = late_ns;
+    
+    // Started after the following frame was due, the next waits return
+    // straight away to catch up unless we are too far behind to bother
+    int64_t frame_ns = 1000000000LL / pacer->frame_rate;
+    if(late_ns > frame_ns)
+    {
+        ++pacer->frames_late;
+        
+        if(late_ns > frame_ns * PACER_MAX_FRAMES_BEHIND)
+        {
+            ++pacer->resyncs;
+            C8ResetPacer(pacer);
+        }
+    }
+}
+
+void C8PrintPacerJitter(const C8Pacer* pacer)
+{
+    printf("Frame pacing over %llu frames at %uHz, %llu instructions per second\n",
+           (unsigned long long)pacer->frames_waited, pacer->frame_rate,
+           (unsigned long long)pacer->instructions_per_second);
+    printf("Late %llu, resynced %llu, worst %.1fus, spinning the last %.1fus\n",
+           (unsigned long long)pacer->frames_late, (unsigned long long)pacer->resyncs,
+           pacer->max_late_ns / 1000.0, pacer->spin_ns / 1000.0);
+    
+    for(uint32_t bucket = 0; bucket < C8_PACER_JITTER_BUCKETS; ++bucket)
+    {
+        if(pacer->jitter[bucket] == 0)
+            continue;
+        
+        if(bucket == 0)
+            printf("    <1us: ");
+        else if(bucket == C8_PACER_JITTER_BUCKETS - 1)
+            printf("    >=%uus: ", 1u << (bucket - 1));
+        else
+            printf("    <%uus: ", 1u << bucket);
+        
+        printf("%llu (%.1f%%)\n", (unsigned long long)pacer->jitter[bucket],
+               (pacer->jitter[bucket] * 100.0) / pacer->frames_waited);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef _CHIP8PACER_H
+#define _CHIP8PACER_H
+
+#include <stdint.h>
+
+// Paces emulation to a fixed frame rate and instruction rate. Frame deadlines
+// sit on a grid measured from the start so rounding and late wakeups don't
+// accumulate into drift. Waits sleep on the monotonic clock until just short
+// of the deadline and spin the rest, the spin window grows when the kernel
+// wakes us late and shrinks back while it doesn't
+#define C8_PACER_JITTER_BUCKETS 16
+
+struct C8Pacer
+{
+    uint32_t frame_rate;
+    uint64_t instructions_per_second;
+    
+    // Instructions owed to the next frame, in 1/frame_rate instructions
+    uint64_t cycle_remainder;
+    
+    // Deadline grid, frame n is due at start_ns + n/frame_rate seconds
+    int64_t start_ns;
+    uint64_t frame;
+    
+    // How early to stop sleeping and start spinning
+    int64_t spin_ns;
+    
+    // How late each frame started, bucket 0 is under 1us and bucket n under
+    // 2^n us, the last bucket takes everything beyond
+    uint64_t jitter[C8_PACER_JITTER_BUCKETS];
+    int64_t max_late_ns;
+    uint64_t frames_waited;
+    
+    // Frames that started after the next one was due, and times we fell so
+    // far behind that the grid was restarted
+    uint64_t frames_late;
+    uint64_t resyncs;
+};
+
+void C8InitialisePacer(C8Pacer* pacer, uint64_t instructions_per_second, uint32_t frame_rate);
+
+// Restarts the deadline grid from now, eg. after the caller has been blocked
+void C8ResetPacer(C8Pacer* pacer);
+
+// Instructions to run in the coming frame, spreads the rate evenly when it
+// doesn't divide by the frame rate
+uint32_t C8PacerFrameCycles(C8Pacer* pacer);
+
+// Waits until the next frame is due
+void C8PacerWait(C8Pacer* pacer);
+
+void C8PrintPacerJitter(const C8Pacer* pacer);
+
+#endif
@@ -0,0 +1,113 @@
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+
+#include "Chip8Pool.h"
+
+// Huge pages are 2MB on the platforms we run on
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static void* C8MapArena(size_t size, bool* huge_pages)
+{
+    void* arena = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // Only works if huge pages have been reserved, fall back quietly
+    arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    *huge_pages = arena != MAP_FAILED;
+#else
+    *huge_pages = false;
+#endif
+    
+    if(arena == MAP_FAILED)
+    {
+        arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(arena == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+#ifdef MADV_HUGEPAGE
+        // Ask for transparent huge pages instead
+        madvise(arena, size, MADV_HUGEPAGE);
+#endif
+    }
+    
+    return arena;
+}
+
+bool C8CreateInstancePool(C8InstancePool* pool, uint32_t capacity, const C8Image* image, C8PagePool* page_pool)
+{
+    // Instances first so they keep the arena's alignment, then the free list
+    size_t instances_size = sizeof(Chip8) * capacity;
+    size_t size = instances_size + (sizeof(uint32_t) * capacity);
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    
+    pool->arena = C8MapArena(size, &pool->huge_pages);
+    if(!pool->arena)
+    {
+        printf("Failed to map an arena for %u instances\n", capacity);
+        return false;
+    }
+    
+    pool->arena_size = size;
+    pool->capacity = capacity;
+    pool->instances = (Chip8*)pool->arena;
+    pool->free_list = (uint32_t*)((uint8_t*)pool->arena + instances_size);
+    
+    memset(&pool->initial, 0, sizeof(pool->initial));
+    C8Initialise(&pool->initial, image, page_pool);
+    
+    // Hand out the lowest addresses first
+    for(uint32_t i = 0; i < capacity; ++i)
+    {
+        pool->instances[i] = pool->initial;
+        pool->free_list[i] = capacity - 1 - i;
+    }
+    
+    pool->free_count = capacity;
+    
+    return true;
+}
+
+void C8DestroyInstancePool(C8InstancePool* pool)
+{
+    // Instances still handed out lose their private pages too
+    for(uint32_t i = 0; i < pool->capacity; ++i)
+    {
+        C8ReleasePages(&pool->instances[i]);
+    }
+    
+    munmap(pool->arena, pool->arena_size);
+    
+    pool->arena = nullptr;
+    pool->instances = nullptr;
+    pool->free_list = nullptr;
+    pool->capacity = 0;
+    pool->free_count = 0;
+}
+
+Chip8* C8AcquireInstance(C8InstancePool* pool)
+{
+    if(pool->free_count == 0)
+    {
+        return nullptr;
+    }
+    
+    return &pool->instances[pool->free_list[--pool->free_count]];
+}
+
+void C8ResetInstance(C8InstancePool* pool, Chip8* chip8)
+{
+    // Private pages go back to the page pool before the copy forgets them
+    C8ReleasePages(chip8);
+    *chip8 = pool->initial;
+}
+
+void C8ReleaseInstance(C8InstancePool* pool, Chip8* chip8)
+{
+    // Reset now so the next acquire is ready to run
+    C8ResetInstance(pool, chip8);
+    pool->free_list[pool->free_count++] = (uint32_t)(chip8 - pool->instances);
+}
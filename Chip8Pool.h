@@ -0,0 +1,41 @@
+#ifndef _CHIP8POOL_H
+#define _CHIP8POOL_H
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "Chip8.h"
+
+// Fixed size pool of instances for workloads that create and destroy them at
+// a high rate. Instances live in one arena, backed by huge pages where the
+// system has them, and are handed out already initialised. Resetting an
+// instance copies a template over it so neither acquiring, resetting nor
+// releasing goes near the system allocator. Not thread safe, use a pool per
+// thread
+struct C8InstancePool
+{
+    // Arena holding the instances followed by the free list
+    void* arena;
+    size_t arena_size;
+    bool huge_pages;
+    
+    Chip8* instances;
+    uint32_t capacity;
+    
+    // Indices of the instances not handed out
+    uint32_t* free_list;
+    uint32_t free_count;
+    
+    // A freshly initialised instance, copied over instances to reset them
+    Chip8 initial;
+};
+
+bool C8CreateInstancePool(C8InstancePool* pool, uint32_t capacity, const C8Image* image, C8PagePool* page_pool);
+void C8DestroyInstancePool(C8InstancePool* pool);
+
+// Returns nullptr when every instance is in use
+Chip8* C8AcquireInstance(C8InstancePool* pool);
+void C8ResetInstance(C8InstancePool* pool, Chip8* chip8);
+void C8ReleaseInstance(C8InstancePool* pool, Chip8* chip8);
+
+#endif
@@ -0,0 +1,143 @@
+#include <cstdio>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "Chip8Scheduler.h"
+
+void C8InitialiseScheduler(C8Scheduler* scheduler, uint32_t cycles_per_frame)
+{
+    scheduler->cycles_per_frame = cycles_per_frame;
+    scheduler->frame = 0;
+    scheduler->tasks.clear();
+    scheduler->runnable.clear();
+    scheduler->next_runnable.clear();
+    scheduler->parked_count = 0;
+    scheduler->halted_count = 0;
+    scheduler->key_events.clear();
+}
+
+uint32_t C8AddTask(C8Scheduler* scheduler, Chip8* chip8)
+{
+    C8Task task = {};
+    task.chip8 = chip8;
+    
+    uint32_t index = scheduler->tasks.size();
+    scheduler->tasks.push_back(task);
+    scheduler->runnable.push_back(index);
+    
+    return index;
+}
+
+void C8RunSchedulerFrame(C8Scheduler* scheduler)
+{
+    C8ApplyTaskKeys(scheduler);
+    
+    scheduler->next_runnable.clear();
+    
+    for(uint32_t index : scheduler->runnable)
+    {
+        C8Task* task = &scheduler->tasks[index];
+        Chip8* chip8 = task->chip8;
+        
+        C8EmulateFrame(chip8, scheduler->cycles_per_frame);
+        
+        if(chip8->fault != C8_FAULT_NONE)
+        {
+            // Halted for good
+            ++scheduler->halted_count;
+            continue;
+        }
+        
+        if(chip8->idle == C8_IDLE_KEY)
+        {
+            // Nothing changes but the timers until a key goes down
+            task->parked = true;
+            task->parked_frame = scheduler->frame + 1;
+            ++scheduler->parked_count;
+            continue;
+        }
+        
+        scheduler->next_runnable.push_back(index);
+    }
+    
+    scheduler->runnable.swap(scheduler->next_runnable);
+    ++scheduler->frame;
+}
+
+void C8SetTaskKeys(C8Scheduler* scheduler, uint32_t index, uint16_t keys)
+{
+    std::lock_guard<std::mutex> lock(scheduler->key_mutex);
+    scheduler->key_events.push_back({index, keys});
+}
+
+void C8ApplyTaskKeys(C8Scheduler* scheduler)
+{
+    // Take the queue so the lock isn't held while tasks catch up
+    {
+        std::lock_guard<std::mutex> lock(scheduler->key_mutex);
+        scheduler->key_events.swap(scheduler->applying_key_events);
+    }
+    
+    for(const C8KeyEvent& event : scheduler->applying_key_events)
+    {
+        C8Task* task = &scheduler->tasks[event.task];
+        task->chip8->keys = event.keys;
+        
+        if(task->parked && event.keys != 0)
+        {
+            // Catch up on the frames spent parked before running again
+            C8SkipKeyWaitFrames(task->chip8, scheduler->frame - task->parked_frame, scheduler->cycles_per_frame);
+            
+            task->parked = false;
+            --scheduler->parked_count;
+            scheduler->runnable.push_back(event.task);
+        }
+    }
+    
+    scheduler->applying_key_events.clear();
+}
+
+static void C8SchedulerThreadMain(C8SchedulerThread* scheduler_thread)
+{
+    C8Pacer* pacer = &scheduler_thread->pacer;
+    C8InitialisePacer(pacer, scheduler_thread->scheduler.cycles_per_frame * 60ULL, 60);
+    
+    while(scheduler_thread->running.load(std::memory_order_relaxed))
+    {
+        Clock_Time start = Clock::now();
+        C8RunSchedulerFrame(&scheduler_thread->scheduler);
+        Clock_Time end = Clock::now();
+        
+        int64_t busy_ns = PerfNano_Counter(end - start).count();
+        scheduler_thread->busy_ns += busy_ns;
+        ++scheduler_thread->frames_run;
+        
+        C8PacerWait(pacer);
+    }
+}
+
+void C8StartSchedulerThread(C8SchedulerThread* scheduler_thread, uint32_t core)
+{
+    scheduler_thread->core = core;
+    scheduler_thread->frames_run = 0;
+    scheduler_thread->busy_ns = 0;
+    scheduler_thread->running = true;
+    scheduler_thread->thread = std::thread(C8SchedulerThreadMain, scheduler_thread);
+    
+    // Keep each scheduler on its own core so its instances stay in that
+    // core's cache
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    if(pthread_setaffinity_np(scheduler_thread->thread.native_handle(), sizeof(cpus), &cpus) != 0)
+    {
+        printf("Failed to pin scheduler to core %u\n", core);
+    }
+}
+
+void C8StopSchedulerThread(C8SchedulerThread* scheduler_thread)
+{
+    scheduler_thread->running = false;
+    scheduler_thread->thread.join();
+}
@@ -0,0 +1,91 @@
+#ifndef _CHIP8SCHEDULER_H
+#define _CHIP8SCHEDULER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+#include "Chip8Pacer.h"
+
+// Cooperative scheduler running many instances on one thread. Every instance
+// is a task that runs a frame at a time and yields at the end of the frame,
+// C8EmulateFrame already hands back early when the guest idles on the delay
+// timer. Tasks waiting in FX0A are parked and cost nothing until a key goes
+// down, when they catch up on the frames they missed and run again
+struct C8Task
+{
+    Chip8* chip8;
+    
+    // Frame the task was parked on, only while parked
+    uint64_t parked_frame;
+    bool parked;
+};
+
+// A keypad change waiting for the next frame
+struct C8KeyEvent
+{
+    uint32_t task;
+    uint16_t keys;
+};
+
+struct C8Scheduler
+{
+    uint32_t cycles_per_frame;
+    
+    // Frames run so far
+    uint64_t frame;
+    
+    std::vector<C8Task> tasks;
+    
+    // Indices of the tasks run each frame
+    std::vector<uint32_t> runnable;
+    std::vector<uint32_t> next_runnable;
+    
+    uint32_t parked_count;
+    uint32_t halted_count;
+    
+    // Keys can be set from any thread while the scheduler's thread is running
+    // frames, they are queued and applied at the start of the next frame
+    std::mutex key_mutex;
+    std::vector<C8KeyEvent> key_events;
+    std::vector<C8KeyEvent> applying_key_events;
+};
+
+void C8InitialiseScheduler(C8Scheduler* scheduler, uint32_t cycles_per_frame);
+uint32_t C8AddTask(C8Scheduler* scheduler, Chip8* chip8);
+
+// Applies the queued keys then runs one frame of every runnable task
+void C8RunSchedulerFrame(C8Scheduler* scheduler);
+
+// Queues the keypad of a task for the next frame, safe from any thread
+void C8SetTaskKeys(C8Scheduler* scheduler, uint32_t task, uint16_t keys);
+
+// Sets the queued keypads, waking parked tasks once a key is down. Only from
+// the thread running the frames
+void C8ApplyTaskKeys(C8Scheduler* scheduler);
+
+// One scheduler per core, each on its own thread pinned to its core and paced
+// to 60 frames a second
+struct C8SchedulerThread
+{
+    C8Scheduler scheduler;
+    uint32_t core;
+    
+    std::thread thread;
+    std::atomic<bool> running;
+    
+    // Frames run and the time spent running them, the pacer counts the ones
+    // that overran
+    uint64_t frames_run;
+    int64_t busy_ns;
+    C8Pacer pacer;
+};
+
+void C8StartSchedulerThread(C8SchedulerThread* scheduler_thread, uint32_t core);
+void C8StopSchedulerThread(C8SchedulerThread* scheduler_thread);
+
+#endif
@@ -0,0 +1,284 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8Shadow.h"
+
+// Seeds rand before each frame, frame numbers are mixed in so every frame
+// draws different numbers
+#define SHADOW_SEED 0x5EED
+
+static inline uint64_t C8HashMix(uint64_t hash, uint64_t value)
+{
+    hash ^= value;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+// Size is a multiple of 8
+static uint64_t C8HashBytes(uint64_t hash, const uint8_t* bytes, uint32_t size)
+{
+    for(uint32_t offset = 0; offset < size; offset += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &bytes[offset], sizeof(word));
+        hash = C8HashMix(hash, word);
+    }
+    
+    return hash;
+}
+
+C8StateHash C8HashState(const C8Shadow* shadow, const Chip8* chip8)
+{
+    C8StateHash hash;
+    
+    hash.registers = C8HashBytes(0, chip8->V, sizeof(chip8->V));
+    hash.registers = C8HashMix(hash.registers,
+                               (uint64_t)chip8->I | ((uint64_t)chip8->pc << 16) | ((uint64_t)chip8->sp << 32) |
+                               ((uint64_t)chip8->delay_timer << 40) | ((uint64_t)chip8->sound_timer << 48) |
+                               ((uint64_t)chip8->fault << 56));
+    
+    hash.registers = C8HashMix(hash.registers, chip8->cycles);
+    
+    // Entries above sp are whatever was last popped
+    for(uint32_t entry = 0; entry < chip8->sp && entry < STACKSIZE; ++entry)
+    {
+        hash.registers = C8HashMix(hash.registers, chip8->stack[entry]);
+    }
+    
+    hash.memory = 0;
+    for(uint32_t page = 0; page < (MEMSIZE >> C8_PAGE_SHIFT); ++page)
+    {
+        uint64_t page_hash = shadow->shared_page_hashes[page];
+        if(chip8->private_pages & (1 << page))
+        {
+            page_hash = C8HashBytes(page, chip8->pages[page], C8_PAGE_SIZE);
+        }
+        hash.memory = C8HashMix(hash.memory, page_hash);
+    }
+    
+    hash.display = C8HashBytes(0, chip8->gfx, sizeof(chip8->gfx));
+    
+    return hash;
+}
+
+static inline bool C8SameHash(const C8StateHash* a, const C8StateHash* b)
+{
+    return a->registers == b->registers && a->memory == b->memory && a->display == b->display;
+}
+
+void C8ReferenceFrame(Chip8* chip8, uint32_t cycles)
+{
+    // A faulted chip stays halted
+    if(chip8->fault != C8_FAULT_NONE)
+    {
+        return;
+    }
+    
+    for(uint32_t cycle = 0; cycle < cycles; ++cycle)
+    {
+        C8EmulateCycle(chip8);
+
+#ifdef C8_CHECKED
+        // Trap at the instruction that faulted, without ticking the timers
+        if(chip8->fault != C8_FAULT_NONE)
+        {
+            return;
+        }
+#endif
+    }
+    
+    C8TickTimers(chip8);
+}
+
+// Runs the same frame on both with the same random numbers
+static void C8RunBoth(C8Shadow* shadow, Chip8* chip8, Chip8* reference, uint32_t frame, uint32_t cycles)
+{
+    srand(SHADOW_SEED + frame);
+    shadow->frame(chip8, cycles);
+    
+    srand(SHADOW_SEED + frame);
+    C8ReferenceFrame(reference, cycles);
+}
+
+static void C8ReplaceCopy(Chip8* to, const Chip8* from)
+{
+    C8ReleasePages(to);
+    C8CopyInstance(to, from);
+}
+
+static void C8ReportDivergence(C8Shadow* shadow, Chip8* chip8, Chip8* reference, uint32_t frame)
+{
+    C8StateHash hash = C8HashState(shadow, chip8);
+    C8StateHash reference_hash = C8HashState(shadow, reference);
+    
+    printf("Diverged from the reference after %llu instructions, in frame %u:%s%s%s differ\n",
+           (unsigned long long)shadow->divergence_cycle, frame,
+           hash.registers != reference_hash.registers ? " registers" : "",
+           hash.memory != reference_hash.memory ? " memory" : "",
+           hash.display != reference_hash.display ? " display" : "");
+    
+    for(uint32_t address = 0; address < MEMSIZE; ++address)
+    {
+        if(C8ReadMemory(chip8, address) != C8ReadMemory(reference, address))
+        {
+            printf("First memory difference at 0x%03X, %02X against %02X\n",
+                   address, C8ReadMemory(chip8, address), C8ReadMemory(reference, address));
+            break;
+        }
+    }
+    
+    printf("Checked:\n");
+    DumpRegisters(chip8);
+    printf("Reference:\n");
+    DumpRegisters(reference);
+}
+
+// Replays the frames since the last checkpoint to find the frame they
+// differ in, then that frame an instruction at a time
+static void C8FindDivergence(C8Shadow* shadow)
+{
+    Chip8 chip8;
+    Chip8 reference;
+    C8CopyInstance(&chip8, &shadow->checkpoint);
+    C8CopyInstance(&reference, &shadow->reference_checkpoint);
+    
+    Chip8 step;
+    Chip8 reference_step;
+    C8CopyInstance(&step, &chip8);
+    C8CopyInstance(&reference_step, &reference);
+    
+    bool found = false;
+    uint32_t frame = shadow->checkpoint_frame;
+    for(uint32_t cycles : shadow->frame_cycles)
+    {
+        C8RunBoth(shadow, &step, &reference_step, frame, cycles);
+        C8StateHash hash = C8HashState(shadow, &step);
+        C8StateHash reference_hash = C8HashState(shadow, &reference_step);
+        if(C8SameHash(&hash, &reference_hash))
+        {
+            C8ReplaceCopy(&chip8, &step);
+            C8ReplaceCopy(&reference, &reference_step);
+            ++frame;
+            continue;
+        }
+        
+        // Frames cut short end the same as the start of the whole frame, bar
+        // the timers ticking early on both
+        for(uint32_t length = 1; length <= cycles; ++length)
+        {
+            C8ReplaceCopy(&step, &chip8);
+            C8ReplaceCopy(&reference_step, &reference);
+            C8RunBoth(shadow, &step, &reference_step, frame, length);
+            
+            hash = C8HashState(shadow, &step);
+            reference_hash = C8HashState(shadow, &reference_step);
+            if(!C8SameHash(&hash, &reference_hash))
+            {
+                shadow->divergence_cycle = chip8.cycles + length;
+                break;
+            }
+        }
+        
+        C8ReportDivergence(shadow, &step, &reference_step, frame);
+        found = true;
+        break;
+    }
+    
+    // Only possible if a frame depends on more than its starting state
+    if(!found)
+    {
+        printf("Diverged from the reference by frame %u but replaying from frame %u matched\n",
+               shadow->frames, shadow->checkpoint_frame);
+    }
+    
+    C8ReleasePages(&chip8);
+    C8ReleasePages(&reference);
+    C8ReleasePages(&step);
+    C8ReleasePages(&reference_step);
+}
+
+void C8InitialiseShadow(C8Shadow* shadow, const Chip8* chip8, C8FrameFunc frame, uint32_t interval)
+{
+    const C8Image* image = chip8->image;
+    C8InitialiseImage(&shadow->image);
+    memcpy(shadow->image.memory, image->memory, sizeof(shadow->image.memory));
+    
+    for(uint32_t page = 0; page < (MEMSIZE >> C8_PAGE_SHIFT); ++page)
+    {
+        shadow->shared_page_hashes[page] = C8HashBytes(page, &image->memory[page * C8_PAGE_SIZE], C8_PAGE_SIZE);
+    }
+    
+    shadow->frame = frame;
+    shadow->interval = interval;
+    
+    // The reference shares pages with its own image instead
+    C8CopyInstance(&shadow->reference, chip8);
+    shadow->reference.image = &shadow->image;
+    for(uint32_t page = 0; page < C8_PAGE_TABLE_SIZE; ++page)
+    {
+        if(!(chip8->private_pages & (1 << page)))
+            shadow->reference.pages[page] = &shadow->image.memory[page * C8_PAGE_SIZE];
+    }
+    
+    C8CopyInstance(&shadow->checkpoint, chip8);
+    C8CopyInstance(&shadow->reference_checkpoint, &shadow->reference);
+    shadow->checkpoint_frame = 0;
+    shadow->frame_cycles.clear();
+    
+    shadow->frames = 0;
+    shadow->checks = 0;
+    shadow->diverged = false;
+    shadow->divergence_cycle = 0;
+}
+
+void C8DestroyShadow(C8Shadow* shadow)
+{
+    C8ReleasePages(&shadow->reference);
+    C8ReleasePages(&shadow->checkpoint);
+    C8ReleasePages(&shadow->reference_checkpoint);
+}
+
+bool C8ShadowCheck(C8Shadow* shadow, Chip8* chip8)
+{
+    if(shadow->diverged)
+    {
+        return false;
+    }
+    
+    ++shadow->checks;
+    
+    C8StateHash hash = C8HashState(shadow, chip8);
+    C8StateHash reference_hash = C8HashState(shadow, &shadow->reference);
+    if(C8SameHash(&hash, &reference_hash))
+    {
+        C8ReplaceCopy(&shadow->checkpoint, chip8);
+        C8ReplaceCopy(&shadow->reference_checkpoint, &shadow->reference);
+        shadow->checkpoint_frame = shadow->frames;
+        shadow->frame_cycles.clear();
+        return true;
+    }
+    
+    shadow->diverged = true;
+    C8FindDivergence(shadow);
+    return false;
+}
+
+bool C8ShadowFrame(C8Shadow* shadow, Chip8* chip8, uint32_t cycles)
+{
+    if(shadow->diverged)
+    {
+        return false;
+    }
+    
+    C8RunBoth(shadow, chip8, &shadow->reference, shadow->frames, cycles);
+    shadow->frame_cycles.push_back(cycles);
+    ++shadow->frames;
+    
+    if(chip8->cycles - shadow->checkpoint.cycles < shadow->interval)
+    {
+        return true;
+    }
+    
+    return C8ShadowCheck(shadow, chip8);
+}
@@ -0,0 +1,74 @@
+#ifndef _CHIP8SHADOW_H
+#define _CHIP8SHADOW_H
+
+#include <stdint.h>
+
+#include "Chip8.h"
+
+#include <vector>
+
+// Shadow execution, checks an optimised frame loop against the reference
+// interpreter. A second instance runs the same ROM from an image with nothing
+// pre-decoded, stepping every instruction through opcodes.cpp with no idle
+// loop skipping or fusion. Both are hashed every interval and on a mismatch
+// the frames since the last matching checkpoint are replayed to find the
+// first instruction they differ after. Both are seeded the same before every
+// frame so CXNN draws the same numbers, which changes them from a normal run
+
+// Runs a frame, eg. C8EmulateFrame or C8AotEmulateFrame
+typedef void (*C8FrameFunc)(Chip8*, uint32_t cycles);
+
+// Hashed apart so a mismatch says what differs
+struct C8StateHash
+{
+    uint64_t registers; // V, I, pc, the stack in use, timers, fault and instructions run
+    uint64_t memory;
+    uint64_t display;
+};
+
+struct C8Shadow
+{
+    // Same bytes as the image being checked, nothing decoded
+    C8Image image;
+    
+    // Memory hashes are kept per page, pages still shared with the image
+    // use the hash taken when the shadow was set up
+    uint64_t shared_page_hashes[MEMSIZE >> C8_PAGE_SHIFT];
+    
+    C8FrameFunc frame;
+    uint32_t interval; // Instructions between checks
+    
+    Chip8 reference;
+    
+    // Both instances at the last check that matched and the frames run since
+    Chip8 checkpoint;
+    Chip8 reference_checkpoint;
+    uint32_t checkpoint_frame;
+    std::vector<uint32_t> frame_cycles;
+    
+    uint32_t frames;
+    uint32_t checks;
+    
+    bool diverged;
+    uint64_t divergence_cycle; // Instructions run up to and including the first that differs
+};
+
+// The reference for C8EmulateFrame, every instruction stepped through the
+// opcode table with no idle loop skipping or fusion
+void C8ReferenceFrame(Chip8* chip8, uint32_t cycles);
+
+// The reference starts from a copy of chip8
+void C8InitialiseShadow(C8Shadow* shadow, const Chip8* chip8, C8FrameFunc frame, uint32_t interval);
+void C8DestroyShadow(C8Shadow* shadow);
+
+// Runs a frame of chip8 through the frame function and the reference, checks
+// them once interval instructions have run since the last check. Returns
+// false once they have diverged, after reporting where
+bool C8ShadowFrame(C8Shadow* shadow, Chip8* chip8, uint32_t cycles);
+
+// Checks now, eg. at the end of a run
+bool C8ShadowCheck(C8Shadow* shadow, Chip8* chip8);
+
+C8StateHash C8HashState(const C8Shadow* shadow, const Chip8* chip8);
+
+#endif
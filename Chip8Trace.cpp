@@ -0,0 +1,90 @@
+#include <cstring>
+#include <cstdio>
+
+#include "Chip8Trace.h"
+
+// A thread that saw tracing on just before it was turned off can still
+// record an event or two, leave that many of the oldest slots alone
+#define TRACE_WRITE_SLACK 16
+
+C8Tracer c8_tracer;
+thread_local C8TraceBuffer* c8_trace_buffer = nullptr;
+
+void C8TraceThread(const char* name)
+{
+    if(c8_trace_buffer)
+    {
+        return;
+    }
+    
+    uint32_t index = c8_tracer.buffer_count.fetch_add(1, std::memory_order_relaxed);
+    if(index >= C8_TRACE_MAX_THREADS)
+    {
+        printf("Too many traced threads, %s won't be traced\n", name);
+        return;
+    }
+    
+    C8TraceBuffer* buffer = new C8TraceBuffer;
+    buffer->thread_name = name;
+    buffer->thread_id = index + 1;
+    buffer->head.store(0, std::memory_order_relaxed);
+    
+    c8_trace_buffer = buffer;
+    c8_tracer.buffers[index].store(buffer, std::memory_order_release);
+}
+
+void C8EnableTrace(bool enabled)
+{
+    if(enabled)
+    {
+        c8_tracer.enabled_ns.store(C8TraceNow(), std::memory_order_relaxed);
+    }
+    
+    c8_tracer.enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool C8WriteTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if(!file)
+    {
+        return false;
+    }
+    
+    int64_t enabled_ns = c8_tracer.enabled_ns.load(std::memory_order_relaxed);
+    
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    
+    uint32_t buffer_count = c8_tracer.buffer_count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < buffer_count && i < C8_TRACE_MAX_THREADS; ++i)
+    {
+        const C8TraceBuffer* buffer = c8_tracer.buffers[i].load(std::memory_order_acquire);
+        if(!buffer)
+            continue;
+        
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->thread_id, buffer->thread_name);
+        first = false;
+        
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t tail = head > (C8_TRACE_RING_SIZE - TRACE_WRITE_SLACK) ? head - (C8_TRACE_RING_SIZE - TRACE_WRITE_SLACK) : 0;
+        
+        for(uint64_t e = tail; e < head; ++e)
+        {
+            const C8TraceEvent* event = &buffer->events[e & (C8_TRACE_RING_SIZE - 1)];
+            if(event->start_ns < enabled_ns)
+                continue;
+            
+            // Complete events, timestamps in microseconds from the trace start
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, buffer->thread_id,
+                    (event->start_ns - enabled_ns) / 1000.0,
+                    (event->end_ns - event->start_ns) / 1000.0);
+        }
+    }
+    
+    fprintf(file, "\n]}\n");
+    
+    return fclose(file) == 0;
+}
@@ -0,0 +1,115 @@
+#ifndef _CHIP8TRACE_H
+#define _CHIP8TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "Chip8.h"
+
+// Timeline of scoped events written out as Chrome trace JSON, open it in
+// Perfetto or chrome://tracing. Each thread records into its own ring buffer
+// so recording takes no locks, when the ring wraps the oldest events are lost.
+// Threads call C8TraceThread once to get a buffer, scopes on threads without
+// one record nothing. While tracing is off a scope costs a relaxed load
+#define C8_TRACE_RING_SIZE 65536 // Must be a power of 2
+#define C8_TRACE_MAX_THREADS 16
+
+struct C8TraceEvent
+{
+    const char* name; // Must outlive the trace, eg. a literal
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+struct C8TraceBuffer
+{
+    const char* thread_name;
+    uint32_t thread_id;
+    
+    C8TraceEvent events[C8_TRACE_RING_SIZE];
+    
+    // Events recorded, only the owning thread writes it
+    std::atomic<uint64_t> head;
+};
+
+struct C8Tracer
+{
+    std::atomic<bool> enabled;
+    
+    // Only events after this are written out
+    std::atomic<int64_t> enabled_ns;
+    
+    std::atomic<C8TraceBuffer*> buffers[C8_TRACE_MAX_THREADS];
+    std::atomic<uint32_t> buffer_count;
+};
+
+extern C8Tracer c8_tracer;
+extern thread_local C8TraceBuffer* c8_trace_buffer;
+
+// Gives the calling thread a buffer, name must outlive the trace
+void C8TraceThread(const char* name);
+
+// Turning tracing on starts a new trace, events from before are dropped
+void C8EnableTrace(bool enabled);
+
+// Writes the events recorded since tracing was last turned on, turn it off
+// first so threads aren't recording over the events being written. Returns
+// false if the file can't be written
+bool C8WriteTrace(const char* path);
+
+inline int64_t C8TraceNow()
+{
+    return PerfNano_Counter(Clock::now().time_since_epoch()).count();
+}
+
+inline void C8TraceRecord(const char* name, int64_t start_ns, int64_t end_ns)
+{
+    C8TraceBuffer* buffer = c8_trace_buffer;
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    
+    C8TraceEvent* event = &buffer->events[head & (C8_TRACE_RING_SIZE - 1)];
+    event->name = name;
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// Records a span the caller has already timed
+inline void C8TraceSpan(const char* name, Clock_Time start, Clock_Time end)
+{
+    if(c8_trace_buffer && c8_tracer.enabled.load(std::memory_order_relaxed))
+    {
+        C8TraceRecord(name,
+                      PerfNano_Counter(start.time_since_epoch()).count(),
+                      PerfNano_Counter(end.time_since_epoch()).count());
+    }
+}
+
+// Records the time from construction to destruction
+struct C8TraceScope
+{
+    const char* name;
+    int64_t start_ns;
+    
+    C8TraceScope(const char* scope_name)
+    {
+        name = scope_name;
+        start_ns = (c8_trace_buffer && c8_tracer.enabled.load(std::memory_order_relaxed)) ? C8TraceNow() : 0;
+    }
+    
+    ~C8TraceScope()
+    {
+        if(start_ns)
+        {
+            C8TraceRecord(name, start_ns, C8TraceNow());
+        }
+    }
+};
+
+#define C8_TRACE_CONCAT_(a, b) a##b
+#define C8_TRACE_CONCAT(a, b) C8_TRACE_CONCAT_(a, b)
+#define C8_TRACE_SCOPE(name) C8TraceScope C8_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif
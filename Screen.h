@@ -7,8 +7,13 @@
 
 #include <string>
 
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
+#include "Chip8.h"
+
+// The core keeps the display packed at 1 bit per pixel, uploaded as is
+#define PACKED_SCREEN_SIZE (SCREEN_PITCH * SCREEN_HEIGHT)
+
+// Number of pixel buffers in the texture streaming ring
+#define PIXEL_BUFFER_COUNT 3
 
 const float screen_quad_vert[] = {
     -1.0f, -1.0f, 0.0f,
@@ -43,9 +48,26 @@ struct Screen
     uint32_t glContextMajorVersion = 3;
     uint32_t glContextMinorVersion = 3;
     
+    // Set when the window contents need drawing again without a new frame
+    bool redraw = true;
+    
+    // Synchronous GL debug output slows down every GL call so it is opt in
+    bool gl_debug = false;
+    
     // Screen backbuffer
     uint32_t back_buffer;
     
+    // Pixel unpack buffers used to stream the framebuffer into the backbuffer
+    // without waiting on the GPU. When ARB_buffer_storage is available each
+    // buffer stays mapped for the lifetime of the screen and a fence guards
+    // its reuse, otherwise the buffers are orphaned on every upload
+    uint32_t pixel_buffer_size;
+    uint32_t pixel_buffers[PIXEL_BUFFER_COUNT];
+    uint8_t* pixel_buffer_mappings[PIXEL_BUFFER_COUNT];
+    GLsync pixel_buffer_fences[PIXEL_BUFFER_COUNT];
+    uint32_t pixel_buffer_index = 0;
+    bool persistent_pixel_buffers = false;
+    
     // Screen Vertex Buffer Objects
     uint32_t vertex_array_id;
     uint32_t vertex_buffer_verts;
@@ -54,10 +76,22 @@ struct Screen
     // Screen Shaders
     uint32_t shader_program;
     
-    uint32_t vertex_shader;
-    uint32_t fragment_shader;
-    
     uint32_t texture_sampler;
+    
+    // Mosaic view, draws one layer of a texture array per instance in a grid
+    // with a single instanced draw. Disabled when there are no layers
+    uint32_t mosaic_layers = 0;
+    uint32_t mosaic_columns;
+    uint32_t mosaic_rows;
+    uint32_t mosaic_texture;
+    uint32_t mosaic_program;
+    
+    // Colours for unset and set pixels
+    int32_t palette_uniform;
+    float palette[2][3] = {
+        { 0.0f, 0.0f, 0.0f },
+        { 1.0f, 1.0f, 1.0f },
+    };
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef _TRIPLEBUFFER_H
+#define _TRIPLEBUFFER_H
+
+#include <stdint.h>
+#include <cstring>
+
+#include <atomic>
+
+#include "Screen.h"
+
+// Set on the middle index when it holds a frame the reader hasn't seen
+#define TB_FRESH 0x80
+
+// Lock-free triple buffer used to hand completed frames from the emulation
+// thread to the render thread. The writer always owns the back buffer and the
+// reader always owns the front buffer, the middle buffer holds the newest
+// published frame and is swapped with an atomic exchange so neither side ever
+// waits on the other.
+struct TripleBuffer
+{
+    uint8_t frames[3][PACKED_SCREEN_SIZE];
+    
+    // Arrival time of the oldest key event each frame is the first to show,
+    // 0 if none
+    int64_t input_ns[3];
+    
+    std::atomic<uint8_t> middle;
+    
+    // Owned by the writer
+    uint8_t back;
+    
+    // Owned by the reader
+    uint8_t front;
+};
+
+inline void TBInitialise(TripleBuffer* tb)
+{
+    memset(tb->frames, 0, sizeof(tb->frames));
+    memset(tb->input_ns, 0, sizeof(tb->input_ns));
+    
+    tb->back = 0;
+    tb->middle.store(1);
+    tb->front = 2;
+}
+
+// Writer: the buffer to fill with the next frame
+inline uint8_t* TBBackBuffer(TripleBuffer* tb)
+{
+    return tb->frames[tb->back];
+}
+
+// Writer: mark the frame in the back buffer as showing input that arrived at
+// time_ns, the oldest time is kept
+inline void TBSetInputTime(TripleBuffer* tb, int64_t time_ns)
+{
+    if(tb->input_ns[tb->back] == 0 || time_ns < tb->input_ns[tb->back])
+    {
+        tb->input_ns[tb->back] = time_ns;
+    }
+}
+
+// Writer: make the back buffer the newest frame and take the old middle.
+// Returns true if that replaced a frame the reader never saw
+inline bool TBPublish(TripleBuffer* tb)
+{
+    uint8_t old_middle = tb->middle.exchange(tb->back | TB_FRESH, std::memory_order_acq_rel);
+    tb->back = old_middle & ~TB_FRESH;
+    
+    // A frame the reader never saw passes its input time on to the next one,
+    // which shows the same input
+    if(!(old_middle & TB_FRESH))
+    {
+        tb->input_ns[tb->back] = 0;
+    }
+    
+    return (old_middle & TB_FRESH) != 0;
+}
+
+// Reader: returns the newest frame if one has been published since the last
+// call, otherwise nullptr. The frame stays valid until the next acquire
+inline const uint8_t* TBAcquire(TripleBuffer* tb)
+{
+    if(!(tb->middle.load(std::memory_order_relaxed) & TB_FRESH))
+    {
+        return nullptr;
+    }
+    
+    uint8_t old_middle = tb->middle.exchange(tb->front, std::memory_order_acq_rel);
+    tb->front = old_middle & ~TB_FRESH;
+    
+    return tb->frames[tb->front];
+}
+
+// Reader: input time of the frame last acquired
+inline int64_t TBInputTime(const TripleBuffer* tb)
+{
+    return tb->input_ns[tb->front];
+}
+
+#endif
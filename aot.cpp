@@ -0,0 +1,47 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8.h"
+#include "Chip8Aot.h"
+
+// Translates a ROM into C++ to build Chip8Native from, see Chip8Aot.h
+
+void PrintUsage()
+{
+    printf("Usage: Chip8Aot rom out.cpp\n");
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+    
+    static C8Image image;
+    C8InitialiseImage(&image);
+    uint32_t size = LoadROM(&image, argv[1]);
+    
+    FILE* file = fopen(argv[2], "w");
+    if(!file)
+    {
+        printf("Failed to write %s\n", argv[2]);
+        return 1;
+    }
+    
+    // The ROM is named without its directory
+    const char* name = strrchr(argv[1], '/');
+    name = name ? name + 1 : argv[1];
+    
+    C8TranslateROM(file, image.memory, size, name);
+    
+    if(fclose(file) != 0)
+    {
+        printf("Failed to write %s\n", argv[2]);
+        return 1;
+    }
+    
+    return 0;
+}
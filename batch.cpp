@@ -0,0 +1,329 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8.h"
+#include "Chip8Metrics.h"
+#include "Chip8Debugger.h"
+#include "Chip8Shadow.h"
+
+#include <vector>
+
+// Headless batch runner, runs ROMs without a window as fast as possible
+
+void PrintUsage()
+{
+    printf("Usage: Chip8Batch [--frames N] [--cycles-per-frame N] [--no-idle-skip] [--metrics PATH] [--debug] [--shadow N] rom...\n");
+}
+
+// Frames between metrics samples
+#define METRICS_SAMPLE_FRAMES 64
+
+// State of each ROM run, exported with a label per ROM
+struct BatchInstance
+{
+    const char* rom;
+    uint64_t cycles;
+    uint64_t cycles_skipped;
+    uint32_t private_pages;
+    uint16_t pc;
+    uint8_t fault;
+};
+
+struct BatchMetrics
+{
+    C8MetricsRegistry registry;
+    C8Counter instructions;
+    C8Counter instructions_skipped;
+    C8Counter frames;
+    C8Counter faults;
+    C8Histogram frame_time;
+    
+    std::vector<BatchInstance> instances;
+};
+
+void RegisterBatchMetrics(BatchMetrics* metrics)
+{
+    C8RegisterCounter(&metrics->registry, &metrics->instructions, "chip8_instructions_total", "Instructions emulated, including skipped ones");
+    C8RegisterCounter(&metrics->registry, &metrics->instructions_skipped, "chip8_instructions_skipped_total", "Instructions skipped in idle loops");
+    C8RegisterCounter(&metrics->registry, &metrics->frames, "chip8_frames_emulated_total", "Frames emulated");
+    C8RegisterCounter(&metrics->registry, &metrics->faults, "chip8_faults_total", "ROMs halted by a fault");
+    C8RegisterHistogram(&metrics->registry, &metrics->frame_time, "chip8_emulate_frame_seconds", "Host time to emulate a frame");
+}
+
+void SnapshotInstance(BatchInstance* instance, const Chip8* chip8)
+{
+    instance->cycles = chip8->cycles;
+    instance->cycles_skipped = chip8->cycles_skipped;
+    instance->private_pages = __builtin_popcount(chip8->private_pages);
+    instance->pc = chip8->pc;
+    instance->fault = chip8->fault;
+}
+
+void WriteInstanceMetrics(FILE* file, void* context)
+{
+    BatchMetrics* metrics = (BatchMetrics*)context;
+    
+    fprintf(file, "# TYPE chip8_instance_cycles gauge\n");
+    for(const BatchInstance& instance : metrics->instances)
+    {
+        fprintf(file, "chip8_instance_cycles{rom=\"%s\"} %llu\n", instance.rom, (unsigned long long)instance.cycles);
+    }
+    
+    fprintf(file, "# TYPE chip8_instance_cycles_skipped gauge\n");
+    for(const BatchInstance& instance : metrics->instances)
+    {
+        fprintf(file, "chip8_instance_cycles_skipped{rom=\"%s\"} %llu\n", instance.rom, (unsigned long long)instance.cycles_skipped);
+    }
+    
+    fprintf(file, "# TYPE chip8_instance_private_pages gauge\n");
+    for(const BatchInstance& instance : metrics->instances)
+    {
+        fprintf(file, "chip8_instance_private_pages{rom=\"%s\"} %u\n", instance.rom, instance.private_pages);
+    }
+    
+    fprintf(file, "# TYPE chip8_instance_pc gauge\n");
+    for(const BatchInstance& instance : metrics->instances)
+    {
+        fprintf(file, "chip8_instance_pc{rom=\"%s\"} %u\n", instance.rom, instance.pc);
+    }
+    
+    fprintf(file, "# TYPE chip8_instance_fault gauge\n");
+    for(const BatchInstance& instance : metrics->instances)
+    {
+        fprintf(file, "chip8_instance_fault{rom=\"%s\"} %u\n", instance.rom, instance.fault);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // One emulated minute by default
+    uint32_t frames = 3600;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    bool idle_skip = true;
+    const char* metrics_path = nullptr;
+    bool debug = false;
+    
+    // Instructions between shadow checks, 0 when not shadowing
+    uint32_t shadow_interval = 0;
+    
+    std::vector<const char*> roms;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--frames") == 0 && (arg + 1) < argc)
+        {
+            frames = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--cycles-per-frame") == 0 && (arg + 1) < argc)
+        {
+            cycles_per_frame = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--no-idle-skip") == 0)
+        {
+            idle_skip = false;
+        }
+        else if(strcmp(argv[arg], "--debug") == 0)
+        {
+            debug = true;
+        }
+        else if(strcmp(argv[arg], "--shadow") == 0 && (arg + 1) < argc)
+        {
+            shadow_interval = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--metrics") == 0 && (arg + 1) < argc)
+        {
+            metrics_path = argv[++arg];
+        }
+        else
+        {
+            roms.push_back(argv[arg]);
+        }
+    }
+    
+    // The debugger stops part way through frames, which the shadow can't
+    if(roms.empty() || (debug && shadow_interval))
+    {
+        PrintUsage();
+        return 1;
+    }
+    
+    uint64_t total_cycles = 0;
+    uint64_t total_skipped = 0;
+    int64_t total_ns = 0;
+    
+    C8PagePool pool;
+    
+    // Timing each frame costs a clock read, only pay for it when exporting
+    static BatchMetrics metrics;
+    if(metrics_path)
+    {
+        RegisterBatchMetrics(&metrics);
+    }
+    Clock_Time next_dump = Clock::now();
+    
+    // Holds an image and instances, too big for the stack
+    static C8Shadow shadow;
+    uint32_t diverged = 0;
+    
+    for(const char* rom : roms)
+    {
+        C8Image image;
+        C8InitialiseImage(&image);
+        LoadROM(&image, rom);
+        
+        Chip8 chip8 = {};
+        C8Initialise(&chip8, &image, &pool);
+        
+        C8Debugger debugger;
+        C8InitialiseDebugger(&debugger);
+        
+        if(shadow_interval)
+        {
+            C8InitialiseShadow(&shadow, &chip8, idle_skip ? C8EmulateFrame : C8ReferenceFrame, shadow_interval);
+        }
+        
+        BatchInstance instance = {};
+        instance.rom = rom;
+        metrics.instances.push_back(instance);
+        
+        Clock_Time start = Clock::now();
+        
+        // Counted up to where metrics were last flushed
+        uint64_t flushed_cycles = 0;
+        uint64_t flushed_skipped = 0;
+        uint32_t flushed_frames = 0;
+        
+        uint32_t frame = 0;
+        for(; frame < frames && chip8.fault == C8_FAULT_NONE; ++frame)
+        {
+            // A frame can take less time than reading the clock twice, so
+            // only time one in every METRICS_SAMPLE_FRAMES and flush the
+            // counters alongside
+            bool sample = metrics_path && (frame % METRICS_SAMPLE_FRAMES) == 0;
+            Clock_Time frame_start;
+            if(sample)
+            {
+                frame_start = Clock::now();
+            }
+            
+            if(debug)
+            {
+                // Run the frame a stop at a time, handing over to the
+                // debugger at each
+                bool quit = false;
+                while(!C8DebugFrame(&chip8, &debugger, cycles_per_frame))
+                {
+                    if(!C8DebugRepl(&chip8, &debugger))
+                    {
+                        quit = true;
+                        break;
+                    }
+                }
+                
+                if(quit)
+                {
+                    break;
+                }
+            }
+            else if(shadow_interval)
+            {
+                if(!C8ShadowFrame(&shadow, &chip8, cycles_per_frame))
+                {
+                    break;
+                }
+            }
+            else if(idle_skip)
+            {
+                C8EmulateFrame(&chip8, cycles_per_frame);
+            }
+            else
+            {
+                C8ReferenceFrame(&chip8, cycles_per_frame);
+            }
+            
+            if(sample)
+            {
+                Clock_Time frame_end = Clock::now();
+                C8ObserveDuration(&metrics.frame_time, PerfNano_Counter(frame_end - frame_start).count());
+                
+                C8AddCounter(&metrics.instructions, chip8.cycles - flushed_cycles);
+                C8AddCounter(&metrics.instructions_skipped, chip8.cycles_skipped - flushed_skipped);
+                C8AddCounter(&metrics.frames, (frame + 1) - flushed_frames);
+                flushed_cycles = chip8.cycles;
+                flushed_skipped = chip8.cycles_skipped;
+                flushed_frames = frame + 1;
+                
+                // Dump about once a second
+                if(frame_end >= next_dump)
+                {
+                    SnapshotInstance(&metrics.instances.back(), &chip8);
+                    C8DumpMetrics(&metrics.registry, metrics_path, WriteInstanceMetrics, &metrics);
+                    next_dump = frame_end + std::chrono::seconds(1);
+                }
+            }
+        }
+        
+        C8AddCounter(&metrics.instructions, chip8.cycles - flushed_cycles);
+        C8AddCounter(&metrics.instructions_skipped, chip8.cycles_skipped - flushed_skipped);
+        C8AddCounter(&metrics.frames, frame - flushed_frames);
+        
+        int64_t elapsed_ns = PerfNano_Counter(Clock::now() - start).count();
+        
+        printf("%s: %llu cycles, %llu skipped (%.1f%%) in %.3fms\n",
+               rom,
+               (unsigned long long)chip8.cycles,
+               (unsigned long long)chip8.cycles_skipped,
+               chip8.cycles ? (chip8.cycles_skipped * 100.0) / chip8.cycles : 0.0,
+               elapsed_ns / 1000000.0);
+        
+        if(shadow_interval)
+        {
+            // Catch anything since the last check
+            if(!C8ShadowCheck(&shadow, &chip8))
+            {
+                ++diverged;
+            }
+            else
+            {
+                printf("Matched the reference at %u checks\n", shadow.checks);
+            }
+            C8DestroyShadow(&shadow);
+        }
+        
+        if(chip8.fault != C8_FAULT_NONE)
+        {
+            C8ReportFault(&chip8);
+            C8AddCounter(&metrics.faults, 1);
+        }
+        
+        SnapshotInstance(&metrics.instances.back(), &chip8);
+        
+        C8ReleasePages(&chip8);
+        
+        total_cycles += chip8.cycles;
+        total_skipped += chip8.cycles_skipped;
+        total_ns += elapsed_ns;
+    }
+    
+    // Host time per emulated second, each frame is 1/60th of a second
+    double emulated_seconds = (frames / 60.0) * roms.size();
+    
+    printf("Total: %llu cycles, %llu skipped, %.3fms host time per emulated second\n",
+           (unsigned long long)total_cycles,
+           (unsigned long long)total_skipped,
+           (total_ns / 1000000.0) / emulated_seconds);
+    
+    if(metrics_path && !C8DumpMetrics(&metrics.registry, metrics_path, WriteInstanceMetrics, &metrics))
+    {
+        printf("Failed to write metrics to %s\n", metrics_path);
+    }
+    
+    if(shadow_interval)
+    {
+        printf("Shadow: %u of %u ROMs diverged from the reference\n", diverged, (uint32_t)roms.size());
+    }
+    
+    C8DestroyPagePool(&pool);
+    
+    return diverged ? 1 : 0;
+}
@@ -0,0 +1,463 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "Chip8.h"
+#include "Chip8Pool.h"
+#include "Chip8Scheduler.h"
+
+// Microbenchmark, runs many instances of one ROM a frame at a time the way a
+// batch farm packs them and reports the per instance footprint and speed
+
+void PrintUsage()
+{
+    printf("Usage: Chip8Bench [--instances N] [--frames N] [--cycles-per-frame N] [--lifecycle N] [--scheduler SECONDS] [--perf] rom\n");
+}
+
+// Hardware counters read around the workload with perf_event_open. They are
+// opened as one group led by cycles so they are scheduled onto the PMU
+// together and count over the same window. Counters the host can't provide
+// are left out, on a VM without a PMU or with perf_event_paranoid too high
+// none of them open and the run goes ahead without them
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+struct PerfCounters
+{
+    int fds[PERF_COUNTER_COUNT];
+    uint64_t values[PERF_COUNTER_COUNT];
+    
+    // The first counter that opened, cycles unless the host lacks it
+    int leader;
+    
+    // Times the group was enabled and actually on the PMU, the values have
+    // been scaled up by their ratio if it was multiplexed with other events
+    uint64_t time_enabled;
+    uint64_t time_running;
+    
+    // False if the group was never on the PMU or couldn't be read, there are
+    // no values to report
+    bool read;
+};
+
+// Layout of a group read with the times
+struct PerfGroupRead
+{
+    uint64_t count;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_COUNTER_COUNT];
+};
+
+static const char* perf_counter_names[PERF_COUNTER_COUNT] =
+{
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1d misses",
+};
+
+static int OpenPerfCounter(uint32_t type, uint64_t config, int leader)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    
+    // Members follow the leader, which is enabled and read for the group
+    attr.disabled = leader < 0;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    
+    // This thread only, on whichever CPU it runs
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+bool OpenPerfCounters(PerfCounters* counters)
+{
+    static const uint32_t types[PERF_COUNTER_COUNT] =
+    {
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE,
+    };
+    
+    static const uint64_t configs[PERF_COUNTER_COUNT] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+    
+    counters->leader = -1;
+    counters->time_enabled = 0;
+    counters->time_running = 0;
+    counters->read = false;
+    for(uint32_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        counters->values[i] = 0;
+        counters->fds[i] = OpenPerfCounter(types[i], configs[i], counters->leader);
+        
+        if(counters->fds[i] < 0)
+        {
+            printf("Perf counter %s unavailable (%s)\n", perf_counter_names[i], strerror(errno));
+        }
+        else if(counters->leader < 0)
+        {
+            counters->leader = counters->fds[i];
+        }
+    }
+    
+    return counters->leader >= 0;
+}
+
+void StartPerfCounters(PerfCounters* counters)
+{
+    ioctl(counters->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void StopPerfCounters(PerfCounters* counters)
+{
+    ioctl(counters->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    
+    PerfGroupRead group;
+    ssize_t size = read(counters->leader, &group, sizeof(group));
+    if(size < (ssize_t)(3 * sizeof(uint64_t)) || group.time_running == 0)
+    {
+        counters->read = false;
+        return;
+    }
+    
+    counters->read = true;
+    counters->time_enabled = group.time_enabled;
+    counters->time_running = group.time_running;
+    
+    // Values come in the order the members were opened
+    uint32_t value = 0;
+    for(uint32_t i = 0; i < PERF_COUNTER_COUNT && value < group.count; ++i)
+    {
+        if(counters->fds[i] < 0)
+            continue;
+        
+        counters->values[i] = group.values[value++];
+        if(group.time_running < group.time_enabled)
+        {
+            counters->values[i] = (uint64_t)((double)counters->values[i] * group.time_enabled / group.time_running);
+        }
+    }
+}
+
+void ClosePerfCounters(PerfCounters* counters)
+{
+    for(uint32_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(counters->fds[i] >= 0)
+        {
+            close(counters->fds[i]);
+        }
+    }
+}
+
+void ReportPerfCounters(const PerfCounters* counters, uint64_t executed)
+{
+    if(!counters->read)
+    {
+        printf("Perf counters were never scheduled, no counts to report\n");
+        return;
+    }
+    
+    if(counters->time_running < counters->time_enabled)
+    {
+        printf("Counters were multiplexed, on the PMU for %.1f%% of the run, values are scaled up\n",
+               (counters->time_running * 100.0) / counters->time_enabled);
+    }
+    
+    // Per CHIP-8 instruction actually executed, skipped ones cost nothing
+    for(uint32_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        if(counters->fds[i] >= 0)
+        {
+            printf("%llu %s, %.2f per instruction executed\n",
+                   (unsigned long long)counters->values[i], perf_counter_names[i],
+                   executed ? (double)counters->values[i] / executed : 0.0);
+        }
+    }
+    
+    if(counters->fds[PERF_CYCLES] >= 0 && counters->fds[PERF_INSTRUCTIONS] >= 0 && counters->values[PERF_CYCLES])
+    {
+        printf("%.2f host instructions per cycle\n",
+               (double)counters->values[PERF_INSTRUCTIONS] / counters->values[PERF_CYCLES]);
+    }
+}
+
+void BenchLifecycle(const C8Image* image, uint32_t instance_count, uint32_t iterations)
+{
+    C8PagePool page_pool;
+    
+    // Baseline, an instance at a time from the system allocator
+    Clock_Time start = Clock::now();
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        Chip8* chip8 = C8CreateInstances(1, image, &page_pool);
+        C8DestroyInstances(chip8, 1);
+    }
+    int64_t malloc_ns = PerfNano_Counter(Clock::now() - start).count();
+    
+    C8InstancePool pool;
+    if(!C8CreateInstancePool(&pool, instance_count, image, &page_pool))
+    {
+        return;
+    }
+    
+    // Acquire and release, releasing resets the instance
+    start = Clock::now();
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        Chip8* chip8 = C8AcquireInstance(&pool);
+        C8ReleaseInstance(&pool, chip8);
+    }
+    int64_t pool_ns = PerfNano_Counter(Clock::now() - start).count();
+    
+    // Resets of an instance that wrote to memory, so a page goes back each time
+    Chip8* chip8 = C8AcquireInstance(&pool);
+    start = Clock::now();
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        C8WriteMemory(chip8, 0x300, (uint8_t)i);
+        C8ResetInstance(&pool, chip8);
+    }
+    int64_t reset_ns = PerfNano_Counter(Clock::now() - start).count();
+    C8ReleaseInstance(&pool, chip8);
+    
+    printf("Instance pool of %u, %.1fMB arena, %s\n",
+           instance_count, pool.arena_size / (1024.0 * 1024.0),
+           pool.huge_pages ? "huge pages" : "transparent huge pages if available");
+    printf("Create/destroy with malloc: %.1fns\n", (double)malloc_ns / iterations);
+    printf("Acquire/release from pool: %.1fns\n", (double)pool_ns / iterations);
+    printf("Reset after a write: %.1fns\n", (double)reset_ns / iterations);
+    
+    C8DestroyInstancePool(&pool);
+    C8DestroyPagePool(&page_pool);
+}
+
+void BenchScheduler(const C8Image* image, uint32_t instance_count, uint32_t cycles_per_frame, uint32_t seconds)
+{
+    // A scheduler per core, each paced to real time with its share of the
+    // instances
+    uint32_t core_count = std::thread::hardware_concurrency();
+    if(core_count == 0)
+    {
+        core_count = 1;
+    }
+    
+    C8PagePool page_pool;
+    Chip8* instances = C8CreateInstances(instance_count, image, &page_pool);
+    
+    C8SchedulerThread* schedulers = new C8SchedulerThread[core_count];
+    for(uint32_t core = 0; core < core_count; ++core)
+    {
+        C8InitialiseScheduler(&schedulers[core].scheduler, cycles_per_frame);
+    }
+    for(uint32_t i = 0; i < instance_count; ++i)
+    {
+        C8AddTask(&schedulers[i % core_count].scheduler, &instances[i]);
+    }
+    
+    for(uint32_t core = 0; core < core_count; ++core)
+    {
+        C8StartSchedulerThread(&schedulers[core], core);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    for(uint32_t core = 0; core < core_count; ++core)
+    {
+        C8StopSchedulerThread(&schedulers[core]);
+    }
+    
+    printf("%u instances on %u cores for %us\n", instance_count, core_count, seconds);
+    
+    const double frame_ns = 1000000000.0 / 60;
+    for(uint32_t core = 0; core < core_count; ++core)
+    {
+        C8SchedulerThread* scheduler_thread = &schedulers[core];
+        uint32_t task_count = scheduler_thread->scheduler.tasks.size();
+        double busy_ns = scheduler_thread->frames_run ? (double)scheduler_thread->busy_ns / scheduler_thread->frames_run : 0;
+        
+        printf("Core %u: %u instances, %u parked, %u halted\n", core, task_count,
+               scheduler_thread->scheduler.parked_count, scheduler_thread->scheduler.halted_count);
+        printf("    %llu frames, %llu overran, %.1fus of work per frame (%.1f%% busy)\n",
+               (unsigned long long)scheduler_thread->frames_run,
+               (unsigned long long)scheduler_thread->pacer.frames_late,
+               busy_ns / 1000.0, (busy_ns * 100.0) / frame_ns);
+        if(busy_ns > 0)
+        {
+            printf("    About %.0f instances at real time\n", (task_count * frame_ns) / busy_ns);
+        }
+        
+        C8PrintPacerJitter(&scheduler_thread->pacer);
+    }
+    
+    delete[] schedulers;
+    C8DestroyInstances(instances, instance_count);
+    C8DestroyPagePool(&page_pool);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t instance_count = 10000;
+    uint32_t frames = 600;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint32_t lifecycle_iterations = 0;
+    uint32_t scheduler_seconds = 0;
+    bool perf = false;
+    const char* rom = nullptr;
+    
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--instances") == 0 && (arg + 1) < argc)
+        {
+            instance_count = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--frames") == 0 && (arg + 1) < argc)
+        {
+            frames = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--cycles-per-frame") == 0 && (arg + 1) < argc)
+        {
+            cycles_per_frame = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--lifecycle") == 0 && (arg + 1) < argc)
+        {
+            lifecycle_iterations = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--perf") == 0)
+        {
+            perf = true;
+        }
+        else if(strcmp(argv[arg], "--scheduler") == 0 && (arg + 1) < argc)
+        {
+            scheduler_seconds = atoi(argv[++arg]);
+        }
+        else
+        {
+            rom = argv[arg];
+        }
+    }
+    
+    if(!rom || instance_count == 0)
+    {
+        PrintUsage();
+        return 1;
+    }
+    
+    // Every instance shares the one image
+    C8Image image;
+    C8InitialiseImage(&image);
+    LoadROM(&image, rom);
+    
+    // The counters only follow this thread, and only around the frame run
+    if(perf && (lifecycle_iterations || scheduler_seconds))
+    {
+        printf("--perf only covers the frame run, ignored with --lifecycle and --scheduler\n");
+    }
+    
+    if(lifecycle_iterations)
+    {
+        BenchLifecycle(&image, instance_count, lifecycle_iterations);
+        return 0;
+    }
+    
+    if(scheduler_seconds)
+    {
+        BenchScheduler(&image, instance_count, cycles_per_frame, scheduler_seconds);
+        return 0;
+    }
+    
+    C8PagePool pool;
+    Chip8* instances = C8CreateInstances(instance_count, &image, &pool);
+    
+    PerfCounters counters;
+    if(perf)
+    {
+        perf = OpenPerfCounters(&counters);
+        if(!perf)
+        {
+            printf("No perf counters available, running without them\n");
+        }
+    }
+    
+    if(perf)
+    {
+        StartPerfCounters(&counters);
+    }
+    
+    Clock_Time start = Clock::now();
+    
+    for(uint32_t frame = 0; frame < frames; ++frame)
+    {
+        for(uint32_t i = 0; i < instance_count; ++i)
+        {
+            C8EmulateFrame(&instances[i], cycles_per_frame);
+        }
+    }
+    
+    int64_t elapsed_ns = PerfNano_Counter(Clock::now() - start).count();
+    
+    if(perf)
+    {
+        StopPerfCounters(&counters);
+    }
+    
+    uint64_t cycles = 0;
+    uint64_t cycles_skipped = 0;
+    uint64_t private_pages = 0;
+    for(uint32_t i = 0; i < instance_count; ++i)
+    {
+        cycles += instances[i].cycles;
+        cycles_skipped += instances[i].cycles_skipped;
+        private_pages += __builtin_popcount(instances[i].private_pages);
+    }
+    
+    uint64_t instance_frames = (uint64_t)instance_count * frames;
+    
+    // Private pages are the only memory an instance doesn't share
+    uint64_t total_bytes = (sizeof(Chip8) * (uint64_t)instance_count) + (private_pages * C8_PAGE_SIZE);
+    
+    printf("%u instances of %s, %u bytes each plus %.2f private pages (%.1fMB)\n",
+           instance_count, rom, (uint32_t)sizeof(Chip8),
+           (double)private_pages / instance_count,
+           total_bytes / (1024.0 * 1024.0));
+    printf("%u frames in %.3fms, %.1fns per instance frame\n",
+           frames, elapsed_ns / 1000000.0, (double)elapsed_ns / instance_frames);
+    printf("%llu cycles executed, %llu skipped, %.1f million executed per second\n",
+           (unsigned long long)(cycles - cycles_skipped),
+           (unsigned long long)cycles_skipped,
+           ((cycles - cycles_skipped) * 1000.0) / elapsed_ns);
+    
+    if(perf)
+    {
+        ReportPerfCounters(&counters, cycles - cycles_skipped);
+        ClosePerfCounters(&counters);
+    }
+    
+    C8DestroyInstances(instances, instance_count);
+    C8DestroyPagePool(&pool);
+    
+    return 0;
+}
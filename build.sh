@@ -6,13 +6,14 @@ set -x
 MEMDEBUG=0
 DEBUGSYMBOLS=1
 VERBOSEWARNINGS=1
+CHECKEDMEMORY=0
 
 # Build Type
 BUILD_TYPE=Debug
 #BUILD_TYPE=Release
 
 # Run cmake to create the build scripts
-cmake -H. -B.cmake -DCMAKE_BUILD_TYPE=$BUILD_TYPE -DDEBUGSYMBOLS=$DEBUGSYMBOLS -DMEMDEBUG=$MEMDEBUG -DVERBOSEWARNINGS=$VERBOSEWARNINGS
+cmake -H. -B.cmake -DCMAKE_BUILD_TYPE=$BUILD_TYPE -DDEBUGSYMBOLS=$DEBUGSYMBOLS -DMEMDEBUG=$MEMDEBUG -DVERBOSEWARNINGS=$VERBOSEWARNINGS -DCHECKEDMEMORY=$CHECKEDMEMORY
 
 MAKEOPTS="-j$(nproc --ignore=1)"
 
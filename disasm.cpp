@@ -0,0 +1,230 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8.h"
+#include "Chip8Disasm.h"
+#include "Chip8Cfg.h"
+#include "opcodes.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Disassembles ROMs into annotated listings, a whole library at a time
+
+void PrintUsage()
+{
+    printf("Usage: Chip8Disasm [--out DIR] [--cfg DIR] [--quiet] [--sequences] rom...\n");
+}
+
+// How many sequences of each length --sequences reports
+#define TOP_SEQUENCES 20
+
+// Prints the most frequent sequences of the given length, marking the ones
+// the pre-decoder fuses
+void PrintSequences(const std::vector<uint64_t>& counts, uint32_t length)
+{
+    std::vector<std::pair<uint64_t, uint32_t> > ranked;
+    for(uint32_t index = 0; index < counts.size(); ++index)
+    {
+        if(counts[index] != 0)
+            ranked.push_back(std::make_pair(counts[index], index));
+    }
+    
+    // Most frequent first, ties in table order
+    std::sort(ranked.begin(), ranked.end(),
+              [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b)
+              {
+                  return a.first != b.first ? a.first > b.first : a.second < b.second;
+              });
+    
+    printf("Most frequent %s\n", length == 2 ? "pairs" : "triples");
+    for(uint32_t rank = 0; rank < ranked.size() && rank < TOP_SEQUENCES; ++rank)
+    {
+        // Unpack the entries, the first is the most significant
+        uint8_t ids[3];
+        uint32_t index = ranked[rank].second;
+        for(uint32_t i = length; i-- > 0;)
+        {
+            ids[i] = index % C8_OP_COUNT;
+            index /= C8_OP_COUNT;
+        }
+        
+        std::string names;
+        for(uint32_t i = 0; i < length; ++i)
+        {
+            names += (i ? " " : "");
+            names += opcode_info[ids[i]].name;
+        }
+        
+        const char* fused_name = nullptr;
+        for(uint32_t fused = 0; fused < C8_FUSED_COUNT; ++fused)
+        {
+            if(fused_info[fused].length == length &&
+               std::equal(ids, ids + length, fused_info[fused].ids))
+            {
+                fused_name = fused_info[fused].name;
+            }
+        }
+        
+        if(fused_name)
+            printf("%10llu  %-32s fused as %s\n", (unsigned long long)ranked[rank].first, names.c_str(), fused_name);
+        else
+            printf("%10llu  %s\n", (unsigned long long)ranked[rank].first, names.c_str());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* out_dir = nullptr;
+    const char* cfg_dir = nullptr;
+    bool quiet = false;
+    bool sequences = false;
+    
+    std::vector<const char*> roms;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--out") == 0 && (arg + 1) < argc)
+        {
+            out_dir = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--cfg") == 0 && (arg + 1) < argc)
+        {
+            cfg_dir = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--quiet") == 0)
+        {
+            quiet = true;
+        }
+        else if(strcmp(argv[arg], "--sequences") == 0)
+        {
+            sequences = true;
+        }
+        else
+        {
+            roms.push_back(argv[arg]);
+        }
+    }
+    
+    if(roms.empty())
+    {
+        PrintUsage();
+        return 1;
+    }
+    
+    static C8Image image;
+    static C8Analysis analysis;
+    C8Cfg cfg;
+    C8SequenceCounts sequence_counts;
+    
+    uint64_t total_bytes = 0;
+    uint64_t total_instructions = 0;
+    uint64_t total_code_bytes = 0;
+    uint32_t total_computed_jumps = 0;
+    uint64_t total_blocks = 0;
+    uint64_t total_loops = 0;
+    uint64_t total_subroutines = 0;
+    
+    Clock_Time start = Clock::now();
+    
+    for(const char* rom : roms)
+    {
+        C8InitialiseImage(&image);
+        uint32_t size = LoadROM(&image, rom);
+        
+        C8AnalyseROM(&analysis, image.memory, size);
+        
+        uint32_t code_bytes = analysis.instructions * 2;
+        total_bytes += size;
+        total_instructions += analysis.instructions;
+        total_code_bytes += code_bytes;
+        total_computed_jumps += analysis.computed_jumps;
+        
+        if(sequences)
+            C8CountSequences(&sequence_counts, &analysis, image.memory);
+        
+        C8BuildCfg(&cfg, &analysis, image.memory);
+        total_blocks += cfg.blocks.size();
+        total_loops += cfg.loops;
+        total_subroutines += cfg.subroutines.size() - (cfg.blocks.empty() ? 0 : 1);
+        
+        // Output files are named after the ROM, without its directory
+        const char* name = strrchr(rom, '/');
+        name = name ? name + 1 : rom;
+        
+        if(cfg_dir)
+        {
+            std::string path = std::string(cfg_dir) + "/" + name + ".dot";
+            FILE* file = fopen(path.c_str(), "w");
+            if(!file)
+            {
+                printf("Failed to write %s\n", path.c_str());
+                return 1;
+            }
+            
+            C8WriteDot(file, &cfg, image.memory, name);
+            fclose(file);
+        }
+        
+        if(quiet)
+        {
+            printf("%s: %u bytes, %u code, %u data, %u blocks, %u loops, %u subroutines, %u computed jumps\n",
+                   rom, size, code_bytes, size > code_bytes ? size - code_bytes : 0,
+                   (uint32_t)cfg.blocks.size(), cfg.loops,
+                   (uint32_t)cfg.subroutines.size() - (cfg.blocks.empty() ? 0 : 1),
+                   analysis.computed_jumps);
+            continue;
+        }
+        
+        if(!out_dir)
+        {
+            // Only the graphs or sequences were asked for
+            if(cfg_dir || sequences)
+                continue;
+            
+            printf("; %s\n", rom);
+            C8WriteListing(stdout, &analysis, image.memory);
+            printf("\n");
+            continue;
+        }
+        
+        std::string path = std::string(out_dir) + "/" + name + ".asm";
+        
+        FILE* file = fopen(path.c_str(), "w");
+        if(!file)
+        {
+            printf("Failed to write %s\n", path.c_str());
+            return 1;
+        }
+        
+        fprintf(file, "; %s\n", rom);
+        C8WriteListing(file, &analysis, image.memory);
+        fclose(file);
+    }
+    
+    int64_t elapsed_ns = PerfNano_Counter(Clock::now() - start).count();
+    
+    // Listings on stdout would bury the summary
+    if(quiet || out_dir || cfg_dir || sequences)
+    {
+        printf("%u ROMs, %llu bytes, %llu in code (%llu instructions), %llu blocks, %llu loops, %llu subroutines, %u computed jumps in %.3fms\n",
+               (uint32_t)roms.size(),
+               (unsigned long long)total_bytes,
+               (unsigned long long)total_code_bytes,
+               (unsigned long long)total_instructions,
+               (unsigned long long)total_blocks,
+               (unsigned long long)total_loops,
+               (unsigned long long)total_subroutines,
+               total_computed_jumps,
+               elapsed_ns / 1000000.0);
+    }
+    
+    if(sequences)
+    {
+        PrintSequences(sequence_counts.pairs, 2);
+        PrintSequences(sequence_counts.triples, 3);
+    }
+    
+    return 0;
+}
@@ -4,91 +4,27 @@
 #include <cassert>
 
 #include "Chip8.h"
-#include "opcodes.h"
+#include "Screen.h"
+#include "TripleBuffer.h"
+#include "Chip8Pacer.h"
+#include "Chip8Metrics.h"
+#include "Chip8Trace.h"
+#include "Chip8Debugger.h"
 
 // For Windowing and input
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <cmath>
 #include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
 
-// Include the tests
-#include "tests.h"
-
-void LoadROM(Chip8* chip8, const char* file_name)
-{
-    // Load ROM into the memory (starting at 0x200)
-    FILE* f = fopen(file_name, "rb");
-    if(f)
-    {
-        uint32_t bytes_read = 0;
-        // Read directly into memory
-        while(!feof(f))
-        {
-            // Read into memory
-            fread(&chip8->memory[0x200 + bytes_read], 1, 1, f);
-            bytes_read++;
-        }
-        
-        fclose(f);
-    }
-    else
-    {
-        // Failed to load
-        printf("Failed to load ROM %s\n", file_name);
-        exit(1);
-    }
-}
-
-void C8Initialise(Chip8* chip8)
-{
-    // Setup default program counter
-    chip8->pc = 0x200;
-    
-    chip8->opcode = 0;
-    
-    // Setup fonts
-    for(int i = 0; i < 80; ++i)
-        chip8->memory[i] = chip8_fontset[i];
-}
-
-void C8GetOpcode(Chip8* chip8)
-{
-    // Get opcode at current program counter location
-    chip8->opcode = (chip8->memory[chip8->pc] << 8) | chip8->memory[chip8->pc+1];
-}
-
-void C8EmulateCycle(Chip8* chip8)
-{
-    // Get the current opcode
-    C8GetOpcode(chip8);
-    
-    // Increment the PC
-    chip8->pc +=2;
-    
-    assert(chip8->pc < MEMSIZE);
-    
-    // Opcode is now in memory, decode
-    //printf("Opcode: 0x%X\n", chip8->opcode);
-    opcode_table[chip8->opcode >> 12](chip8);
-}
-
-void C8DecrementCounters(Chip8* chip8)
-{
-    Clock_Time current_time = Clock::now();
-    int64_t nanoseconds = PerfNano_Counter(current_time - chip8->start_time).count();
-    
-    if((nanoseconds / 1000000) > 16)
-    {
-        if(chip8->delay_timer != 0)
-            --chip8->delay_timer;
-        
-        if(chip8->sound_timer != 0)
-            --chip8->sound_timer;
-        
-        chip8->start_time = Clock::now();
-    }
-}
+#include <signal.h>
 
 #include <iostream>
 void PrintGLFWErr(int error, const char* description)
@@ -163,6 +99,11 @@ void CreateWindow(Screen* screen)
     // Set 24 bit depth buffer
     glfwWindowHint(GLFW_DEPTH_BITS, 24);
     
+    if(screen->gl_debug)
+    {
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+    }
+    
     screen->window = glfwCreateWindow(screen->window_width,
                                       screen->window_height, 
                                       screen->window_title.c_str(),
@@ -182,18 +123,23 @@ void CreateWindow(Screen* screen)
     glewExperimental = GL_TRUE;
     glewInit();
     
-    printf("Enabling OpenGL Debug Logging...\n");
-    
-    // Enable the debug callback
-    glEnable(GL_DEBUG_OUTPUT);
-    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-    glDebugMessageCallback(OpenGLErrCallback, nullptr);
-    glDebugMessageControl(
-        GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, true
-        );
-    printf("Enabled debug logging successfully\n");
+    if(screen->gl_debug)
+    {
+        printf("Enabling OpenGL Debug Logging...\n");
+        
+        // Enable the debug callback
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageCallback(OpenGLErrCallback, nullptr);
+        glDebugMessageControl(
+            GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, true
+            );
+        printf("Enabled debug logging successfully\n");
+    }
     
-    glfwSwapInterval(0);
+    // Presentation runs on its own thread so waiting for vsync no longer holds
+    // up emulation
+    glfwSwapInterval(1);
 }
 
 void CreateBackbuffer(Screen* screen)
@@ -206,8 +152,9 @@ void CreateBackbuffer(Screen* screen)
     // Bind at this point, we only have one texture so just leave it alone
     glBindTexture(GL_TEXTURE_2D, screen->back_buffer);
     
-    // Create an empty texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, screen->width, screen->height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    // Create an empty texture, each texel holds 8 pixels which the fragment
+    // shader unpacks
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, SCREEN_PITCH, screen->height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
     
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -251,14 +198,173 @@ void CreateScreenQuad(Screen* screen)
     glBindVertexArray(0);
 }
 
-void UpdateScreen(Chip8* chip8, Screen* screen)
+void CreatePixelBuffers(Screen* screen)
+{
+    // Each slot in the ring is big enough to hold every layer of the mosaic
+    screen->pixel_buffer_size = PACKED_SCREEN_SIZE * (screen->mosaic_layers ? screen->mosaic_layers : 1);
+    
+    // Prefer persistently mapped buffers, fall back to orphaning otherwise
+    screen->persistent_pixel_buffers = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+    
+    printf("Streaming framebuffer through %s pixel buffers\n",
+           screen->persistent_pixel_buffers ? "persistent" : "orphaned");
+    
+    glGenBuffers(PIXEL_BUFFER_COUNT, screen->pixel_buffers);
+    
+    for(int i = 0; i < PIXEL_BUFFER_COUNT; ++i)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, screen->pixel_buffers[i]);
+        
+        if(screen->persistent_pixel_buffers)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, screen->pixel_buffer_size, NULL, flags);
+            screen->pixel_buffer_mappings[i] = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, screen->pixel_buffer_size, flags);
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, screen->pixel_buffer_size, NULL, GL_STREAM_DRAW);
+            screen->pixel_buffer_mappings[i] = nullptr;
+        }
+        
+        screen->pixel_buffer_fences[i] = 0;
+    }
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+uint8_t* MapPixelBuffer(Screen* screen)
+{
+    uint32_t slot = screen->pixel_buffer_index;
+    
+    // The GPU may still be reading this slot, rather than wait on it the
+    // caller holds on to its frames and tries again on the next pass
+    if(screen->pixel_buffer_fences[slot])
+    {
+        if(glClientWaitSync(screen->pixel_buffer_fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            return nullptr;
+        }
+        
+        glDeleteSync(screen->pixel_buffer_fences[slot]);
+        screen->pixel_buffer_fences[slot] = 0;
+    }
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, screen->pixel_buffers[slot]);
+    
+    if(screen->persistent_pixel_buffers)
+    {
+        return screen->pixel_buffer_mappings[slot];
+    }
+    
+    // Orphan the old storage so the driver can hand us a fresh block
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, screen->pixel_buffer_size, NULL, GL_STREAM_DRAW);
+    return (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, screen->pixel_buffer_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void UnmapPixelBuffer(Screen* screen)
+{
+    // Persistent mappings stay mapped, the buffer is left bound for the uploads
+    if(!screen->persistent_pixel_buffers)
+    {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+}
+
+void ReleasePixelBuffer(Screen* screen)
 {
+    uint32_t slot = screen->pixel_buffer_index;
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    if(screen->persistent_pixel_buffers)
+    {
+        screen->pixel_buffer_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    
+    screen->pixel_buffer_index = (slot + 1) % PIXEL_BUFFER_COUNT;
+}
+
+bool UpdateScreen(const uint8_t* gfx, Screen* screen)
+{
+    uint8_t* pixels = MapPixelBuffer(screen);
+    if(!pixels)
+    {
+        return false;
+    }
+    
+    // Copy the packed screen into the pixel buffer
+    memcpy(pixels, gfx, PACKED_SCREEN_SIZE);
+    UnmapPixelBuffer(screen);
+    
+    // Kick off the copy from the pixel buffer to the texture, the backbuffer
+    // is the only texture we use so it can stay bound
     glBindTexture(GL_TEXTURE_2D, screen->back_buffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SCREEN_PITCH, screen->height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, (void*)0);
+    
+    ReleasePixelBuffer(screen);
+    
+    return true;
+}
+
+void CreateMosaic(Screen* screen, uint32_t layers)
+{
+    int32_t max_layers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    
+    if(layers > (uint32_t)max_layers)
+    {
+        printf("Mosaic limited to %d instances\n", max_layers);
+        layers = max_layers;
+    }
+    
+    // Lay the instances out in a roughly square grid
+    screen->mosaic_layers = layers;
+    screen->mosaic_columns = (uint32_t)ceil(sqrt((double)layers));
+    screen->mosaic_rows = (layers + screen->mosaic_columns - 1) / screen->mosaic_columns;
+    
+    glGenTextures(1, &screen->mosaic_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, screen->mosaic_texture);
+    
+    // One packed screen per layer
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, SCREEN_PITCH, screen->height, layers, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+}
+
+bool UpdateMosaic(const uint8_t* const* layers, Screen* screen)
+{
+    uint8_t* pixels = MapPixelBuffer(screen);
+    if(!pixels)
+    {
+        return false;
+    }
     
-    // Copy the screen bytes from the chip to the texture
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screen->width, screen->height, GL_RED, GL_UNSIGNED_BYTE, chip8->gfx);
+    // Only layers with a new frame are copied and uploaded
+    for(uint32_t layer = 0; layer < screen->mosaic_layers; ++layer)
+    {
+        if(layers[layer])
+        {
+            memcpy(pixels + (layer * PACKED_SCREEN_SIZE), layers[layer], PACKED_SCREEN_SIZE);
+        }
+    }
+    
+    UnmapPixelBuffer(screen);
     
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, screen->mosaic_texture);
+    
+    for(uint32_t layer = 0; layer < screen->mosaic_layers; ++layer)
+    {
+        if(layers[layer])
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, SCREEN_PITCH, screen->height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, (void*)(uintptr_t)(layer * PACKED_SCREEN_SIZE));
+        }
+    }
+    
+    ReleasePixelBuffer(screen);
+    
+    return true;
 }
 
 void DrawScreen(Screen* screen)
@@ -267,32 +373,201 @@ void DrawScreen(Screen* screen)
     glClearColor(0.0f, 1.0f, 1.0f, 0.0f);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     
-    // Bind shader
-    glUseProgram(screen->shader_program);
-    
-    // Bind textures
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(screen->vertex_array_id);
-    glBindTexture(GL_TEXTURE_2D, screen->back_buffer);
     
-    // Draw the FSQ
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if(screen->mosaic_layers)
+    {
+        // Draw every instance in one go, the cost doesn't change with the
+        // number of instances
+        glUseProgram(screen->mosaic_program);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, screen->mosaic_texture);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, screen->mosaic_layers);
+    }
+    else
+    {
+        // Bind shader
+        glUseProgram(screen->shader_program);
+        
+        // Bind textures
+        glBindTexture(GL_TEXTURE_2D, screen->back_buffer);
+        
+        // Draw the FSQ
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
     
-    // Swap buffers
-    glfwSwapBuffers(screen->window);
+    // Swap buffers, with vsync on this is where the render thread waits
+    {
+        C8_TRACE_SCOPE("Present");
+        glfwSwapBuffers(screen->window);
+    }
     
     glfwPollEvents();
 }
 
+uint32_t CompileShader(GLenum type, const char* source)
+{
+    uint32_t shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    
+    return shader;
+}
+
+// Linked programs are cached on disk, the key identifies the driver and the
+// shader sources so a driver update or a shader change misses the cache
+std::string ProgramCacheKey(const char* vertex_source, const char* fragment_source)
+{
+    // FNV-1a over both sources
+    uint64_t hash = 14695981039346656037ULL;
+    for(const char* source : { vertex_source, fragment_source })
+    {
+        for(const char* c = source; *c; ++c)
+        {
+            hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+        }
+    }
+    
+    char hash_string[17];
+    snprintf(hash_string, sizeof(hash_string), "%016llx", (unsigned long long)hash);
+    
+    std::string key;
+    key += (const char*)glGetString(GL_VENDOR);
+    key += "\n";
+    key += (const char*)glGetString(GL_RENDERER);
+    key += "\n";
+    key += (const char*)glGetString(GL_VERSION);
+    key += "\n";
+    key += hash_string;
+    
+    return key;
+}
+
+bool LoadCachedProgram(uint32_t program, const std::string& file_name, const std::string& key)
+{
+    FILE* f = fopen(file_name.c_str(), "rb");
+    if(!f)
+    {
+        return false;
+    }
+    
+    // Layout: key length, key, binary format, binary length, binary
+    bool loaded = false;
+    uint32_t key_length = 0;
+    if(fread(&key_length, sizeof(key_length), 1, f) == 1 && key_length == key.size())
+    {
+        std::string file_key(key_length, '\0');
+        uint32_t format = 0;
+        uint32_t length = 0;
+        
+        if(fread(&file_key[0], 1, key_length, f) == key_length && file_key == key &&
+           fread(&format, sizeof(format), 1, f) == 1 &&
+           fread(&length, sizeof(length), 1, f) == 1)
+        {
+            std::vector<uint8_t> binary(length);
+            if(fread(binary.data(), 1, length, f) == length)
+            {
+                glProgramBinary(program, format, binary.data(), length);
+                
+                // The driver may still reject the binary
+                int32_t status = GL_FALSE;
+                glGetProgramiv(program, GL_LINK_STATUS, &status);
+                loaded = (status == GL_TRUE);
+            }
+        }
+    }
+    
+    fclose(f);
+    
+    return loaded;
+}
+
+void SaveCachedProgram(uint32_t program, const std::string& file_name, const std::string& key)
+{
+    int32_t length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+    {
+        return;
+    }
+    
+    std::vector<uint8_t> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+    
+    FILE* f = fopen(file_name.c_str(), "wb");
+    if(!f)
+    {
+        return;
+    }
+    
+    uint32_t key_length = key.size();
+    uint32_t binary_format = format;
+    uint32_t binary_length = length;
+    fwrite(&key_length, sizeof(key_length), 1, f);
+    fwrite(key.data(), 1, key_length, f);
+    fwrite(&binary_format, sizeof(binary_format), 1, f);
+    fwrite(&binary_length, sizeof(binary_length), 1, f);
+    fwrite(binary.data(), 1, binary_length, f);
+    
+    fclose(f);
+}
+
+uint32_t BuildProgram(const char* name, const char* vertex_source, const char* fragment_source)
+{
+    uint32_t program = glCreateProgram();
+    
+    // Try the on disk cache before compiling from source
+    bool use_cache = GLEW_ARB_get_program_binary || GLEW_VERSION_4_1;
+    std::string cache_file = std::string("./") + name + ".shadercache";
+    std::string key;
+    
+    if(use_cache)
+    {
+        key = ProgramCacheKey(vertex_source, fragment_source);
+        
+        if(LoadCachedProgram(program, cache_file, key))
+        {
+            return program;
+        }
+    }
+    
+    uint32_t vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_source);
+    uint32_t fragment_shader = CompileShader(GL_FRAGMENT_SHADER, fragment_source);
+    
+    glAttachShader(program, fragment_shader);
+    glAttachShader(program, vertex_shader);
+    
+    if(use_cache)
+    {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    
+    glLinkProgram(program);
+    
+    // The program keeps what it needs once linked
+    glDetachShader(program, fragment_shader);
+    glDetachShader(program, vertex_shader);
+    glDeleteShader(fragment_shader);
+    glDeleteShader(vertex_shader);
+    
+    if(use_cache)
+    {
+        SaveCachedProgram(program, cache_file, key);
+    }
+    
+    return program;
+}
+
 void CreateShader(Screen* screen)
 {
     const char* vertex_shader =
         "#version 400\n"
         "layout(location = 0) in vec3 vp;"
         "layout(location = 1) in vec2 uv;"
-    
+        
         "out vec2 UV;"
-    
+        
         "void main() {"
         "  gl_Position = vec4(vp, 1.0);"
         "  UV = vec2(uv.r, 1-uv.g);"
@@ -301,74 +576,729 @@ void CreateShader(Screen* screen)
     const char* fragment_shader =
         "#version 400\n"
         "in vec2 UV;\n"
-        "uniform sampler2D myTextureSampler;\n"
+        "uniform usampler2D myTextureSampler;\n"
+        "uniform vec3 palette[2];\n"
         "out vec3 frag_colour;\n"
         "void main() {\n"
-        "  float p = texture( myTextureSampler, UV ).r;\n"
-        "  frag_colour = vec3(p, p, p);\n"
+        "  ivec2 size = textureSize( myTextureSampler, 0 ) * ivec2(8, 1);\n"
+        "  ivec2 pixel = min(ivec2(UV * vec2(size)), size - 1);\n"
+        "  uint row = texelFetch( myTextureSampler, ivec2(pixel.x >> 3, pixel.y), 0 ).r;\n"
+        "  uint p = (row >> uint(7 - (pixel.x & 7))) & 1u;\n"
+        "  frag_colour = palette[p];\n"
+        "}\n";
+    
+    screen->shader_program = BuildProgram("screen", vertex_shader, fragment_shader);
+    
+    // Upload the palette
+    glUseProgram(screen->shader_program);
+    screen->palette_uniform = glGetUniformLocation(screen->shader_program, "palette");
+    glUniform3fv(screen->palette_uniform, 2, &screen->palette[0][0]);
+    
+    glUseProgram(0);
+}
+
+void CreateMosaicShader(Screen* screen)
+{
+    // Same screen quad as the single view, each instance is scaled into its
+    // own cell of the grid and samples its own layer
+    const char* vertex_shader =
+        "#version 400\n"
+        "layout(location = 0) in vec3 vp;\n"
+        "layout(location = 1) in vec2 uv;\n"
+        "uniform ivec2 grid;\n"
+        "out vec2 UV;\n"
+        "flat out int layer;\n"
+        "void main() {\n"
+        "  ivec2 cell = ivec2(gl_InstanceID % grid.x, grid.y - 1 - (gl_InstanceID / grid.x));\n"
+        "  vec2 scale = 1.0 / vec2(grid);\n"
+        "  vec2 origin = (vec2(cell) * scale * 2.0) - 1.0;\n"
+        "  gl_Position = vec4(origin + ((vp.xy * 0.95) + 1.0) * scale, 0.0, 1.0);\n"
+        "  UV = vec2(uv.r, 1-uv.g);\n"
+        "  layer = gl_InstanceID;\n"
         "}\n";
     
-    screen->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(screen->vertex_shader, 1, &vertex_shader, NULL);
-    glCompileShader(screen->vertex_shader);
+    const char* fragment_shader =
+        "#version 400\n"
+        "in vec2 UV;\n"
+        "flat in int layer;\n"
+        "uniform usampler2DArray screens;\n"
+        "uniform vec3 palette[2];\n"
+        "out vec3 frag_colour;\n"
+        "void main() {\n"
+        "  ivec2 size = textureSize( screens, 0 ).xy * ivec2(8, 1);\n"
+        "  ivec2 pixel = min(ivec2(UV * vec2(size)), size - 1);\n"
+        "  uint row = texelFetch( screens, ivec3(pixel.x >> 3, pixel.y, layer), 0 ).r;\n"
+        "  uint p = (row >> uint(7 - (pixel.x & 7))) & 1u;\n"
+        "  frag_colour = palette[p];\n"
+        "}\n";
     
-    screen->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(screen->fragment_shader, 1, &fragment_shader, NULL);
-    glCompileShader(screen->fragment_shader);
+    screen->mosaic_program = BuildProgram("mosaic", vertex_shader, fragment_shader);
     
-    screen->shader_program = glCreateProgram();
-    glAttachShader(screen->shader_program, screen->fragment_shader);
-    glAttachShader(screen->shader_program, screen->vertex_shader);
-    glLinkProgram(screen->shader_program);
+    glUseProgram(screen->mosaic_program);
+    glUniform2i(glGetUniformLocation(screen->mosaic_program, "grid"), screen->mosaic_columns, screen->mosaic_rows);
+    glUniform3fv(glGetUniformLocation(screen->mosaic_program, "palette"), 2, &screen->palette[0][0]);
     
     glUseProgram(0);
 }
 
-#include <unistd.h>
-int main()
+// Frame time statistics for the main loop
+struct FrameTimes
+{
+    Clock_Time last_frame;
+    Clock_Time last_report;
+    
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t total_ns;
+    uint32_t frames;
+};
+
+void ResetFrameTimes(FrameTimes* times, Clock_Time now)
+{
+    times->last_report = now;
+    times->min_ns = INT64_MAX;
+    times->max_ns = 0;
+    times->total_ns = 0;
+    times->frames = 0;
+}
+
+void RecordFrameTime(FrameTimes* times)
+{
+    Clock_Time now = Clock::now();
+    int64_t frame_ns = PerfNano_Counter(now - times->last_frame).count();
+    times->last_frame = now;
+    
+    if(frame_ns < times->min_ns)
+        times->min_ns = frame_ns;
+    
+    if(frame_ns > times->max_ns)
+        times->max_ns = frame_ns;
+    
+    times->total_ns += frame_ns;
+    ++times->frames;
+    
+    // Report roughly every 5 seconds
+    if(PerfNano_Counter(now - times->last_report).count() > 5000000000LL)
+    {
+        printf("Frame time over %u frames: avg %.1fus min %.1fus max %.1fus\n",
+               times->frames,
+               (times->total_ns / (double)times->frames) / 1000.0,
+               times->min_ns / 1000.0,
+               times->max_ns / 1000.0);
+        
+        ResetFrameTimes(times, now);
+    }
+}
+
+// Time from a key event arriving to the first present showing a frame from
+// after the program read it, bucket n holds latencies under 2^n us
+#define LATENCY_BUCKETS 21
+
+struct InputLatency
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t samples;
+    int64_t total_ns;
+    int64_t max_ns;
+    
+    // Every sample is also written here in microseconds when set
+    FILE* file;
+};
+
+void RecordInputLatency(InputLatency* latency, int64_t latency_ns)
+{
+    uint32_t bucket = 0;
+    for(int64_t us = latency_ns / 1000; us > 0 && bucket < (LATENCY_BUCKETS - 1); us >>= 1)
+    {
+        ++bucket;
+    }
+    
+    ++latency->buckets[bucket];
+    ++latency->samples;
+    latency->total_ns += latency_ns;
+    
+    if(latency_ns > latency->max_ns)
+        latency->max_ns = latency_ns;
+    
+    if(latency->file)
+    {
+        fprintf(latency->file, "%.1f\n", latency_ns / 1000.0);
+    }
+}
+
+void PrintInputLatency(const InputLatency* latency)
+{
+    if(latency->samples == 0)
+    {
+        printf("No input latency samples\n");
+        return;
+    }
+    
+    printf("Input to present latency over %llu inputs: avg %.2fms max %.2fms\n",
+           (unsigned long long)latency->samples,
+           (latency->total_ns / (double)latency->samples) / 1000000.0,
+           latency->max_ns / 1000000.0);
+    
+    for(uint32_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+    {
+        if(latency->buckets[bucket] == 0)
+            continue;
+        
+        if(bucket == LATENCY_BUCKETS - 1)
+            printf("    >=%uus: ", 1u << (bucket - 1));
+        else
+            printf("    <%uus: ", 1u << bucket);
+        
+        printf("%llu (%.1f%%)\n", (unsigned long long)latency->buckets[bucket],
+               (latency->buckets[bucket] * 100.0) / latency->samples);
+    }
+}
+
+// Counters and timings exported with --metrics
+struct FrontendMetrics
+{
+    C8MetricsRegistry registry;
+    C8Counter instructions;
+    C8Counter instructions_skipped;
+    C8Counter frames_emulated;
+    C8Counter frames_published;
+    C8Counter frames_dropped;
+    C8Counter frames_presented;
+    C8Counter faults;
+    C8Histogram emulate_time;
+    C8Histogram draw_time;
+    C8Histogram sleep_time;
+};
+
+void RegisterFrontendMetrics(FrontendMetrics* metrics)
+{
+    C8MetricsRegistry* registry = &metrics->registry;
+    C8RegisterCounter(registry, &metrics->instructions, "chip8_instructions_total", "Instructions emulated, including skipped ones");
+    C8RegisterCounter(registry, &metrics->instructions_skipped, "chip8_instructions_skipped_total", "Instructions skipped in idle loops");
+    C8RegisterCounter(registry, &metrics->frames_emulated, "chip8_frames_emulated_total", "Frames emulated, across every instance");
+    C8RegisterCounter(registry, &metrics->frames_published, "chip8_frames_published_total", "Frames handed to the render thread");
+    C8RegisterCounter(registry, &metrics->frames_dropped, "chip8_frames_dropped_total", "Frames replaced before the render thread took them");
+    C8RegisterCounter(registry, &metrics->frames_presented, "chip8_frames_presented_total", "Frames presented");
+    C8RegisterCounter(registry, &metrics->faults, "chip8_faults_total", "Instances halted by a fault");
+    C8RegisterHistogram(registry, &metrics->emulate_time, "chip8_emulate_seconds", "Time to emulate a frame of every instance");
+    C8RegisterHistogram(registry, &metrics->draw_time, "chip8_draw_seconds", "Time to draw and present a frame");
+    C8RegisterHistogram(registry, &metrics->sleep_time, "chip8_sleep_seconds", "Time the emulation thread spent waiting between frames");
+}
+
+// State shared between the render thread and the emulation thread
+struct Emulator
+{
+    // One chip per instance, only the mosaic view runs more than one
+    uint32_t instance_count;
+    Chip8* instances;
+    
+    // One image per ROM, instances running the same ROM share its pages
+    C8Image* images;
+    C8PagePool pool;
+    
+    // Completed frames going to the render thread, one per instance
+    TripleBuffer* frames;
+    
+    // Key events going to the emulation thread
+    InputQueue input;
+    
+    // Paces the emulation thread to 60Hz and the target instruction rate
+    C8Pacer pacer;
+    
+    FrontendMetrics metrics;
+    
+    // Instance 0 runs under the debugger, which reads commands from stdin on
+    // the emulation thread while it is stopped
+    bool debugging;
+    C8Debugger debugger;
+    
+    // The emulation thread parks here while every instance is waiting on a key
+    // with its timers stopped, key events and shutdown wake it
+    std::mutex wait_mutex;
+    std::condition_variable wait_condition;
+    
+    std::atomic<bool> running;
+    
+    Screen* screen;
+};
+
+void WakeEmulationThread(Emulator* emulator)
+{
+    // Taking the lock orders this with the emulation thread checking for
+    // input before it waits, it is only ever held for a moment
+    {
+        std::lock_guard<std::mutex> lock(emulator->wait_mutex);
+    }
+    
+    emulator->wait_condition.notify_one();
+}
+
+// Set by F12 or SIGUSR1, the render thread starts or stops tracing
+static std::atomic<bool> trace_toggle_requested(false);
+
+void TraceSignalHandler(int /*signal*/)
+{
+    trace_toggle_requested.store(true, std::memory_order_relaxed);
+}
+
+void KeyCallback(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/)
+{
+    if(action == GLFW_REPEAT)
+    {
+        return;
+    }
+    
+    if(key == GLFW_KEY_F12)
+    {
+        if(action == GLFW_PRESS)
+        {
+            trace_toggle_requested.store(true, std::memory_order_relaxed);
+        }
+        return;
+    }
+    
+    Emulator* emulator = (Emulator*)glfwGetWindowUserPointer(window);
+    C8QueueKey(&emulator->input, key, action == GLFW_PRESS);
+    WakeEmulationThread(emulator);
+}
+
+void RefreshCallback(GLFWwindow* window)
+{
+    Emulator* emulator = (Emulator*)glfwGetWindowUserPointer(window);
+    emulator->screen->redraw = true;
+}
+
+void EmulationThread(Emulator* emulator)
+{
+    FrontendMetrics* metrics = &emulator->metrics;
+    
+    C8TraceThread("Emulation");
+    C8ResetPacer(&emulator->pacer);
+    
+    // Arrival time of input the program has read that no published frame has
+    // shown yet
+    int64_t input_ns = 0;
+    
+    while(emulator->running.load(std::memory_order_relaxed))
+    {
+        // Get keys, every instance sees the same keypad
+        C8ProcessInput(&emulator->instances[0], &emulator->input);
+        
+        // Rates that don't divide by 60 get an extra instruction some frames
+        uint32_t cycles = C8PacerFrameCycles(&emulator->pacer);
+        
+        bool published = false;
+        bool blocked = true;
+        
+        // Totalled over the instances so the counters take one update a frame
+        uint64_t instructions = 0;
+        uint64_t instructions_skipped = 0;
+        uint32_t frames_published = 0;
+        uint32_t frames_dropped = 0;
+        
+        Clock_Time emulate_start = Clock::now();
+        
+        for(uint32_t i = 0; i < emulator->instance_count; ++i)
+        {
+            Chip8* chip8 = &emulator->instances[i];
+            
+            if(i != 0)
+            {
+                chip8->keys = emulator->instances[0].keys;
+            }
+            
+            // Emulate a frame worth of instructions and tick the timers, a
+            // faulted instance is reported once and then stays halted
+            bool faulted = chip8->fault != C8_FAULT_NONE;
+            uint64_t chip_cycles = chip8->cycles;
+            uint64_t chip_skipped = chip8->cycles_skipped;
+            
+            if(i == 0 && emulator->debugging)
+            {
+                while(!C8DebugFrame(chip8, &emulator->debugger, cycles))
+                {
+                    if(!C8DebugRepl(chip8, &emulator->debugger))
+                    {
+                        glfwSetWindowShouldClose(emulator->screen->window, GLFW_TRUE);
+                        emulator->debugging = false;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                C8_TRACE_SCOPE("C8EmulateFrame");
+                C8EmulateFrame(chip8, cycles);
+            }
+            
+            instructions += chip8->cycles - chip_cycles;
+            instructions_skipped += chip8->cycles_skipped - chip_skipped;
+            
+            if(!faulted && chip8->fault != C8_FAULT_NONE)
+            {
+                printf("Instance %u halted\n", i);
+                C8ReportFault(chip8);
+                C8AddCounter(&metrics->faults, 1);
+            }
+            
+            int64_t observed_ns = C8ObserveInput(chip8, &emulator->input);
+            if(observed_ns && (input_ns == 0 || observed_ns < input_ns))
+            {
+                input_ns = observed_ns;
+            }
+            
+            if(chip8->draw_flag)
+            {
+                // Hand the completed frame over to the render thread, the
+                // first one drawn after the input was read is tagged with it
+                if(input_ns)
+                {
+                    TBSetInputTime(&emulator->frames[i], input_ns);
+                    input_ns = 0;
+                }
+                
+                memcpy(TBBackBuffer(&emulator->frames[i]), chip8->gfx, PACKED_SCREEN_SIZE);
+                frames_dropped += TBPublish(&emulator->frames[i]);
+                ++frames_published;
+                chip8->draw_flag = false;
+                published = true;
+            }
+            
+            // Nothing changes for this instance until a key arrives
+            blocked &= (chip8->fault != C8_FAULT_NONE) ||
+                       (chip8->idle == C8_IDLE_KEY &&
+                        chip8->delay_timer == 0 &&
+                        chip8->sound_timer == 0);
+        }
+        
+        Clock_Time emulate_end = Clock::now();
+        C8ObserveDuration(&metrics->emulate_time, PerfNano_Counter(emulate_end - emulate_start).count());
+        C8TraceSpan("Emulate", emulate_start, emulate_end);
+        C8AddCounter(&metrics->instructions, instructions);
+        C8AddCounter(&metrics->instructions_skipped, instructions_skipped);
+        C8AddCounter(&metrics->frames_emulated, emulator->instance_count);
+        C8AddCounter(&metrics->frames_published, frames_published);
+        C8AddCounter(&metrics->frames_dropped, frames_dropped);
+        
+        // Wake the render thread if it is waiting for something to show
+        if(published)
+        {
+            glfwPostEmptyEvent();
+        }
+        
+        if(blocked)
+        {
+            // Sleep until there is a key event to process
+            std::unique_lock<std::mutex> lock(emulator->wait_mutex);
+            emulator->wait_condition.wait(lock, [emulator] {
+                return !emulator->running.load(std::memory_order_relaxed) || C8InputPending(&emulator->input);
+            });
+            
+            C8ResetPacer(&emulator->pacer);
+        }
+        else
+        {
+            // Sleep until the next frame is due
+            C8PacerWait(&emulator->pacer);
+        }
+        
+        Clock_Time sleep_end = Clock::now();
+        C8ObserveDuration(&metrics->sleep_time, PerfNano_Counter(sleep_end - emulate_end).count());
+        C8TraceSpan("Sleep", emulate_end, sleep_end);
+    }
+}
+
+int main(int argc, char** argv)
 {
-    // Do tests
-    TestAll();
+    // Time to first frame is measured from here
+    Clock_Time launch_time = Clock::now();
+    
+    // Command line, any number of ROMs which the mosaic instances cycle through
+    const char* default_rom = "./games/LANDER";
+    const char** roms = &default_rom;
+    uint32_t rom_count = 1;
+    uint32_t mosaic = 0;
+    uint64_t instructions_per_second = DEFAULT_CYCLES_PER_FRAME * 60;
+    bool gl_debug = false;
+    const char* latency_path = nullptr;
+    const char* metrics_path = nullptr;
+    const char* trace_path = "chip8_trace.json";
+    bool debug = false;
+    
+    std::vector<const char*> rom_args;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--mosaic") == 0 && (arg + 1) < argc)
+        {
+            mosaic = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--cycles-per-frame") == 0 && (arg + 1) < argc)
+        {
+            instructions_per_second = atoi(argv[++arg]) * 60ULL;
+        }
+        else if(strcmp(argv[arg], "--ips") == 0 && (arg + 1) < argc)
+        {
+            instructions_per_second = strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(strcmp(argv[arg], "--debug") == 0)
+        {
+            debug = true;
+        }
+        else if(strcmp(argv[arg], "--trace") == 0 && (arg + 1) < argc)
+        {
+            trace_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--metrics") == 0 && (arg + 1) < argc)
+        {
+            metrics_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--latency-file") == 0 && (arg + 1) < argc)
+        {
+            latency_path = argv[++arg];
+        }
+        else if(strcmp(argv[arg], "--gl-debug") == 0)
+        {
+            gl_debug = true;
+        }
+        else
+        {
+            rom_args.push_back(argv[arg]);
+        }
+    }
     
-    // The Chip8 Chip
-    Chip8 chip8 = {};
-    C8Initialise(&chip8);
-    LoadROM(&chip8, "./games/LANDER");
+    if(!rom_args.empty())
+    {
+        roms = rom_args.data();
+        rom_count = rom_args.size();
+    }
     
     Screen screen;
     screen.window_title = "Test";
     screen.window_width = 640;
     screen.window_height = 480;
+    screen.gl_debug = gl_debug;
     CreateWindow(&screen);
     CreateBackbuffer(&screen);
+    
+    if(mosaic)
+    {
+        CreateMosaic(&screen, mosaic);
+    }
+    
+    CreatePixelBuffers(&screen);
     CreateScreenQuad(&screen);
     CreateShader(&screen);
     
-    chip8.screen = &screen;
-    chip8.start_time = Clock::now();
-    C8SetupInput(&chip8);
+    if(mosaic)
+    {
+        CreateMosaicShader(&screen);
+    }
+    
+    // The Chip8 Chips, emulated on their own thread
+    static Emulator emulator;
+    emulator.instance_count = mosaic ? screen.mosaic_layers : 1;
+    C8InitialisePacer(&emulator.pacer, instructions_per_second, 60);
+    RegisterFrontendMetrics(&emulator.metrics);
+    emulator.debugging = debug;
+    C8InitialiseDebugger(&emulator.debugger);
+    emulator.images = new C8Image[rom_count];
+    for(uint32_t i = 0; i < rom_count; ++i)
+    {
+        C8InitialiseImage(&emulator.images[i]);
+        LoadROM(&emulator.images[i], roms[i]);
+    }
+    
+    emulator.instances = C8CreateInstances(emulator.instance_count, &emulator.images[0], &emulator.pool);
+    emulator.frames = new TripleBuffer[emulator.instance_count];
     
-    for(;;)
+    for(uint32_t i = 0; i < emulator.instance_count; ++i)
     {
-        // Get keys
-        C8GetInput(&chip8);
+        C8Initialise(&emulator.instances[i], &emulator.images[i % rom_count], &emulator.pool);
+        TBInitialise(&emulator.frames[i]);
+    }
+    
+    C8SetupInput(&emulator.input);
+    
+    emulator.screen = &screen;
+    glfwSetWindowUserPointer(screen.window, &emulator);
+    glfwSetKeyCallback(screen.window, KeyCallback);
+    glfwSetWindowRefreshCallback(screen.window, RefreshCallback);
+    
+    emulator.running = true;
+    std::thread emulation_thread(EmulationThread, &emulator);
+    
+    FrameTimes frame_times;
+    frame_times.last_frame = Clock::now();
+    ResetFrameTimes(&frame_times, frame_times.last_frame);
+    
+    // Frames waiting to be uploaded, held on to when an upload is deferred
+    std::vector<const uint8_t*> pending_frames(emulator.instance_count, nullptr);
+    
+    // Oldest input time among the pending frames
+    int64_t pending_input_ns = 0;
+    
+    static InputLatency input_latency;
+    if(latency_path)
+    {
+        input_latency.file = fopen(latency_path, "w");
+        if(!input_latency.file)
+        {
+            printf("Failed to open %s\n", latency_path);
+        }
+    }
+    
+    bool first_frame = true;
+    
+    Clock_Time next_metrics_dump = Clock::now();
+    
+    C8TraceThread("Render");
+    signal(SIGUSR1, TraceSignalHandler);
+    
+    while(!glfwWindowShouldClose(screen.window))
+    {
+        if(trace_toggle_requested.exchange(false, std::memory_order_relaxed))
+        {
+            bool tracing = !c8_tracer.enabled.load(std::memory_order_relaxed);
+            C8EnableTrace(tracing);
+            
+            if(tracing)
+            {
+                printf("Tracing, F12 or SIGUSR1 again to write %s\n", trace_path);
+            }
+            else if(C8WriteTrace(trace_path))
+            {
+                printf("Trace written to %s\n", trace_path);
+            }
+            else
+            {
+                printf("Failed to write trace to %s\n", trace_path);
+            }
+        }
         
-        // Emulate CPU
-        C8EmulateCycle(&chip8);
+        // The render thread wakes at least every frame, dump about once a
+        // second from here
+        if(metrics_path && Clock::now() >= next_metrics_dump)
+        {
+            if(!C8DumpMetrics(&emulator.metrics.registry, metrics_path, nullptr, nullptr))
+            {
+                printf("Failed to write metrics to %s\n", metrics_path);
+                metrics_path = nullptr;
+            }
+            
+            next_metrics_dump = Clock::now() + std::chrono::seconds(1);
+        }
+        
+        // Pick up the newest completed frames
+        bool pending = false;
+        for(uint32_t i = 0; i < emulator.instance_count; ++i)
+        {
+            const uint8_t* frame = TBAcquire(&emulator.frames[i]);
+            if(frame)
+            {
+                pending_frames[i] = frame;
+                
+                int64_t frame_input_ns = TBInputTime(&emulator.frames[i]);
+                if(frame_input_ns && (pending_input_ns == 0 || frame_input_ns < pending_input_ns))
+                {
+                    pending_input_ns = frame_input_ns;
+                }
+            }
+            
+            pending |= (pending_frames[i] != nullptr);
+        }
         
-        // Decrement counters
-        C8DecrementCounters(&chip8);
+        if(!pending && !screen.redraw)
+        {
+            // Nothing new to show, sleep until there is an input event, the
+            // emulation thread publishes a frame or the next frame is due
+            C8_TRACE_SCOPE("Wait");
+            glfwWaitEventsTimeout(1.0 / 60.0);
+            continue;
+        }
         
-        if(chip8.draw_flag)
+        // Update texture and blit to screen
+        int64_t shown_input_ns = 0;
+        if(pending)
         {
-            // Update texture and blit to screen
-            UpdateScreen(&chip8, &screen);
-            chip8.draw_flag = false;
+            C8_TRACE_SCOPE("Upload");
+            bool uploaded = screen.mosaic_layers ?
+                UpdateMosaic(pending_frames.data(), &screen) :
+                UpdateScreen(pending_frames[0], &screen);
+            
+            if(uploaded)
+            {
+                std::fill(pending_frames.begin(), pending_frames.end(), nullptr);
+                shown_input_ns = pending_input_ns;
+                pending_input_ns = 0;
+            }
         }
         
+        screen.redraw = false;
+        Clock_Time draw_start = Clock::now();
         DrawScreen(&screen);
+        Clock_Time draw_end = Clock::now();
+        C8ObserveDuration(&emulator.metrics.draw_time, PerfNano_Counter(draw_end - draw_start).count());
+        C8TraceSpan("DrawScreen", draw_start, draw_end);
+        C8AddCounter(&emulator.metrics.frames_presented, 1);
+        RecordFrameTime(&frame_times);
+        
+        // With vsync on the swap returns once the frame is queued for scan
+        // out, as close to the photons as we can see
+        if(shown_input_ns)
+        {
+            int64_t now_ns = PerfNano_Counter(Clock::now().time_since_epoch()).count();
+            RecordInputLatency(&input_latency, now_ns - shown_input_ns);
+        }
         
-        usleep(400);
+        if(first_frame)
+        {
+            printf("First frame presented after %.2fms\n",
+                   PerfNano_Counter(Clock::now() - launch_time).count() / 1000000.0);
+            first_frame = false;
+        }
     }
-}
-
+    
+    emulator.running = false;
+    WakeEmulationThread(&emulator);
+    emulation_thread.join();
+    
+    // Still tracing at exit, keep what was recorded
+    if(c8_tracer.enabled.load(std::memory_order_relaxed))
+    {
+        C8EnableTrace(false);
+        if(C8WriteTrace(trace_path))
+        {
+            printf("Trace written to %s\n", trace_path);
+        }
+    }
+    
+    // Report how much of the run was spent in idle loops
+    uint64_t cycles = 0;
+    uint64_t cycles_skipped = 0;
+    for(uint32_t i = 0; i < emulator.instance_count; ++i)
+    {
+        cycles += emulator.instances[i].cycles;
+        cycles_skipped += emulator.instances[i].cycles_skipped;
+    }
+    
+    printf("Emulated %llu instructions, %llu (%.1f%%) skipped in idle loops\n",
+           (unsigned long long)cycles, (unsigned long long)cycles_skipped,
+           cycles ? (cycles_skipped * 100.0) / cycles : 0.0);
+    
+    C8PrintPacerJitter(&emulator.pacer);
+    PrintInputLatency(&input_latency);
+    
+    if(input_latency.file)
+    {
+        fclose(input_latency.file);
+    }
+    
+    C8DestroyInstances(emulator.instances, emulator.instance_count);
+    C8DestroyPagePool(&emulator.pool);
+    delete[] emulator.images;
+    delete[] emulator.frames;
+    
+    glfwTerminate();
+    
+    return 0;
+}
\ No newline at end of file
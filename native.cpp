@@ -0,0 +1,213 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Chip8.h"
+#include "Chip8Aot.h"
+#include "Chip8Cfg.h"
+
+#include <vector>
+
+// Headless runner for a ROM translated ahead of time, built as Chip8Native
+// with the translation Chip8Aot wrote. Times the translated code against the
+// interpreter and can check that both leave the same state every frame
+
+void PrintUsage()
+{
+    printf("Usage: Chip8Native [--frames N] [--cycles-per-frame N] [--keys] [--compare]\n");
+}
+
+// What is compared after each frame
+struct FrameState
+{
+    uint8_t V[REGISTERCOUNT];
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t fault;
+    uint8_t idle;
+    uint64_t cycles_skipped;
+    uint8_t gfx[SCREEN_PITCH * SCREEN_HEIGHT];
+};
+
+void CaptureState(FrameState* state, const Chip8* chip8)
+{
+    memcpy(state->V, chip8->V, sizeof(state->V));
+    state->I = chip8->I;
+    state->pc = chip8->pc;
+    state->sp = chip8->sp;
+    state->delay_timer = chip8->delay_timer;
+    state->sound_timer = chip8->sound_timer;
+    state->fault = chip8->fault;
+    state->idle = chip8->idle;
+    state->cycles_skipped = chip8->cycles_skipped;
+    memcpy(state->gfx, chip8->gfx, sizeof(state->gfx));
+}
+
+bool SameState(const FrameState* a, const FrameState* b)
+{
+    return memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+        a->I == b->I && a->pc == b->pc && a->sp == b->sp &&
+        a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer && a->fault == b->fault &&
+        a->idle == b->idle && a->cycles_skipped == b->cycles_skipped &&
+        memcmp(a->gfx, b->gfx, sizeof(a->gfx)) == 0;
+}
+
+enum RunMode
+{
+    RUN_CYCLE,
+    RUN_FRAME,
+    RUN_TRANSLATED,
+};
+
+// With --keys every run presses the same keys, a different one held for the
+// last 10 frames of every 60 so key waits finish
+uint16_t ScriptedKeys(uint32_t frame)
+{
+    return (frame % 60) >= 50 ? 1 << ((frame / 60) % MAX_KEYS) : 0;
+}
+
+// Runs a fresh instance for the given frames, returns the host time taken
+int64_t Run(const C8Image* image, C8PagePool* pool, RunMode mode, uint32_t frames, uint32_t cycles_per_frame,
+            bool keys, std::vector<FrameState>* states)
+{
+    // Same random numbers for every run
+    srand(1);
+    
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, image, pool);
+    
+    Clock_Time start = Clock::now();
+    for(uint32_t frame = 0; frame < frames; ++frame)
+    {
+        if(keys)
+        {
+            chip8.keys = ScriptedKeys(frame);
+        }
+        
+        switch(mode)
+        {
+            case RUN_CYCLE:
+            for(uint32_t cycle = 0; cycle < cycles_per_frame; ++cycle)
+            {
+                C8EmulateCycle(&chip8);
+            }
+            C8TickTimers(&chip8);
+            break;
+            
+            case RUN_FRAME:
+            C8EmulateFrame(&chip8, cycles_per_frame);
+            break;
+            
+            case RUN_TRANSLATED:
+            C8AotEmulateFrame(&chip8, cycles_per_frame);
+            break;
+        }
+        
+        if(states)
+        {
+            FrameState state;
+            CaptureState(&state, &chip8);
+            states->push_back(state);
+        }
+    }
+    int64_t elapsed_ns = PerfNano_Counter(Clock::now() - start).count();
+    
+    C8ReleasePages(&chip8);
+    
+    return elapsed_ns;
+}
+
+void DumpState(const char* title, const FrameState* state)
+{
+    printf("%s\n", title);
+    for(uint32_t v = 0; v < REGISTERCOUNT; ++v)
+    {
+        printf("V%X=%02X ", v, state->V[v]);
+    }
+    printf("\nI=%03X pc=%03X sp=%X DT=%02X ST=%02X fault=%u\n", state->I, state->pc, state->sp, state->delay_timer, state->sound_timer, state->fault);
+}
+
+int main(int argc, char** argv)
+{
+    // Ten emulated minutes by default
+    uint32_t frames = 36000;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    bool compare = false;
+    bool keys = false;
+    
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--frames") == 0 && (arg + 1) < argc)
+        {
+            frames = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--cycles-per-frame") == 0 && (arg + 1) < argc)
+        {
+            cycles_per_frame = atoi(argv[++arg]);
+        }
+        else if(strcmp(argv[arg], "--keys") == 0)
+        {
+            keys = true;
+        }
+        else if(strcmp(argv[arg], "--compare") == 0)
+        {
+            compare = true;
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    
+    static C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], c8_aot_rom, c8_aot_rom_size);
+    C8PredecodeROM(&image, c8_aot_rom_size);
+    
+    C8PagePool pool;
+    
+    int64_t cycle_ns = Run(&image, &pool, RUN_CYCLE, frames, cycles_per_frame, keys, nullptr);
+    int64_t frame_ns = Run(&image, &pool, RUN_FRAME, frames, cycles_per_frame, keys, nullptr);
+    int64_t translated_ns = Run(&image, &pool, RUN_TRANSLATED, frames, cycles_per_frame, keys, nullptr);
+    
+    printf("%s: %u frames, C8EmulateCycle %.3fms, C8EmulateFrame %.3fms, translated %.3fms (%.1fx and %.1fx faster)\n",
+           c8_aot_rom_name, frames,
+           cycle_ns / 1000000.0, frame_ns / 1000000.0, translated_ns / 1000000.0,
+           translated_ns ? (double)cycle_ns / translated_ns : 0.0,
+           translated_ns ? (double)frame_ns / translated_ns : 0.0);
+    
+    int result = 0;
+    if(compare)
+    {
+        std::vector<FrameState> expected;
+        std::vector<FrameState> translated;
+        Run(&image, &pool, RUN_FRAME, frames, cycles_per_frame, keys, &expected);
+        Run(&image, &pool, RUN_TRANSLATED, frames, cycles_per_frame, keys, &translated);
+        
+        uint32_t frame = 0;
+        while(frame < frames && SameState(&expected[frame], &translated[frame]))
+        {
+            ++frame;
+        }
+        
+        if(frame < frames)
+        {
+            printf("Frame %u differs\n", frame);
+            DumpState("Interpreter", &expected[frame]);
+            DumpState("Translated", &translated[frame]);
+            result = 1;
+        }
+        else
+        {
+            printf("All %u frames match the interpreter\n", frames);
+        }
+    }
+    
+    C8DestroyPagePool(&pool);
+    
+    return result;
+}
@@ -7,34 +7,73 @@
 #include "Chip8.h"
 #include "Chip8Input.h"
 
-#define OpCodeNotImpl(oc) printf("Opcode 0x%X not implemented\n", oc); exit(0);
+#define OpCodeNotImpl(oc) C8RaiseFault(chip8, C8_FAULT_BAD_OPCODE, oc)
 
 // Define some shortcuts for extracting X and Y from the opcode
 #define REG_X (chip8->opcode & 0x0F00) >> 8
 #define REG_Y (chip8->opcode & 0x00F0) >> 4
 
-void Op_0xxx(Chip8* chip8)
+// Memory at a 12 bit address plus a small offset, the guard page after memory
+// keeps the offset in bounds so the unchecked build needs no branch
+#ifdef C8_CHECKED
+#define READ_MEMORY(addr, offset) C8ReadMemory(chip8, C8CheckedAddress(chip8, (addr), (offset)))
+#define WRITE_MEMORY(addr, offset, value) C8WriteMemory(chip8, C8CheckedAddress(chip8, (addr), (offset)), (value))
+
+static inline uint32_t C8CheckedAddress(Chip8* chip8, uint32_t address, uint32_t offset)
 {
-    // There are a number of 0___ opcodes
-    switch(chip8->opcode)
+    if(address + offset >= MEMSIZE)
     {
-        case 0x00E0:
-        // 0x00E0 - Display Clear
-        memset(chip8->gfx, 0, sizeof(chip8->gfx));
-        break;
-        
-        case 0x00EE:
-        // 0x00EE - return from subroutine
-        chip8->pc = chip8->stack[--chip8->sp];
-        // Flatten the memory
-        chip8->stack[chip8->sp] = 0;
-        break;
-        
-        default:
-        // 0x0NNN
-        //OpCodeNotImpl(chip8->opcode);
-        break;
+        C8RaiseFault(chip8, C8_FAULT_MEMORY, address + offset);
+    }
+    
+    return (address & MEMMASK) + offset;
+}
+#else
+#define READ_MEMORY(addr, offset) C8ReadMemory(chip8, ((addr) & MEMMASK) + (offset))
+#define WRITE_MEMORY(addr, offset, value) C8WriteMemory(chip8, ((addr) & MEMMASK) + (offset), (value))
+#endif
+
+// Key index from VX, the keypad only has 16 keys
+static inline uint8_t C8KeyIndex(Chip8* chip8, uint8_t key)
+{
+#ifdef C8_CHECKED
+    if(key >= MAX_KEYS)
+    {
+        C8RaiseFault(chip8, C8_FAULT_KEY, key);
     }
+#else
+    (void)chip8;
+#endif
+    return key & (MAX_KEYS - 1);
+}
+
+void Op_00E0(Chip8* chip8)
+{
+    // 0x00E0 - Display Clear
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+}
+
+void Op_00EE(Chip8* chip8)
+{
+    // 0x00EE - return from subroutine
+#ifdef C8_CHECKED
+    if(chip8->sp == 0)
+    {
+        C8RaiseFault(chip8, C8_FAULT_STACK_UNDERFLOW, chip8->sp);
+    }
+#endif
+    // sp is only masked on use so a checked build can see it run off
+    // either end of the stack
+    --chip8->sp;
+    chip8->pc = chip8->stack[chip8->sp & (STACKSIZE - 1)];
+    // Flatten the memory
+    chip8->stack[chip8->sp & (STACKSIZE - 1)] = 0;
+}
+
+void Op_0NNN(Chip8* chip8)
+{
+    // 0x0NNN - Calls a machine code routine, ignored
+    (void)chip8;
 }
 
 void Op_1NNN(Chip8* chip8)
@@ -48,7 +87,14 @@ void Op_2NNN(Chip8* chip8)
 {
     // Calls subroutine at NNN.
     // Push next pc onto stack
-    chip8->stack[chip8->sp++] = chip8->pc;
+#ifdef C8_CHECKED
+    if(chip8->sp >= STACKSIZE)
+    {
+        C8RaiseFault(chip8, C8_FAULT_STACK_OVERFLOW, chip8->sp);
+    }
+#endif
+    chip8->stack[chip8->sp & (STACKSIZE - 1)] = chip8->pc;
+    ++chip8->sp;
     
     // Jump to the subroutine location
     chip8->pc = chip8->opcode & 0x0FFF;
@@ -102,104 +148,102 @@ void Op_7XNN(Chip8* chip8)
     chip8->V[REG_X] += (chip8->opcode & 0x00FF);
 }
 
-void Op_8xxx(Chip8* chip8)
+void Op_8XY0(Chip8* chip8)
+{
+    // 0x8XY0 - Sets VX to the value of VY.
+    chip8->V[REG_X] = chip8->V[REG_Y];
+}
+
+void Op_8XY1(Chip8* chip8)
+{
+    // 0x8XY1 - Sets VX to VX | VY. (Bitwise OR operation).
+    chip8->V[REG_X] = (chip8->V[REG_X] | chip8->V[REG_Y]);
+}
+
+void Op_8XY2(Chip8* chip8)
+{
+    // 0x8XY2 - Sets VX to VX and VY. (Bitwise AND operation).
+    chip8->V[REG_X] = (chip8->V[REG_X] & chip8->V[REG_Y]);
+}
+
+void Op_8XY3(Chip8* chip8)
+{
+    // 0x8XY3 - Sets VX to VX xor VY.
+    chip8->V[REG_X] = (chip8->V[REG_X] ^ chip8->V[REG_Y]);
+}
+
+void Op_8XY4(Chip8* chip8)
 {
-    // There are a number of 8___ opcodes
-    switch(chip8->opcode & 0xF00F)
+    // 0x8XY4 - Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
+    if(chip8->V[REG_X] > (0xFF - chip8->V[REG_Y]))
     {
-        case 0x8000:
-        // 0x8XY0 - Sets VX to the value of VY.
-        chip8->V[REG_X] = chip8->V[REG_Y];
-        break;
-        
-        case 0x8001:
-        // 0x8XY1 - Sets VX to VX | VY. (Bitwise OR operation).
-        chip8->V[REG_X] = (chip8->V[REG_X] | chip8->V[REG_Y]);
-        break;
-        
-        case 0x8002:
-        // 0x8XY2 - Sets VX to VX and VY. (Bitwise AND operation).
-        chip8->V[REG_X] = (chip8->V[REG_X] & chip8->V[REG_Y]);
-        break;
-        
-        case 0x8003:
-        // 0x8XY3 - Sets VX to VX xor VY.
-        chip8->V[REG_X] = (chip8->V[REG_X] ^ chip8->V[REG_Y]);
-        break;
-        
-        case 0x8004:
-        // 0x8XY4 - Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
-        if(chip8->V[REG_X] > (0xFF - chip8->V[REG_Y]))
-        {
-            // Set carry flag
-            chip8->V[0xF] = 1;
-        }
-        else
-        {
-            // Unset carry flag
-            chip8->V[0xF] = 0;
-        }
-        chip8->V[REG_X] += chip8->V[REG_Y];
-        break;
-        
-        case 0x8005:
-        // 0x8XY5
-        // VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when
-        // there isn't.
-        if(chip8->V[REG_X] <= chip8->V[REG_Y])
-        {
-            // Underflow - Set borrow flag
-            chip8->V[0xF] = 0;
-        }
-        else
-        {
-            // Unset borrow flag
-            chip8->V[0xF] = 1;
-        }
-        chip8->V[REG_X] -= chip8->V[REG_Y];
-        break;
-        
-        case 0x8006:
-        // 0x8XY6
-        // Shifts VY right by one and stores the result to VX (VY remains unchanged).
-        // VF is set to the value of the least significant bit of VY before the
-        // shift
-        chip8->V[0xF] = chip8->V[REG_Y] & 0x01;
-        chip8->V[REG_X] = chip8->V[REG_Y] >> 1;
-        break;
-        
-        case 0x8007:
-        // 0x8XY7
-        // Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when
-        // there isn't.
-        if(chip8->V[REG_Y] < chip8->V[REG_X])
-        {
-            // Underflow - Set borrow flag to 0
-            chip8->V[0xF] = 0;
-        }
-        else
-        {
-            // Unset borrow flag to 1
-            chip8->V[0xF] = 1;
-        }
-        chip8->V[REG_X] = chip8->V[REG_Y] - chip8->V[REG_X];
-        break;
-        
-        case 0x800E:
-        // 0x8XYE
-        // Shifts VY left by one and copies the result to VX. VF is set to the value
-        // of the most significant bit of VY before the shift.
-        chip8->V[0xF] = chip8->V[REG_Y] >> 7;
-        
-        assert(chip8->V[0xF] == 1 || chip8->V[0xF] == 0);
-        
-        chip8->V[REG_X] = chip8->V[REG_Y] = chip8->V[REG_Y] << 1;
-        break;
-        
-        default:
-        OpCodeNotImpl(chip8->opcode);
-        break;
+        // Set carry flag
+        chip8->V[0xF] = 1;
+    }
+    else
+    {
+        // Unset carry flag
+        chip8->V[0xF] = 0;
+    }
+    chip8->V[REG_X] += chip8->V[REG_Y];
+}
+
+void Op_8XY5(Chip8* chip8)
+{
+    // 0x8XY5
+    // VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when
+    // there isn't.
+    if(chip8->V[REG_X] <= chip8->V[REG_Y])
+    {
+        // Underflow - Set borrow flag
+        chip8->V[0xF] = 0;
     }
+    else
+    {
+        // Unset borrow flag
+        chip8->V[0xF] = 1;
+    }
+    chip8->V[REG_X] -= chip8->V[REG_Y];
+}
+
+void Op_8XY6(Chip8* chip8)
+{
+    // 0x8XY6
+    // Shifts VY right by one and stores the result to VX (VY remains unchanged).
+    // VF is set to the value of the least significant bit of VY before the
+    // shift
+    chip8->V[0xF] = chip8->V[REG_Y] & 0x01;
+    chip8->V[REG_X] = chip8->V[REG_Y] >> 1;
+}
+
+void Op_8XY7(Chip8* chip8)
+{
+    // 0x8XY7
+    // Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when
+    // there isn't.
+    if(chip8->V[REG_Y] < chip8->V[REG_X])
+    {
+        // Underflow - Set borrow flag to 0
+        chip8->V[0xF] = 0;
+    }
+    else
+    {
+        // Unset borrow flag to 1
+        chip8->V[0xF] = 1;
+    }
+    chip8->V[REG_X] = chip8->V[REG_Y] - chip8->V[REG_X];
+}
+
+void Op_8XYE(Chip8* chip8)
+{
+    // 0x8XYE
+    // Shifts VY left by one and copies the result to VX. VF is set to the value
+    // of the most significant bit of VY before the shift.
+    chip8->V[0xF] = chip8->V[REG_Y] >> 7;
+    
+    assert(chip8->V[0xF] == 1 || chip8->V[0xF] == 0);
+    
+    chip8->V[REG_X] = chip8->V[REG_Y] = chip8->V[REG_Y] << 1;
 }
 
 void Op_9XY0(Chip8* chip8)
@@ -234,6 +278,46 @@ void Op_CXNN(Chip8* chip8)
     chip8->V[REG_X] = (chip8->opcode & 0x00FF) & (rand() % 255);
 }
 
+uint8_t C8DrawSprite(Chip8* chip8, uint8_t x, uint8_t y, uint16_t address, uint32_t height)
+{
+    uint8_t collision = 0;
+    
+    uint32_t VX = x % SCREEN_WIDTH;
+    uint32_t VY = y;
+    
+    // The display is packed a bit per pixel so each sprite row covers at most
+    // two bytes, the second wraps around to the start of the screen row
+    uint32_t shift = VX % 8;
+    uint32_t left = VX / 8;
+    uint32_t right = (left + 1) % SCREEN_PITCH;
+    
+    for(uint32_t row_index=0; row_index<height; ++row_index)
+    {
+        // Get the row from memory
+        uint8_t pixel_row = READ_MEMORY(address, row_index);
+        
+        // Sprites wrap around the edges of the screen
+        uint8_t* row = &chip8->gfx[((VY + row_index) % SCREEN_HEIGHT) * SCREEN_PITCH];
+        
+        uint8_t left_bits = pixel_row >> shift;
+        uint8_t right_bits = shift ? (uint8_t)(pixel_row << (8 - shift)) : 0;
+        
+        // Graphics are drawn by XOR-ing the value of each pixel - if a value
+        // changes from a 1 to a 0 there is a collision
+        if((row[left] & left_bits) || (row[right] & right_bits))
+        {
+            collision = 1;
+        }
+        
+        row[left] ^= left_bits;
+        row[right] ^= right_bits;
+    }
+    
+    chip8->draw_flag = true;
+    
+    return collision;
+}
+
 void Op_DXYN(Chip8* chip8)
 {
     // DXYN
@@ -246,196 +330,250 @@ flipped from set to unset when the sprite is drawn, and to 0 if that doesn’t
 happen
     */
     
-    // Reset V[0xF]
+    // Reset V[0xF], VX and VY are read after so DFYN draws at 0
     chip8->V[0xF] = 0;
     
-    uint32_t VX = chip8->V[REG_X];
-    uint32_t VY = chip8->V[REG_Y];
-    uint32_t height = (chip8->opcode & 0x000F);
-    
-    // Setup loop
-    for(uint32_t y=0; y<height; ++y)
-    {
-        // Get the row from memory
-        uint8_t pixel_row = chip8->memory[chip8->I + y];
-        for(uint32_t x=0; x<8; ++x)
-        {
-            // Graphics are drawn by XOR-ing the value of each pixel - if a value
-            // changes from a 1 to a 0 V[0xF] is set to 1
-            uint8_t old_pixel_value = chip8->gfx[((VY + y) * SCREEN_WIDTH) + (VX + x)] & 0x01;
-            
-            uint8_t new_pixel_value = ((pixel_row >> (7 - x)) & 0x01);
-            
-            assert(old_pixel_value == 0 || old_pixel_value == 1);
-            assert(new_pixel_value == 0 || new_pixel_value == 1);
-            
-            uint8_t tempVal = old_pixel_value ^ new_pixel_value;
-            
-            chip8->gfx[((VY + y) * SCREEN_WIDTH) + (VX + x)] = tempVal == 1 ? 255 : 0;
-            if(old_pixel_value == 1 && new_pixel_value == 1)
-            {
-                chip8->V[0xF] = 1;
-            }
-        }
-    }
-    
-    chip8->draw_flag = true;
+    chip8->V[0xF] = C8DrawSprite(chip8, chip8->V[REG_X], chip8->V[REG_Y], chip8->I, chip8->opcode & 0x000F);
 }
 
-void Op_EXxx(Chip8* chip8)
+void Op_EX9E(Chip8* chip8)
 {
-    // There are a number of EX__ opcodes
-    switch(chip8->opcode & 0xF0FF)
-    {
-        case 0xE09E:
-        /* 0xEX9E
+    /* 0xEX9E
     Skips the next instruction if the key stored in VX is pressed. (Usually the
     next instruction is a jump to skip a code block)
-        */
-        if(chip8->keys[chip8->V[REG_X]] != 0)
-        {
-            // Key down, skip an extra instruction
-            chip8->pc +=2;
-        }
-        break;
-        
-        case 0xE0A1:
-        /*
-        Skips the next instruction if the key stored in VX isn't pressed. (Usually the next instruction is a jump to skip a code block)
-        */
-        if(chip8->keys[chip8->V[REG_X]] == 0)
-        {
-            // Key not down, skip an extra instruction
-            chip8->pc +=2;
-        }
-        break;
-        
-        default:
-        OpCodeNotImpl(chip8->opcode);
+    */
+    chip8->keys_read = true;
+    if(chip8->keys & (1 << C8KeyIndex(chip8, chip8->V[REG_X])))
+    {
+        // Key down, skip an extra instruction
+        chip8->pc +=2;
     }
 }
 
-#include <unistd.h>
-void Op_FXxx(Chip8* chip8)
+void Op_EXA1(Chip8* chip8)
 {
-    // There are a number of FX__ opcodes
-    switch(chip8->opcode & 0xF0FF)
+    /*
+    Skips the next instruction if the key stored in VX isn't pressed. (Usually the next instruction is a jump to skip a code block)
+    */
+    chip8->keys_read = true;
+    if(!(chip8->keys & (1 << C8KeyIndex(chip8, chip8->V[REG_X]))))
     {
-        case 0xF007:
-        /* 
+        // Key not down, skip an extra instruction
+        chip8->pc +=2;
+    }
+}
+
+void Op_FX07(Chip8* chip8)
+{
+    /* 
     0xFX07
     Sets VX to the value of the delay timer.
-        */
-        chip8->V[REG_X] = chip8->delay_timer;
-        break;
-        
-        case 0xF00A:
-        // 0xFX0A
-        // A key press is awaited, and then stored in VX. (Blocking Operation. All
-        // instruction halted until next key event)
-        while(true)
-        {
-            // Make sure we poll so the input state is refreshed
-            glfwPollEvents();
-            
-            C8GetInput(chip8);
-            
-            bool key_changed = false;
-            for(int i=0; i<MAX_KEYS; ++i)
-            {
-                if(chip8->keys[i] != 0)
-                {
-                    chip8->V[REG_X] = i;
-                    key_changed = true;
-                    break;
-                }
-            }
-            
-            if(key_changed)
-            {
-                break;
-            }
-            
-            sleep(1);
-        }
-        break;
-        
-        case 0xF015:
-        // 0xFX15
-        // Sets the delay timer to VX.
-        chip8->delay_timer = chip8->V[REG_X];
-        break;
-        
-        case 0xF018:
-        // 0xFX15
-        // Sets the sound timer to VX.
-        chip8->sound_timer = chip8->V[REG_X];
-        break;
-        
-        case 0xF01E:
-        // 0xFX1E - Adds VX to I
-        if(((uint32_t)chip8->I + (uint32_t)chip8->V[REG_X]) > 0xFFF)
-        {
-            chip8->V[0xF] = 1;
-        }
-        else
+    */
+    chip8->V[REG_X] = chip8->delay_timer;
+}
+
+void Op_FX0A(Chip8* chip8)
+{
+    // 0xFX0A
+    // A key press is awaited, and then stored in VX. (Blocking Operation. All
+    // instruction halted until next key event)
+    // Rather than block the emulation thread the instruction is repeated
+    // until a key is down
+    chip8->keys_read = true;
+    bool key_pressed = false;
+    for(int i=0; i<MAX_KEYS; ++i)
+    {
+        if(chip8->keys & (1 << i))
         {
-            chip8->V[0xF] = 0;
+            chip8->V[REG_X] = i;
+            key_pressed = true;
+            break;
         }
-        
-        chip8->I += chip8->V[REG_X];
-        break;
-        
-        case 0xF029:
-        /*
+    }
+    
+    if(!key_pressed)
+    {
+        chip8->pc -= 2;
+    }
+}
+
+void Op_FX15(Chip8* chip8)
+{
+    // 0xFX15
+    // Sets the delay timer to VX.
+    chip8->delay_timer = chip8->V[REG_X];
+}
+
+void Op_FX18(Chip8* chip8)
+{
+    // 0xFX18
+    // Sets the sound timer to VX.
+    chip8->sound_timer = chip8->V[REG_X];
+}
+
+void Op_FX1E(Chip8* chip8)
+{
+    // 0xFX1E - Adds VX to I
+    if(((uint32_t)chip8->I + (uint32_t)chip8->V[REG_X]) > 0xFFF)
+    {
+        chip8->V[0xF] = 1;
+    }
+    else
+    {
+        chip8->V[0xF] = 0;
+    }
+    
+    chip8->I += chip8->V[REG_X];
+}
+
+void Op_FX29(Chip8* chip8)
+{
+    /*
     0xFX29
     
     Sets I to the location of the sprite for the character in VX. Characters
-        0-F (in hexadecimal) are represented by a 4x5 font.
-        */
-        chip8->I = chip8->V[(REG_X)] * 5;
-        break;
-        
-        case 0xF033:
-        // 0xFX33
-        /*
-        Stores the binary-coded decimal representation of VX, with the most
+    0-F (in hexadecimal) are represented by a 4x5 font.
+    */
+    chip8->I = chip8->V[(REG_X)] * 5;
+}
+
+void Op_FX33(Chip8* chip8)
+{
+    // 0xFX33
+    /*
+    Stores the binary-coded decimal representation of VX, with the most
     significant of three digits at the address in I, the middle digit at I plus
     1, and the least significant digit at I plus 2. (In other words, take the
     decimal representation of VX, place the hundreds digit in memory at location
     in I, the tens digit at location I+1, and the ones digit at location I+2.)
-        */
-        chip8->memory[chip8->I] = chip8->V[REG_X] / 100;
-        chip8->memory[chip8->I + 1] = (chip8->V[REG_X] / 10) % 10;
-        chip8->memory[chip8->I + 2] = (chip8->V[REG_X] % 100) % 10;
-        break;
-        
-        case 0xF055:
-        /*
-        Stores V0 to VX (including VX) in memory starting at address I. The offset
+    */
+    WRITE_MEMORY(chip8->I, 0, chip8->V[REG_X] / 100);
+    WRITE_MEMORY(chip8->I, 1, (chip8->V[REG_X] / 10) % 10);
+    WRITE_MEMORY(chip8->I, 2, (chip8->V[REG_X] % 100) % 10);
+}
+
+void Op_FX55(Chip8* chip8)
+{
+    /*
+    Stores V0 to VX (including VX) in memory starting at address I. The offset
     from I is increased by 1 for each value written, but I itself is left
     unmodified.
-        */
-        for(int v=0; v<= REG_X; ++v)
-        {
-            chip8->memory[chip8->I + v] = chip8->V[v];
-        }
-        break;
-        
-        case 0xF065:
-        /*
-        Fills V0 to VX (including VX) with values from memory starting at address I.
+    */
+    for(int v=0; v<= REG_X; ++v)
+    {
+        WRITE_MEMORY(chip8->I, v, chip8->V[v]);
+    }
+}
+
+void Op_FX65(Chip8* chip8)
+{
+    /*
+    Fills V0 to VX (including VX) with values from memory starting at address I.
     The offset from I is increased by 1 for each value written, but I itself is
     left unmodified.
-        */
-        for(int v=0; v<= REG_X; ++v)
-        {
-            chip8->V[v] = chip8->memory[chip8->I + v];
-        }
-        break;
-        
-        default:
-        OpCodeNotImpl(chip8->opcode);
-        break;
+    */
+    for(int v=0; v<= REG_X; ++v)
+    {
+        chip8->V[v] = READ_MEMORY(chip8->I, v);
     }
 }
+
+void Op_Bad(Chip8* chip8)
+{
+    // Matches no entry in Opcodes.def
+    OpCodeNotImpl(chip8->opcode);
+}
+
+// Fused sequences, decoded is indexed by address so the instructions are two
+// apart. The pre-decoder only fuses instructions on the same page so the pc
+// never wraps part way through
+
+// Shared tail of the loops, 3XNN then 1NNN unless it skips it
+static inline uint32_t C8FusedSkipJump(Chip8* chip8, const C8Decoded* decoded)
+{
+    uint16_t skip = decoded[2].opcode;
+    if(chip8->V[(skip & 0x0F00) >> 8] == (skip & 0x00FF))
+    {
+        chip8->opcode = skip;
+        chip8->pc += 6;
+        return 2;
+    }
+    
+    chip8->opcode = decoded[4].opcode;
+    chip8->pc = decoded[4].opcode & 0x0FFF;
+    return 3;
+}
+
+uint32_t Op_Fused_TimerWait(Chip8* chip8, const C8Decoded* decoded)
+{
+    // FX07, 3XNN, 1NNN
+    chip8->V[(decoded[0].opcode & 0x0F00) >> 8] = chip8->delay_timer;
+    return C8FusedSkipJump(chip8, decoded);
+}
+
+uint32_t Op_Fused_CounterLoop(Chip8* chip8, const C8Decoded* decoded)
+{
+    // 7XNN, 3XNN, 1NNN
+    chip8->V[(decoded[0].opcode & 0x0F00) >> 8] += decoded[0].opcode & 0x00FF;
+    return C8FusedSkipJump(chip8, decoded);
+}
+
+uint32_t Op_Fused_LD_I_DRW(Chip8* chip8, const C8Decoded* decoded)
+{
+    // ANNN, DXYN
+    chip8->I = decoded[0].opcode & 0x0FFF;
+    chip8->opcode = decoded[2].opcode;
+    chip8->pc += 4;
+    Op_DXYN(chip8);
+    return 2;
+}
+
+uint32_t Op_Fused_LD_LD(Chip8* chip8, const C8Decoded* decoded)
+{
+    // 6XNN, 6XNN
+    chip8->V[(decoded[0].opcode & 0x0F00) >> 8] = decoded[0].opcode & 0x00FF;
+    chip8->V[(decoded[2].opcode & 0x0F00) >> 8] = decoded[2].opcode & 0x00FF;
+    chip8->opcode = decoded[2].opcode;
+    chip8->pc += 4;
+    return 2;
+}
+
+// The first entry of Opcodes.def an opcode matches, a chain of conditionals
+// so it can be evaluated at compile time
+static constexpr uint8_t C8DecodeEntry(uint32_t opcode)
+{
+    return
+#define OPCODE(name, pattern, mask, handler, format, operands, flow) (opcode & mask) == pattern ? (uint8_t)C8_OP_##name :
+#include "Opcodes.def"
+#undef OPCODE
+        (uint8_t)C8_OP_BAD;
+}
+
+// Every entry is a constant expression, so the table is constant initialised
+// and filled in before any code runs, including other static initialisers
+#define C8_DECODE_16(n) \
+    C8DecodeEntry((n) * 16 + 0x0), C8DecodeEntry((n) * 16 + 0x1), C8DecodeEntry((n) * 16 + 0x2), C8DecodeEntry((n) * 16 + 0x3), \
+    C8DecodeEntry((n) * 16 + 0x4), C8DecodeEntry((n) * 16 + 0x5), C8DecodeEntry((n) * 16 + 0x6), C8DecodeEntry((n) * 16 + 0x7), \
+    C8DecodeEntry((n) * 16 + 0x8), C8DecodeEntry((n) * 16 + 0x9), C8DecodeEntry((n) * 16 + 0xA), C8DecodeEntry((n) * 16 + 0xB), \
+    C8DecodeEntry((n) * 16 + 0xC), C8DecodeEntry((n) * 16 + 0xD), C8DecodeEntry((n) * 16 + 0xE), C8DecodeEntry((n) * 16 + 0xF)
+#define C8_DECODE_256(n) \
+    C8_DECODE_16((n) * 16 + 0x0), C8_DECODE_16((n) * 16 + 0x1), C8_DECODE_16((n) * 16 + 0x2), C8_DECODE_16((n) * 16 + 0x3), \
+    C8_DECODE_16((n) * 16 + 0x4), C8_DECODE_16((n) * 16 + 0x5), C8_DECODE_16((n) * 16 + 0x6), C8_DECODE_16((n) * 16 + 0x7), \
+    C8_DECODE_16((n) * 16 + 0x8), C8_DECODE_16((n) * 16 + 0x9), C8_DECODE_16((n) * 16 + 0xA), C8_DECODE_16((n) * 16 + 0xB), \
+    C8_DECODE_16((n) * 16 + 0xC), C8_DECODE_16((n) * 16 + 0xD), C8_DECODE_16((n) * 16 + 0xE), C8_DECODE_16((n) * 16 + 0xF)
+#define C8_DECODE_4096(n) \
+    C8_DECODE_256((n) * 16 + 0x0), C8_DECODE_256((n) * 16 + 0x1), C8_DECODE_256((n) * 16 + 0x2), C8_DECODE_256((n) * 16 + 0x3), \
+    C8_DECODE_256((n) * 16 + 0x4), C8_DECODE_256((n) * 16 + 0x5), C8_DECODE_256((n) * 16 + 0x6), C8_DECODE_256((n) * 16 + 0x7), \
+    C8_DECODE_256((n) * 16 + 0x8), C8_DECODE_256((n) * 16 + 0x9), C8_DECODE_256((n) * 16 + 0xA), C8_DECODE_256((n) * 16 + 0xB), \
+    C8_DECODE_256((n) * 16 + 0xC), C8_DECODE_256((n) * 16 + 0xD), C8_DECODE_256((n) * 16 + 0xE), C8_DECODE_256((n) * 16 + 0xF)
+
+const uint8_t c8_decode_table[65536] = {
+    C8_DECODE_4096(0x0), C8_DECODE_4096(0x1), C8_DECODE_4096(0x2), C8_DECODE_4096(0x3),
+    C8_DECODE_4096(0x4), C8_DECODE_4096(0x5), C8_DECODE_4096(0x6), C8_DECODE_4096(0x7),
+    C8_DECODE_4096(0x8), C8_DECODE_4096(0x9), C8_DECODE_4096(0xA), C8_DECODE_4096(0xB),
+    C8_DECODE_4096(0xC), C8_DECODE_4096(0xD), C8_DECODE_4096(0xE), C8_DECODE_4096(0xF),
+};
+
+#undef C8_DECODE_16
+#undef C8_DECODE_256
+#undef C8_DECODE_4096
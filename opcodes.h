@@ -1,46 +1,144 @@
 #ifndef _OPCODES_H
 #define _OPCODES_H
 
+#include <stdint.h>
+
 // Predef
 struct Chip8;
+struct C8Decoded;
 
 // Function pointer for opcodes
 typedef void (*opcode_func_ptr)(Chip8*);
 
-void Op_0xxx(Chip8*);
-void Op_1NNN(Chip8*);
-void Op_2NNN(Chip8*);
-void Op_3XNN(Chip8*);
-void Op_4XNN(Chip8*);
-void Op_5XY0(Chip8*);
-void Op_6XNN(Chip8*);
-void Op_7XNN(Chip8*);
-void Op_8xxx(Chip8*);
-void Op_9XY0(Chip8*);
-void Op_ANNN(Chip8*);
-void Op_BNNN(Chip8*);
-void Op_CXNN(Chip8*);
-void Op_DXYN(Chip8*);
-void Op_EXxx(Chip8*);
-void Op_FXxx(Chip8*);
-
-const opcode_func_ptr opcode_table[] = {
-    Op_0xxx, // 0x0
-    Op_1NNN, // 0x1
-    Op_2NNN, // 0x2
-    Op_3XNN, // 0x3
-    Op_4XNN, // 0x4
-    Op_5XY0, // 0x5
-    Op_6XNN, // 0x6
-    Op_7XNN, // 0x7
-    Op_8xxx, // 0x8
-    Op_9XY0, // 0x9
-    Op_ANNN, // 0xA
-    Op_BNNN, // 0xB
-    Op_CXNN, // 0xC
-    Op_DXYN, // 0xD
-    Op_EXxx, // 0xE
-    Op_FXxx, // 0xF
-};
-
-#endif
\ No newline at end of file
+// How an instruction hands on control, lets tools follow code through a ROM
+enum C8Flow
+{
+    C8_FLOW_NEXT,     // On to the next instruction
+    C8_FLOW_SKIP,     // On to the next instruction or the one after
+    C8_FLOW_JUMP,     // To NNN
+    C8_FLOW_CALL,     // To NNN, returning to the next instruction
+    C8_FLOW_RETURN,   // Back to the caller
+    C8_FLOW_COMPUTED, // To NNN + V0, unknown until it runs
+    C8_FLOW_STOP,     // Not an instruction
+};
+
+// Fields of the opcode passed to its format string, in order
+enum C8Operands
+{
+    C8_OPERANDS_NONE,
+    C8_OPERANDS_NNN,
+    C8_OPERANDS_X,
+    C8_OPERANDS_XNN,
+    C8_OPERANDS_XY,
+    C8_OPERANDS_XYN,
+    C8_OPERANDS_OPCODE, // The whole opcode
+};
+
+// Ensure our XMacro is unbound to begin with
+#undef OPCODE
+
+enum C8OpcodeId
+{
+#define OPCODE(name, pattern, mask, handler, format, operands, flow) C8_OP_##name,
+#include "Opcodes.def"
+#undef OPCODE
+    // Anything no entry matches
+    C8_OP_BAD,
+    
+    // Always last
+    C8_OP_COUNT,
+};
+
+#define OPCODE(name, pattern, mask, handler, format, operands, flow) void handler(Chip8*);
+#include "Opcodes.def"
+#undef OPCODE
+void Op_Bad(Chip8*);
+
+// XORs a sprite of height rows from address onto the display, returns 1 if
+// any pixel was turned off. Shared with translated code
+uint8_t C8DrawSprite(Chip8* chip8, uint8_t x, uint8_t y, uint16_t address, uint32_t height);
+
+const opcode_func_ptr opcode_table[C8_OP_COUNT] = {
+#define OPCODE(name, pattern, mask, handler, format, operands, flow) handler,
+#include "Opcodes.def"
+#undef OPCODE
+    Op_Bad,
+};
+
+struct C8OpcodeInfo
+{
+    const char* name;
+    uint16_t pattern;
+    uint16_t mask;
+    const char* format;
+    uint8_t operands; // One of C8Operands
+    uint8_t flow; // One of C8Flow
+};
+
+const C8OpcodeInfo opcode_info[C8_OP_COUNT] = {
+#define OPCODE(name, pattern, mask, handler, format, operands, flow) { #name, pattern, mask, format, operands, flow },
+#include "Opcodes.def"
+#undef OPCODE
+    { "BAD", 0x0000, 0x0000, "DW 0x%04X", C8_OPERANDS_OPCODE, C8_FLOW_STOP },
+};
+
+// Sequences the pre-decoder fuses into a single dispatch, matched on the
+// entries of consecutive instructions, first match wins
+enum C8FusedId
+{
+    C8_FUSED_TIMER_WAIT,   // FX07, 3XNN, 1NNN
+    C8_FUSED_COUNTER_LOOP, // 7XNN, 3XNN, 1NNN
+    C8_FUSED_LD_I_DRW,     // ANNN, DXYN
+    C8_FUSED_LD_LD,        // 6XNN, 6XNN
+    
+    // Always last
+    C8_FUSED_COUNT,
+};
+
+#define C8_FUSED_MAX_LENGTH 3
+
+// Decoded dispatch values from here on start a fused sequence, past every
+// entry of opcode_table so a single compare finds plain instructions
+#define C8_DISPATCH_FUSED C8_OP_COUNT
+
+// Runs a fused sequence from the decoded entry at its address, returns how many
+// of its instructions ran as a skip can leave early. Leaves the opcode of the
+// last one run in chip8->opcode as stepping would
+typedef uint32_t (*fused_func_ptr)(Chip8*, const C8Decoded*);
+
+uint32_t Op_Fused_TimerWait(Chip8*, const C8Decoded*);
+uint32_t Op_Fused_CounterLoop(Chip8*, const C8Decoded*);
+uint32_t Op_Fused_LD_I_DRW(Chip8*, const C8Decoded*);
+uint32_t Op_Fused_LD_LD(Chip8*, const C8Decoded*);
+
+const fused_func_ptr fused_table[C8_FUSED_COUNT] = {
+    Op_Fused_TimerWait,
+    Op_Fused_CounterLoop,
+    Op_Fused_LD_I_DRW,
+    Op_Fused_LD_LD,
+};
+
+struct C8FusedInfo
+{
+    const char* name;
+    uint8_t length;
+    uint8_t ids[C8_FUSED_MAX_LENGTH]; // Entries of opcode_table
+};
+
+const C8FusedInfo fused_info[C8_FUSED_COUNT] = {
+    { "timer wait", 3, { C8_OP_LD_VX_DT, C8_OP_SE_VX_NN, C8_OP_JP } },
+    { "counter loop", 3, { C8_OP_ADD_VX_NN, C8_OP_SE_VX_NN, C8_OP_JP } },
+    { "draw", 2, { C8_OP_LD_I, C8_OP_DRW } },
+    { "load pair", 2, { C8_OP_LD_VX_NN, C8_OP_LD_VX_NN } },
+};
+
+// The entry each of the 64K opcodes decodes to, generated from the table at
+// compile time
+extern const uint8_t c8_decode_table[65536];
+
+inline uint8_t C8Decode(uint16_t opcode)
+{
+    return c8_decode_table[opcode];
+}
+
+#endif
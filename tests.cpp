@@ -1,7 +1,27 @@
 #include "Chip8.h"
+#include "Chip8Pool.h"
+#include "Chip8Env.h"
+#include "Chip8Scheduler.h"
+#include "Chip8Pacer.h"
+#include "Chip8Metrics.h"
+#include "Chip8Trace.h"
+#include "Chip8Debugger.h"
+#include "Chip8Disasm.h"
+#include "Chip8Cfg.h"
+#include "Chip8Aot.h"
+#include "Chip8Shadow.h"
+#include "opcodes.h"
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+
+#include <thread>
+
+// Every test chip shares a blank image, anything a test writes lands on a
+// private page
+C8Image test_image;
+C8PagePool test_pool;
 
 void CheckC8Structures(Chip8* input, Chip8* expected)
 {
@@ -11,7 +31,7 @@ void CheckC8Structures(Chip8* input, Chip8* expected)
     // Memory state
     for(uint16_t b=0; b<MEMSIZE; ++b)
     {
-        assert(input->memory[b] == expected->memory[b]);
+        assert(C8ReadMemory(input, b) == C8ReadMemory(expected, b));
     }
     
     // Registers
@@ -27,7 +47,7 @@ void CheckC8Structures(Chip8* input, Chip8* expected)
     assert(input->pc == expected->pc);
     
     // GFX Memory
-    for(uint16_t i=0; i<(SCREEN_WIDTH * SCREEN_HEIGHT); ++i)
+    for(uint16_t i=0; i<(SCREEN_PITCH * SCREEN_HEIGHT); ++i)
     {
         assert(input->gfx[i] == expected->gfx[i]);
     }
@@ -39,7 +59,7 @@ void CheckC8Structures(Chip8* input, Chip8* expected)
     // Skip clock start time as this is dynamic
     
     // Stack
-    for(uint16_t s=0; s<16; ++s)
+    for(uint16_t s=0; s<STACKSIZE; ++s)
     {
         assert(input->stack[s] == expected->stack[s]);
     }
@@ -48,12 +68,12 @@ void CheckC8Structures(Chip8* input, Chip8* expected)
     assert(input->sp == expected->sp);
     
     // Dont check keys
-    // Dont check keymap
     
     // Draw flag
     assert(input->draw_flag == expected->draw_flag);
     
-    // Dont check screen ptr
+    // Fault
+    assert(input->fault == expected->fault);
 }
 
 void Test(const char* opcode, Chip8 input, Chip8 expected)
@@ -63,12 +83,16 @@ void Test(const char* opcode, Chip8 input, Chip8 expected)
     // Emulate CPU
     C8EmulateCycle(&input);
     
-    // Decrement counters
-    C8DecrementCounters(&input);
+    // A frame has passed, tick the timers
+    C8TickTimers(&input);
     
     // Check against expected
     CheckC8Structures(&input, &expected);
     
+    // The copies hold the only references to the pages SetupTestC8 made private
+    C8ReleasePages(&input);
+    C8ReleasePages(&expected);
+    
     printf("PASS\n");
 }
 
@@ -76,11 +100,11 @@ Chip8 SetupTestC8(uint16_t opcode)
 {
     // Setup input C8 Struct
     Chip8 chip8 = {};
-    C8Initialise(&chip8);
+    C8Initialise(&chip8, &test_image, &test_pool);
     
     // Place the opcode at 0x200
-    chip8.memory[0x200] = opcode >> 8;
-    chip8.memory[0x201] = opcode & 0x00FF;
+    C8WriteMemory(&chip8, 0x200, opcode >> 8);
+    C8WriteMemory(&chip8, 0x201, opcode & 0x00FF);
     
     chip8.opcode = opcode;
     
@@ -92,7 +116,7 @@ void Test_0x00E0()
     Chip8 input = SetupTestC8(0x00E0);
     
     // This should clear the video RAM so we need to add some random bytes to the GFX
-    for(int x=0; x<(SCREEN_WIDTH * SCREEN_HEIGHT); ++x)
+    for(int x=0; x<(SCREEN_PITCH * SCREEN_HEIGHT); ++x)
     {
         input.gfx[x] = rand() % 255;
     }
@@ -142,6 +166,24 @@ void Test_0x2NNN()
     Test("0x2NNN", input, expected);
 }
 
+void Test_0x2NNN_Overflow()
+{
+    Chip8 input = SetupTestC8(0x2123);
+    input.sp = STACKSIZE;
+    
+    // Setup the expected result, the stack pointer wraps onto the bottom of
+    // the stack rather than writing past it
+    Chip8 expected = SetupTestC8(0x2123);
+    expected.pc = 0x0123;
+    expected.stack[0] = 0x202;
+    expected.sp = STACKSIZE + 1;
+#ifdef C8_CHECKED
+    expected.fault = C8_FAULT_STACK_OVERFLOW;
+#endif
+    
+    Test("0x2NNN overflow", input, expected);
+}
+
 void Test_0x3XNN_NotEqual()
 {
     Chip8 input = SetupTestC8(0x3466);
@@ -544,16 +586,105 @@ void Test_0xBNNN()
     Test("0xBNNN", input, expected);
 }
 
+void SetTestPixel(Chip8* chip8, uint32_t x, uint32_t y, bool set)
+{
+    uint8_t mask = 0x80 >> (x % 8);
+    uint8_t* pixels = &chip8->gfx[(y * SCREEN_PITCH) + (x / 8)];
+    
+    *pixels = set ? (*pixels | mask) : (*pixels & ~mask);
+}
+
+void Test_0xDXYN()
+{
+    Chip8 input = SetupTestC8(0xD125);
+    input.V[1] = 2;
+    input.V[2] = 3;
+    
+    // Setup the expected result, the 0 from the font at (2, 3)
+    Chip8 expected = SetupTestC8(0xD125);
+    expected.V[1] = 2;
+    expected.V[2] = 3;
+    expected.pc +=2;
+    expected.draw_flag = true;
+    
+    for(int y=0; y<5; ++y)
+    {
+        for(int x=0; x<8; ++x)
+        {
+            if(chip8_fontset[y] & (0x80 >> x))
+            {
+                SetTestPixel(&expected, 2 + x, 3 + y, true);
+            }
+        }
+    }
+    
+    Test("0xDXYN", input, expected);
+}
+
+void Test_0xDXYN_Collision()
+{
+    Chip8 input = SetupTestC8(0xD125);
+    input.V[1] = 2;
+    input.V[2] = 3;
+    SetTestPixel(&input, 2, 3, true);
+    
+    // Setup the expected result, the pixel already set is flipped off
+    Chip8 expected = SetupTestC8(0xD125);
+    expected.V[1] = 2;
+    expected.V[2] = 3;
+    expected.V[0xF] = 1;
+    expected.pc +=2;
+    expected.draw_flag = true;
+    
+    for(int y=0; y<5; ++y)
+    {
+        for(int x=0; x<8; ++x)
+        {
+            if(chip8_fontset[y] & (0x80 >> x))
+            {
+                SetTestPixel(&expected, 2 + x, 3 + y, true);
+            }
+        }
+    }
+    SetTestPixel(&expected, 2, 3, false);
+    
+    Test("0xDXYN collision", input, expected);
+}
+
+void Test_0xDXYN_Wrap()
+{
+    Chip8 input = SetupTestC8(0xD122);
+    input.V[1] = 62;
+    input.V[2] = 31;
+    
+    // Setup the expected result, the top two rows of the font 0 (0xF0, 0x90)
+    // wrap around the right and bottom edges
+    Chip8 expected = SetupTestC8(0xD122);
+    expected.V[1] = 62;
+    expected.V[2] = 31;
+    expected.pc +=2;
+    expected.draw_flag = true;
+    
+    SetTestPixel(&expected, 62, 31, true);
+    SetTestPixel(&expected, 63, 31, true);
+    SetTestPixel(&expected, 0, 31, true);
+    SetTestPixel(&expected, 1, 31, true);
+    SetTestPixel(&expected, 62, 0, true);
+    SetTestPixel(&expected, 1, 0, true);
+    
+    Test("0xDXYN wrap", input, expected);
+}
+
 void Test_0xEX9E_Pressed()
 {
     Chip8 input = SetupTestC8(0xE39E);
     input.V[3] = 6;
-    input.keys[6] = 1;
+    input.keys |= (1 << 6);
     
     // Setup the expected result
     Chip8 expected = SetupTestC8(0xE39E);
     expected.V[3] = 6;
-    expected.keys[6] = 1;
+    expected.keys |= (1 << 6);
     expected.pc +=4;
     
     Test("0xE39E Pressed", input, expected);
@@ -563,12 +694,12 @@ void Test_0xEX9E_NotPressed()
 {
     Chip8 input = SetupTestC8(0xE39E);
     input.V[3] = 6;
-    input.keys[6] = 0;
+    input.keys &= ~(1 << 6);
     
     // Setup the expected result
     Chip8 expected = SetupTestC8(0xE39E);
     expected.V[3] = 6;
-    expected.keys[6] = 0;
+    expected.keys &= ~(1 << 6);
     expected.pc +=2;
     
     Test("0xE39E Not Pressed", input, expected);
@@ -578,12 +709,12 @@ void Test_0xEXA1_Pressed()
 {
     Chip8 input = SetupTestC8(0xE3A1);
     input.V[3] = 7;
-    input.keys[7] = 1;
+    input.keys |= (1 << 7);
     
     // Setup the expected result
     Chip8 expected = SetupTestC8(0xE3A1);
     expected.V[3] = 7;
-    expected.keys[7] = 1;
+    expected.keys |= (1 << 7);
     expected.pc +=2;
     
     Test("0xE3A1 Pressed", input, expected);
@@ -593,12 +724,12 @@ void Test_0xEXA1_NotPressed()
 {
     Chip8 input = SetupTestC8(0xE3A1);
     input.V[3] = 7;
-    input.keys[7] = 0;
+    input.keys &= ~(1 << 7);
     
     // Setup the expected result
     Chip8 expected = SetupTestC8(0xE3A1);
     expected.V[3] = 7;
-    expected.keys[7] = 0;
+    expected.keys &= ~(1 << 7);
     expected.pc +=4;
     
     Test("0xE3A1 Not Pressed", input, expected);
@@ -619,6 +750,31 @@ void Test_0xFX07()
     Test("0xFX07", input, expected);
 }
 
+void Test_0xFX0A_Pressed()
+{
+    Chip8 input = SetupTestC8(0xF60A);
+    input.keys |= (1 << 9);
+    
+    // Setup the expected result
+    Chip8 expected = SetupTestC8(0xF60A);
+    expected.V[6] = 9;
+    expected.pc +=2;
+    
+    Test("0xFX0A Pressed", input, expected);
+}
+
+void Test_0xFX0A_NotPressed()
+{
+    Chip8 input = SetupTestC8(0xF60A);
+    input.V[6] = 3;
+    
+    // Setup the expected result, the instruction repeats until a key is down
+    Chip8 expected = SetupTestC8(0xF60A);
+    expected.V[6] = 3;
+    
+    Test("0xFX0A Not Pressed", input, expected);
+}
+
 void Test_0xFX15()
 {
     Chip8 input = SetupTestC8(0xF615);
@@ -692,9 +848,9 @@ void Test_0xFX33()
     expected.I = 0x250;
     expected.pc +=2;
     
-    expected.memory[0x250] = 1;
-    expected.memory[0x251] = 2;
-    expected.memory[0x252] = 3;
+    C8WriteMemory(&expected, 0x250, 1);
+    C8WriteMemory(&expected, 0x251, 2);
+    C8WriteMemory(&expected, 0x252, 3);
     
     Test("0xFX33", input, expected);
 }
@@ -723,29 +879,64 @@ void Test_0xFX55()
     expected.I = 0x250;
     expected.pc +=2;
     
-    expected.memory[0x250] = 1;
-    expected.memory[0x251] = 2;
-    expected.memory[0x252] = 3;
-    expected.memory[0x253] = 4;
-    expected.memory[0x254] = 5;
-    expected.memory[0x255] = 6;
-    expected.memory[0x256] = 7;
+    C8WriteMemory(&expected, 0x250, 1);
+    C8WriteMemory(&expected, 0x251, 2);
+    C8WriteMemory(&expected, 0x252, 3);
+    C8WriteMemory(&expected, 0x253, 4);
+    C8WriteMemory(&expected, 0x254, 5);
+    C8WriteMemory(&expected, 0x255, 6);
+    C8WriteMemory(&expected, 0x256, 7);
     
     Test("0xFX55", input, expected);
 }
 
+void Test_0xFX55_TopOfMemory()
+{
+    Chip8 input = SetupTestC8(0xF655);
+    input.V[0] = 1;
+    input.V[1] = 2;
+    input.V[2] = 3;
+    input.V[3] = 4;
+    input.V[4] = 5;
+    input.V[5] = 6;
+    input.V[6] = 7;
+    input.I = 0xFFC;
+    
+    // Setup the expected result, V4 to V6 land in the guard band
+    Chip8 expected = SetupTestC8(0xF655);
+    expected.V[0] = 1;
+    expected.V[1] = 2;
+    expected.V[2] = 3;
+    expected.V[3] = 4;
+    expected.V[4] = 5;
+    expected.V[5] = 6;
+    expected.V[6] = 7;
+    expected.I = 0xFFC;
+    expected.pc +=2;
+#ifdef C8_CHECKED
+    expected.fault = C8_FAULT_MEMORY;
+#endif
+    
+    C8WriteMemory(&expected, 0xFFC, 1);
+    C8WriteMemory(&expected, 0xFFD, 2);
+    C8WriteMemory(&expected, 0xFFE, 3);
+    C8WriteMemory(&expected, 0xFFF, 4);
+    
+    Test("0xFX55 top of memory", input, expected);
+}
+
 void Test_0xFX65()
 {
     Chip8 input = SetupTestC8(0xF665);
     input.I = 0x250;
     
-    input.memory[0x250] = 1;
-    input.memory[0x251] = 2;
-    input.memory[0x252] = 3;
-    input.memory[0x253] = 4;
-    input.memory[0x254] = 5;
-    input.memory[0x255] = 6;
-    input.memory[0x256] = 7;
+    C8WriteMemory(&input, 0x250, 1);
+    C8WriteMemory(&input, 0x251, 2);
+    C8WriteMemory(&input, 0x252, 3);
+    C8WriteMemory(&input, 0x253, 4);
+    C8WriteMemory(&input, 0x254, 5);
+    C8WriteMemory(&input, 0x255, 6);
+    C8WriteMemory(&input, 0x256, 7);
     
     // Setup the expected result
     Chip8 expected = SetupTestC8(0xF665);
@@ -757,13 +948,13 @@ void Test_0xFX65()
     expected.V[5] = 6;
     expected.V[6] = 7;
     
-    expected.memory[0x250] = 1;
-    expected.memory[0x251] = 2;
-    expected.memory[0x252] = 3;
-    expected.memory[0x253] = 4;
-    expected.memory[0x254] = 5;
-    expected.memory[0x255] = 6;
-    expected.memory[0x256] = 7;
+    C8WriteMemory(&expected, 0x250, 1);
+    C8WriteMemory(&expected, 0x251, 2);
+    C8WriteMemory(&expected, 0x252, 3);
+    C8WriteMemory(&expected, 0x253, 4);
+    C8WriteMemory(&expected, 0x254, 5);
+    C8WriteMemory(&expected, 0x255, 6);
+    C8WriteMemory(&expected, 0x256, 7);
     
     expected.I = 0x250;
     expected.pc +=2;
@@ -771,13 +962,1121 @@ void Test_0xFX65()
     Test("0xFX65", input, expected);
 }
 
+void Test_BadOpcode()
+{
+    Chip8 input = SetupTestC8(0xF0FF);
+    
+    // Setup the expected result, the fault is recorded rather than exiting
+    Chip8 expected = SetupTestC8(0xF0FF);
+    expected.pc +=2;
+    expected.fault = C8_FAULT_BAD_OPCODE;
+    
+    Test("Bad opcode", input, expected);
+}
+
+void Test_CopyOnWrite()
+{
+    printf("Testing Copy on write...");
+    
+    Chip8 first = {};
+    Chip8 second = {};
+    C8Initialise(&first, &test_image, &test_pool);
+    C8Initialise(&second, &test_image, &test_pool);
+    
+    // Reads come straight from the image
+    assert(first.private_pages == 0);
+    assert(C8ReadMemory(&first, 0) == chip8_fontset[0]);
+    
+    // The first write to a page copies it, the rest of the page comes along
+    C8WriteMemory(&first, 0x010, 0xAB);
+    assert(first.private_pages == (1 << 0));
+    assert(C8ReadMemory(&first, 0x010) == 0xAB);
+    assert(C8ReadMemory(&first, 0) == chip8_fontset[0]);
+    
+    // Neither the image nor other instances see the write
+    assert(test_image.memory[0x010] == chip8_fontset[0x010]);
+    assert(C8ReadMemory(&second, 0x010) == chip8_fontset[0x010]);
+    assert(second.private_pages == 0);
+    
+    // Releasing shares the image again
+    C8ReleasePages(&first);
+    assert(first.private_pages == 0);
+    assert(C8ReadMemory(&first, 0x010) == chip8_fontset[0x010]);
+    
+    printf("PASS\n");
+}
+
+void Test_InstancePool()
+{
+    printf("Testing Instance pool...");
+    
+    C8InstancePool pool;
+    assert(C8CreateInstancePool(&pool, 2, &test_image, &test_pool));
+    
+    // Instances come out ready to run
+    Chip8* first = C8AcquireInstance(&pool);
+    Chip8* second = C8AcquireInstance(&pool);
+    assert(first && second && first != second);
+    assert(C8AcquireInstance(&pool) == nullptr);
+    assert(first->pc == 0x200);
+    assert(C8ReadMemory(first, 0) == chip8_fontset[0]);
+    
+    // Resetting puts back the initial state and memory
+    first->pc = 0x300;
+    first->V[3] = 7;
+    C8WriteMemory(first, 0x300, 0xAB);
+    C8ResetInstance(&pool, first);
+    
+    assert(first->pc == 0x200);
+    assert(first->V[3] == 0);
+    assert(first->private_pages == 0);
+    assert(C8ReadMemory(first, 0x300) == 0);
+    
+    // Released instances are handed out again
+    C8ReleaseInstance(&pool, second);
+    assert(C8AcquireInstance(&pool) == second);
+    
+    C8DestroyInstancePool(&pool);
+    
+    printf("PASS\n");
+}
+
+void Test_KeysRead()
+{
+    printf("Testing Keys read...");
+    
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, &test_image, &test_pool);
+    
+    // SKP V0 then spin, only the first frame reads the keypad
+    const uint8_t program[] = { 0xE0, 0x9E, 0x12, 0x02 };
+    for(uint16_t i = 0; i < sizeof(program); ++i)
+    {
+        C8WriteMemory(&chip8, 0x200 + i, program[i]);
+    }
+    
+    C8EmulateFrame(&chip8, DEFAULT_CYCLES_PER_FRAME);
+    assert(chip8.keys_read);
+    
+    C8EmulateFrame(&chip8, DEFAULT_CYCLES_PER_FRAME);
+    assert(!chip8.keys_read);
+    
+    C8ReleasePages(&chip8);
+    
+    printf("PASS\n");
+}
+
+void Test_Scheduler()
+{
+    printf("Testing Scheduler...");
+    
+    // Sets both timers then counts in V3 while a key is held
+    const uint8_t program[] =
+    {
+        0x60, 0x3C, // LD V0, 60
+        0xF0, 0x15, // LD DT, V0
+        0xF0, 0x18, // LD ST, V0
+        0xF2, 0x0A, // LD V2, K
+        0x73, 0x01, // ADD V3, 1
+        0x12, 0x06, // JP 0x206
+    };
+    
+    Chip8 scheduled = {};
+    Chip8 reference = {};
+    C8Initialise(&scheduled, &test_image, &test_pool);
+    C8Initialise(&reference, &test_image, &test_pool);
+    for(uint16_t i = 0; i < sizeof(program); ++i)
+    {
+        C8WriteMemory(&scheduled, 0x200 + i, program[i]);
+        C8WriteMemory(&reference, 0x200 + i, program[i]);
+    }
+    
+    C8Scheduler scheduler;
+    C8InitialiseScheduler(&scheduler, DEFAULT_CYCLES_PER_FRAME);
+    uint32_t task = C8AddTask(&scheduler, &scheduled);
+    
+    // Parks on the key wait in the first frame and stays parked
+    for(uint32_t frame = 0; frame < 10; ++frame)
+    {
+        C8RunSchedulerFrame(&scheduler);
+        C8EmulateFrame(&reference, DEFAULT_CYCLES_PER_FRAME);
+    }
+    assert(scheduler.parked_count == 1);
+    assert(scheduler.runnable.empty());
+    assert(scheduled.delay_timer == 59);
+    
+    // A key down wakes it caught up with a chip that ran every frame, once
+    // the queued keys are applied at the start of the next frame
+    C8SetTaskKeys(&scheduler, task, 1 << 4);
+    reference.keys = 1 << 4;
+    assert(scheduler.parked_count == 1);
+    assert(scheduled.keys == 0);
+    
+    C8ApplyTaskKeys(&scheduler);
+    assert(scheduler.parked_count == 0);
+    
+    CheckC8Structures(&scheduled, &reference);
+    assert(scheduled.cycles == reference.cycles);
+    assert(scheduled.cycles_skipped == reference.cycles_skipped);
+    
+    for(uint32_t frame = 0; frame < 3; ++frame)
+    {
+        C8RunSchedulerFrame(&scheduler);
+        C8EmulateFrame(&reference, DEFAULT_CYCLES_PER_FRAME);
+    }
+    
+    CheckC8Structures(&scheduled, &reference);
+    assert(scheduled.cycles == reference.cycles);
+    assert(scheduled.cycles_skipped == reference.cycles_skipped);
+    assert(scheduled.V[2] == 4);
+    assert(scheduled.V[3] != 0);
+    
+    C8ReleasePages(&scheduled);
+    C8ReleasePages(&reference);
+    
+    printf("PASS\n");
+}
+
+void Test_SchedulerThreadKeys()
+{
+    printf("Testing Scheduler thread keys...");
+    
+    // Waits for a key then counts in V3
+    const uint8_t program[] =
+    {
+        0xF2, 0x0A, // LD V2, K
+        0x73, 0x01, // ADD V3, 1
+        0x12, 0x02, // JP 0x202
+    };
+    
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, &test_image, &test_pool);
+    for(uint16_t i = 0; i < sizeof(program); ++i)
+    {
+        C8WriteMemory(&chip8, 0x200 + i, program[i]);
+    }
+    
+    C8Scheduler scheduler;
+    C8InitialiseScheduler(&scheduler, DEFAULT_CYCLES_PER_FRAME);
+    uint32_t task = C8AddTask(&scheduler, &chip8);
+    
+    C8RunSchedulerFrame(&scheduler);
+    assert(scheduler.parked_count == 1);
+    
+    // Keys set from another thread are queued until the next frame, which
+    // wakes the task and runs it
+    std::thread key_thread(C8SetTaskKeys, &scheduler, task, (uint16_t)(1 << 7));
+    key_thread.join();
+    assert(scheduler.parked_count == 1);
+    assert(chip8.keys == 0);
+    
+    C8RunSchedulerFrame(&scheduler);
+    assert(scheduler.parked_count == 0);
+    assert(scheduler.key_events.empty());
+    assert(scheduler.runnable.size() == 1);
+    assert(chip8.keys == 1 << 7);
+    assert(chip8.V[2] == 7);
+    assert(chip8.V[3] != 0);
+    
+    C8ReleasePages(&chip8);
+    
+    printf("PASS\n");
+}
+
+void Test_SchedulerThread()
+{
+    printf("Testing Scheduler thread...");
+    
+    // Starts and stops the thread with nothing to run
+    C8SchedulerThread scheduler_thread;
+    C8InitialiseScheduler(&scheduler_thread.scheduler, DEFAULT_CYCLES_PER_FRAME);
+    C8StartSchedulerThread(&scheduler_thread, 0);
+    C8StopSchedulerThread(&scheduler_thread);
+    assert(!scheduler_thread.running);
+    assert(!scheduler_thread.thread.joinable());
+    
+    printf("PASS\n");
+}
+
+void Test_Pacer()
+{
+    printf("Testing Pacer...");
+    
+    // A rate that doesn't divide by the frame rate is spread over the second
+    C8Pacer pacer;
+    C8InitialisePacer(&pacer, 1000, 60);
+    
+    uint32_t total = 0;
+    for(uint32_t frame = 0; frame < 60; ++frame)
+    {
+        uint32_t cycles = C8PacerFrameCycles(&pacer);
+        assert(cycles == 16 || cycles == 17);
+        total += cycles;
+    }
+    assert(total == 1000);
+    
+    // Waits land on the deadline grid
+    C8InitialisePacer(&pacer, 1000, 1000);
+    Clock_Time start = Clock::now();
+    for(uint32_t frame = 0; frame < 10; ++frame)
+    {
+        C8PacerWait(&pacer);
+    }
+    assert(PerfNano_Counter(Clock::now() - start).count() >= 9000000);
+    assert(pacer.frames_waited == 10);
+    
+    printf("PASS\n");
+}
+
+void Test_Metrics()
+{
+    printf("Testing Metrics...");
+    
+    static C8MetricsRegistry registry;
+    static C8Counter counter;
+    static C8Histogram histogram;
+    C8RegisterCounter(&registry, &counter, "test_total", "A counter");
+    C8RegisterHistogram(&registry, &histogram, "test_seconds", "A histogram");
+    
+    C8AddCounter(&counter, 3);
+    C8AddCounter(&counter, 4);
+    
+    // Under 1us, under 4us and beyond the last bucket
+    C8ObserveDuration(&histogram, 500);
+    C8ObserveDuration(&histogram, 3000);
+    C8ObserveDuration(&histogram, 100000000000LL);
+    
+    FILE* file = tmpfile();
+    assert(file);
+    C8WriteMetrics(&registry, file);
+    
+    char text[8192] = {};
+    rewind(file);
+    size_t size = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    assert(size > 0);
+    
+    assert(strstr(text, "# TYPE test_total counter\ntest_total 7\n"));
+    assert(strstr(text, "# TYPE test_seconds histogram\n"));
+    assert(strstr(text, "test_seconds_bucket{le=\"1e-06\"} 1\n"));
+    assert(strstr(text, "test_seconds_bucket{le=\"2e-06\"} 1\n"));
+    assert(strstr(text, "test_seconds_bucket{le=\"4e-06\"} 2\n"));
+    assert(strstr(text, "test_seconds_bucket{le=\"+Inf\"} 3\n"));
+    assert(strstr(text, "test_seconds_count 3\n"));
+    
+    printf("PASS\n");
+}
+
+void Test_Trace()
+{
+    printf("Testing Trace...");
+    
+    C8TraceThread("Tests");
+    
+    // Nothing is recorded while tracing is off
+    {
+        C8_TRACE_SCOPE("Off");
+    }
+    
+    C8EnableTrace(true);
+    {
+        C8_TRACE_SCOPE("Outer");
+        C8_TRACE_SCOPE("Inner");
+    }
+    C8EnableTrace(false);
+    
+    const char* path = "Chip8TestTrace.json";
+    assert(C8WriteTrace(path));
+    
+    char text[4096] = {};
+    FILE* file = fopen(path, "r");
+    assert(file);
+    size_t size = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    remove(path);
+    assert(size > 0);
+    
+    assert(strstr(text, "{\"traceEvents\":["));
+    assert(strstr(text, "\"args\":{\"name\":\"Tests\"}"));
+    assert(strstr(text, "{\"name\":\"Outer\",\"ph\":\"X\""));
+    assert(strstr(text, "{\"name\":\"Inner\",\"ph\":\"X\""));
+    assert(!strstr(text, "\"Off\""));
+    
+    printf("PASS\n");
+}
+
+void Test_Debugger()
+{
+    printf("Testing Debugger...");
+    
+    const uint8_t program[] =
+    {
+        0x60, 0x05, // LD V0, 5
+        0x22, 0x0A, // CALL 0x20A
+        0xA3, 0x00, // LD I, 0x300
+        0xF0, 0x33, // LD B, V0
+        0x12, 0x08, // JP 0x208
+        0x70, 0x01, // ADD V0, 1
+        0x00, 0xEE, // RET
+    };
+    
+    Chip8 debugged = {};
+    Chip8 reference = {};
+    C8Initialise(&debugged, &test_image, &test_pool);
+    C8Initialise(&reference, &test_image, &test_pool);
+    for(uint16_t i = 0; i < sizeof(program); ++i)
+    {
+        C8WriteMemory(&debugged, 0x200 + i, program[i]);
+        C8WriteMemory(&reference, 0x200 + i, program[i]);
+    }
+    
+    C8Debugger debugger;
+    C8InitialiseDebugger(&debugger);
+    
+    // Starts stopped
+    assert(!C8DebugFrame(&debugged, &debugger, DEFAULT_CYCLES_PER_FRAME));
+    assert(debugged.pc == 0x200);
+    
+    // Breakpoint in the subroutine, the call is on the stack
+    C8SetBreakpoint(&debugger, 0x20A, true);
+    C8DebugContinue(&debugger);
+    assert(!C8DebugFrame(&debugged, &debugger, DEFAULT_CYCLES_PER_FRAME));
+    assert(debugged.pc == 0x20A);
+    assert(debugged.sp == 1 && debugged.stack[0] == 0x204);
+    assert(debugger.frame_cycle == 2);
+    
+    // Stops after the instruction that writes the watched byte
+    C8WatchMemory(&debugger, &debugged, 0x302, 1);
+    C8DebugContinue(&debugger);
+    assert(!C8DebugFrame(&debugged, &debugger, DEFAULT_CYCLES_PER_FRAME));
+    assert(debugged.pc == 0x208);
+    assert(C8ReadMemory(&debugged, 0x302) == 6);
+    
+    // Watching a register
+    C8WatchRegister(&debugger, &debugged, C8_DEBUG_WATCH_I);
+    
+    C8DebugStep(&debugger, 1);
+    assert(!C8DebugFrame(&debugged, &debugger, DEFAULT_CYCLES_PER_FRAME));
+    assert(debugged.pc == 0x208);
+    assert(strcmp(debugger.stop_reason, "Stepped") == 0);
+    
+    // Running out the frame leaves the same state as running it in one go
+    C8DebugContinue(&debugger);
+    assert(C8DebugFrame(&debugged, &debugger, DEFAULT_CYCLES_PER_FRAME));
+    C8EmulateFrame(&reference, DEFAULT_CYCLES_PER_FRAME);
+    
+    CheckC8Structures(&debugged, &reference);
+    assert(debugged.cycles == reference.cycles);
+    
+    C8ReleasePages(&debugged);
+    C8ReleasePages(&reference);
+    
+    printf("PASS\n");
+}
+
+void Test_Decode()
+{
+    printf("Testing Decode...");
+    
+    // Every entry decodes to itself, the table order resolves the overlaps
+    for(uint32_t id = 0; id < C8_OP_BAD; ++id)
+    {
+        assert(C8Decode(opcode_info[id].pattern) == id);
+    }
+    
+    assert(C8Decode(0x0123) == C8_OP_SYS);
+    assert(C8Decode(0x5121) == C8_OP_SE_VX_VY);
+    assert(C8Decode(0x800F) == C8_OP_BAD);
+    assert(C8Decode(0xE19F) == C8_OP_BAD);
+    assert(C8Decode(0xF0FF) == C8_OP_BAD);
+    
+    // The generated table agrees with a first match search of the entries
+    for(uint32_t opcode = 0; opcode < 65536; ++opcode)
+    {
+        uint8_t id = C8_OP_BAD;
+        for(uint8_t entry = 0; entry < C8_OP_BAD && id == C8_OP_BAD; ++entry)
+        {
+            if((opcode & opcode_info[entry].mask) == opcode_info[entry].pattern)
+                id = entry;
+        }
+        assert(C8Decode(opcode) == id);
+    }
+    
+    char text[32];
+    C8FormatInstruction(text, sizeof(text), 0xD125);
+    assert(strcmp(text, "DRW V1, V2, 5") == 0);
+    C8FormatInstruction(text, sizeof(text), 0x7A0F);
+    assert(strcmp(text, "ADD VA, 0x0F") == 0);
+    C8FormatInstruction(text, sizeof(text), 0xF0FF);
+    assert(strcmp(text, "DW 0xF0FF") == 0);
+    
+    printf("PASS\n");
+}
+
+void Test_Disassembler()
+{
+    printf("Testing Disassembler...");
+    
+    const uint8_t program[] =
+    {
+        0x22, 0x08, // 0x200 CALL 0x208
+        0x12, 0x02, // 0x202 JP 0x202
+        0x18, 0x00, // 0x204 never reached
+        0x3C, 0x3C, // 0x206 sprite
+        0xA2, 0x06, // 0x208 LD I, 0x206
+        0xD0, 0x12, // 0x20A DRW V0, V1, 2
+        0x00, 0xEE, // 0x20C RET
+    };
+    
+    C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], program, sizeof(program));
+    
+    C8Analysis analysis;
+    C8AnalyseROM(&analysis, image.memory, sizeof(program));
+    
+    assert(analysis.instructions == 5);
+    assert(analysis.computed_jumps == 0);
+    assert(analysis.flags[0x200] & C8_BYTE_CODE);
+    assert(analysis.flags[0x201] & C8_BYTE_OPERAND);
+    assert(analysis.flags[0x202] & C8_BYTE_LABEL);
+    assert(analysis.flags[0x208] & C8_BYTE_SUBROUTINE);
+    assert(!(analysis.flags[0x204] & C8_BYTE_CODE));
+    assert(analysis.flags[0x206] & C8_BYTE_DATA_REF);
+    assert((analysis.flags[0x206] & C8_BYTE_SPRITE) && (analysis.flags[0x207] & C8_BYTE_SPRITE));
+    assert(!(analysis.flags[0x206] & C8_BYTE_CODE));
+    
+    printf("PASS\n");
+}
+
+void Test_Cfg()
+{
+    printf("Testing Control flow graph...");
+    
+    const uint8_t program[] =
+    {
+        0x22, 0x08, // 0x200 CALL 0x208
+        0x30, 0x01, // 0x202 SE V0, 1
+        0x12, 0x02, // 0x204 JP 0x202
+        0x12, 0x06, // 0x206 JP 0x206
+        0x70, 0x01, // 0x208 ADD V0, 1
+        0x00, 0xEE, // 0x20A RET
+    };
+    
+    C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], program, sizeof(program));
+    
+    C8Analysis analysis;
+    C8AnalyseROM(&analysis, image.memory, sizeof(program));
+    
+    C8Cfg cfg;
+    C8BuildCfg(&cfg, &analysis, image.memory);
+    
+    assert(cfg.blocks.size() == 5);
+    assert(cfg.loops == 2);
+    assert(cfg.subroutines.size() == 2 && cfg.subroutines[1] == 0x208);
+    
+    // The call block goes to the subroutine and on to the return site
+    const C8Block* call = &cfg.blocks[0];
+    assert(call->start == 0x200 && call->end == 0x202);
+    assert(call->edge_count == 2);
+    assert(call->edges[0].kind == C8_EDGE_CALL && call->edges[0].target == 0x208);
+    assert(call->edges[1].kind == C8_EDGE_NEXT && call->edges[1].target == 0x202);
+    
+    // The skip either falls into the jump back or skips it
+    const C8Block* skip = &cfg.blocks[1];
+    assert(skip->start == 0x202 && skip->loop_header);
+    assert(skip->edge_count == 2 && skip->edges[1].kind == C8_EDGE_SKIP && skip->edges[1].target == 0x206);
+    
+    assert(cfg.blocks[3].start == 0x206 && cfg.blocks[3].loop_header);
+    
+    const C8Block* subroutine = &cfg.blocks[4];
+    assert(subroutine->start == 0x208 && subroutine->end == 0x20C);
+    assert(subroutine->subroutine == 0x208 && subroutine->edge_count == 0);
+    assert(cfg.blocks[1].subroutine == 0x200);
+    
+    // Everything in the graph is decoded into the image
+    C8PredecodeImage(&image, &cfg);
+    assert(image.decoded[0x200].id == C8_OP_CALL && image.decoded[0x200].opcode == 0x2208);
+    assert(image.decoded[0x20A].id == C8_OP_RET);
+    assert(image.decoded[0x20C].id == C8_DECODE_NONE);
+    
+    printf("PASS\n");
+}
+
+void Test_PredecodeSelfModifying()
+{
+    printf("Testing Pre-decoded self modifying code...");
+    
+    const uint8_t program[] =
+    {
+        0x60, 0x12, // 0x200 LD V0, 0x12
+        0x61, 0x0E, // 0x202 LD V1, 0x0E
+        0xA2, 0x0A, // 0x204 LD I, 0x20A
+        0xF1, 0x55, // 0x206 LD [I], V1, writes JP 0x20E over 0x20A
+        0x65, 0x01, // 0x208 LD V5, 1
+        0x65, 0x02, // 0x20A LD V5, 2
+        0x66, 0x03, // 0x20C LD V6, 3
+        0x12, 0x0E, // 0x20E JP 0x20E
+    };
+    
+    C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], program, sizeof(program));
+    C8PredecodeROM(&image, sizeof(program));
+    assert(image.decoded[0x20A].id == C8_OP_LD_VX_NN);
+    
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, &image, &test_pool);
+    C8EmulateFrame(&chip8, DEFAULT_CYCLES_PER_FRAME);
+    
+    // The write made the page private so the new jump ran instead of what
+    // was decoded at load time
+    assert(chip8.V[5] == 1);
+    assert(chip8.V[6] == 0);
+    assert(chip8.pc == 0x20E);
+    
+    C8ReleasePages(&chip8);
+    
+    printf("PASS\n");
+}
+
+void Test_Fused()
+{
+    printf("Testing Fused sequences...");
+    
+    const uint8_t program[] =
+    {
+        0x60, 0x03, // 0x200 LD V0, 3
+        0x61, 0x00, // 0x202 LD V1, 0
+        0xA2, 0x16, // 0x204 LD I, 0x216
+        0xD0, 0x11, // 0x206 DRW V0, V1, 1
+        0x71, 0x01, // 0x208 ADD V1, 1
+        0x31, 0x04, // 0x20A SE V1, 4
+        0x12, 0x04, // 0x20C JP 0x204
+        0xF2, 0x07, // 0x20E LD V2, DT
+        0x32, 0x00, // 0x210 SE V2, 0
+        0x12, 0x0E, // 0x212 JP 0x20E
+        0x12, 0x14, // 0x214 JP 0x214
+        0xF0,       // 0x216 Sprite
+    };
+    
+    C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], program, sizeof(program));
+    C8PredecodeROM(&image, sizeof(program));
+    
+    assert(image.decoded[0x200].dispatch == C8_DISPATCH_FUSED + C8_FUSED_LD_LD);
+    assert(image.decoded[0x202].dispatch == image.decoded[0x202].id);
+    assert(image.decoded[0x204].dispatch == C8_DISPATCH_FUSED + C8_FUSED_LD_I_DRW);
+    assert(image.decoded[0x208].dispatch == C8_DISPATCH_FUSED + C8_FUSED_COUNTER_LOOP);
+    assert(image.decoded[0x20E].dispatch == C8_DISPATCH_FUSED + C8_FUSED_TIMER_WAIT);
+    
+    // Instructions inside a sequence still decode alone
+    assert(image.decoded[0x20A].id == C8_OP_SE_VX_NN);
+    
+    // Frames too short for some sequences to fit must end the same as
+    // stepping one instruction at a time
+    for(uint32_t cycles = 1; cycles <= 7; ++cycles)
+    {
+        Chip8 fused = {};
+        Chip8 stepped = {};
+        C8Initialise(&fused, &image, &test_pool);
+        C8Initialise(&stepped, &image, &test_pool);
+        fused.delay_timer = 3;
+        stepped.delay_timer = 3;
+        
+        for(uint32_t frame = 0; frame < 30; ++frame)
+        {
+            C8EmulateFrame(&fused, cycles);
+            
+            for(uint32_t cycle = 0; cycle < cycles; ++cycle)
+            {
+                C8EmulateCycle(&stepped);
+            }
+            C8TickTimers(&stepped);
+            
+            assert(memcmp(fused.V, stepped.V, sizeof(fused.V)) == 0);
+            assert(fused.I == stepped.I);
+            assert(fused.pc == stepped.pc);
+            assert(fused.delay_timer == stepped.delay_timer);
+            assert(memcmp(fused.gfx, stepped.gfx, sizeof(fused.gfx)) == 0);
+            assert(fused.cycles == stepped.cycles);
+        }
+        
+        // Drew four rows and waited out the timer
+        assert(fused.pc == 0x214);
+        assert(fused.V[1] == 4);
+        
+        C8ReleasePages(&fused);
+        C8ReleasePages(&stepped);
+    }
+    
+    printf("PASS\n");
+}
+
+void Test_Sequences()
+{
+    printf("Testing Sequence counts...");
+    
+    const uint8_t program[] =
+    {
+        0xA2, 0x0A, // 0x200 LD I, 0x20A
+        0xD0, 0x11, // 0x202 DRW V0, V1, 1
+        0xA2, 0x0A, // 0x204 LD I, 0x20A
+        0xD0, 0x11, // 0x206 DRW V0, V1, 1
+        0x12, 0x08, // 0x208 JP 0x208
+        0xF0,       // 0x20A Sprite
+    };
+    
+    uint8_t memory[MEMSIZE] = {};
+    memcpy(&memory[0x200], program, sizeof(program));
+    
+    C8Analysis analysis;
+    C8AnalyseROM(&analysis, memory, sizeof(program));
+    
+    C8SequenceCounts counts;
+    C8CountSequences(&counts, &analysis, memory);
+    
+    assert(counts.pairs[C8_OP_LD_I * C8_OP_COUNT + C8_OP_DRW] == 2);
+    assert(counts.pairs[C8_OP_DRW * C8_OP_COUNT + C8_OP_LD_I] == 1);
+    assert(counts.pairs[C8_OP_DRW * C8_OP_COUNT + C8_OP_JP] == 1);
+    
+    // Nothing runs on from the jump
+    assert(counts.pairs[C8_OP_JP * C8_OP_COUNT + C8_OP_JP] == 0);
+    assert(counts.triples[(C8_OP_LD_I * C8_OP_COUNT + C8_OP_DRW) * C8_OP_COUNT + C8_OP_LD_I] == 1);
+    assert(counts.triples[(C8_OP_LD_I * C8_OP_COUNT + C8_OP_DRW) * C8_OP_COUNT + C8_OP_JP] == 1);
+    
+    // Counts add up across ROMs
+    C8CountSequences(&counts, &analysis, memory);
+    assert(counts.pairs[C8_OP_LD_I * C8_OP_COUNT + C8_OP_DRW] == 4);
+    
+    printf("PASS\n");
+}
+
+void Test_AotTranslate()
+{
+    printf("Testing Ahead of time translation...");
+    
+    const uint8_t program[] =
+    {
+        0x60, 0x05, // 0x200 LD V0, 5
+        0xF0, 0x55, // 0x202 LD [I], V0
+        0x70, 0x01, // 0x204 ADD V0, 1
+        0xF1, 0x0A, // 0x206 LD V1, K
+        0x12, 0x04, // 0x208 JP 0x204
+    };
+    
+    uint8_t memory[MEMSIZE] = {};
+    memcpy(&memory[0x200], program, sizeof(program));
+    
+    FILE* file = tmpfile();
+    assert(file);
+    C8TranslateROM(file, memory, sizeof(program), "test\"rom");
+    
+    static char text[65536] = {};
+    rewind(file);
+    size_t size = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    assert(size > 0);
+    
+    assert(strstr(text, "const char* const c8_aot_rom_name = \"test\\\"rom\";\n"));
+    assert(strstr(text, "const uint32_t c8_aot_rom_size = 10;\n"));
+    
+    // The jump target starts a block, the write and the key wait end one
+    assert(strstr(text, "case 0x200: goto block_200;"));
+    assert(strstr(text, "case 0x204: goto block_204;"));
+    assert(strstr(text, "case 0x208: goto block_208;"));
+    assert(strstr(text, "block_200:\n"));
+    assert(strstr(text, "block_204:\n"));
+    assert(strstr(text, "block_208:\n"));
+    assert(!strstr(text, "block_202:\n"));
+    assert(!strstr(text, "block_206:\n"));
+    
+    // The jump back stays in translated code
+    assert(strstr(text, "goto block_204;\n"));
+    assert(strstr(text, "void C8AotEmulateFrame(Chip8* chip8, uint32_t cycles)"));
+    assert(!strstr(text, "C8_IDLE_TIMER"));
+    
+    // A jump back to a loop polling the delay timer skips the rest of the
+    // frame as the interpreter does
+    const uint8_t wait[] =
+    {
+        0xF2, 0x07, // 0x200 LD V2, DT
+        0x32, 0x00, // 0x202 SE V2, 0
+        0x12, 0x00, // 0x204 JP 0x200
+    };
+    
+    memset(memory, 0, sizeof(memory));
+    memcpy(&memory[0x200], wait, sizeof(wait));
+    
+    file = tmpfile();
+    assert(file);
+    C8TranslateROM(file, memory, sizeof(wait), "wait");
+    
+    memset(text, 0, sizeof(text));
+    rewind(file);
+    size = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    assert(size > 0);
+    
+    assert(strstr(text, "if(budget != 0 && chip8->delay_timer != 0x00 &&"));
+    assert(strstr(text, "chip8->idle = C8_IDLE_TIMER;"));
+    
+    // BNNN can leave the pc past the top of memory, the interpreter masks it
+    // when fetching so the block lookup has to as well
+    const uint8_t computed[] =
+    {
+        0x60, 0x10, // 0x200 LD V0, 0x10
+        0xB3, 0x00, // 0x202 JP V0, 0x300
+    };
+    
+    memset(memory, 0, sizeof(memory));
+    memcpy(&memory[0x200], computed, sizeof(computed));
+    memory[0x310] = 0xBF; // 0x310 JP V0, 0xFF0
+    memory[0x311] = 0xF0;
+    
+    file = tmpfile();
+    assert(file);
+    C8TranslateROM(file, memory, 0x112, "computed");
+    
+    memset(text, 0, sizeof(text));
+    rewind(file);
+    size = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    assert(size > 0);
+    
+    assert(strstr(text, "c8_aot_block_starts[(chip8->pc & MEMMASK) >> 3]"));
+    assert(!strstr(text, "c8_aot_block_starts[chip8->pc >> 3]"));
+    
+    printf("PASS\n");
+}
+
+// Steps every instruction but gets the 50th wrong
+void ShadowBrokenFrame(Chip8* chip8, uint32_t cycles)
+{
+    for(uint32_t cycle = 0; cycle < cycles; ++cycle)
+    {
+        C8EmulateCycle(chip8);
+        if(chip8->cycles == 50)
+        {
+            chip8->V[3] ^= 1;
+        }
+    }
+    
+    C8TickTimers(chip8);
+}
+
+void Test_Shadow()
+{
+    printf("Testing Shadow execution...");
+    
+    const uint8_t program[] =
+    {
+        0xC1, 0xFF, // 0x200 RND V1, 0xFF
+        0xA2, 0x0C, // 0x202 LD I, 0x20C
+        0xD0, 0x11, // 0x204 DRW V0, V1, 1
+        0x70, 0x01, // 0x206 ADD V0, 1
+        0xF1, 0x55, // 0x208 LD [I], V1
+        0x12, 0x00, // 0x20A JP 0x200
+        0xF0,       // 0x20C Sprite, overwritten
+    };
+    
+    C8Image image;
+    C8InitialiseImage(&image);
+    memcpy(&image.memory[0x200], program, sizeof(program));
+    C8PredecodeROM(&image, sizeof(program));
+    
+    static C8Shadow shadow;
+    
+    // The optimised frame loop matches the reference, random numbers and
+    // writes included
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, &image, &test_pool);
+    C8InitialiseShadow(&shadow, &chip8, C8EmulateFrame, 20);
+    for(uint32_t frame = 0; frame < 60; ++frame)
+    {
+        assert(C8ShadowFrame(&shadow, &chip8, 7));
+    }
+    assert(C8ShadowCheck(&shadow, &chip8));
+    assert(shadow.checks == 21 && !shadow.diverged);
+    assert(chip8.private_pages != 0);
+    C8DestroyShadow(&shadow);
+    C8ReleasePages(&chip8);
+    
+    // A divergence between checks is found by replaying, to the instruction
+    chip8 = Chip8();
+    C8Initialise(&chip8, &image, &test_pool);
+    C8InitialiseShadow(&shadow, &chip8, ShadowBrokenFrame, 100);
+    
+    bool matched = true;
+    for(uint32_t frame = 0; frame < 60 && matched; ++frame)
+    {
+        matched = C8ShadowFrame(&shadow, &chip8, 7);
+    }
+    assert(!matched && shadow.diverged);
+    assert(shadow.divergence_cycle == 50);
+    
+    // Stays diverged
+    assert(!C8ShadowCheck(&shadow, &chip8));
+    
+    C8DestroyShadow(&shadow);
+    C8ReleasePages(&chip8);
+    
+    printf("PASS\n");
+}
+
+void Test_Env()
+{
+    printf("Testing Environment step...");
+    
+    // Draws the 0 from the font in the top left then counts up at 0x300
+    const uint8_t rom[] = {
+        0x60, 0x00, // V0 = 0
+        0xF0, 0x29, // I = font 0
+        0xD0, 0x05, // Draw at (0, 0)
+        0xA3, 0x00, // I = 0x300
+        0x71, 0x01, // V1 += 1
+        0xF1, 0x55, // [0x300] = V0, V1
+        0x12, 0x08, // Jump back to the add
+    };
+    
+    C8EnvConfig config = {};
+    config.threads = 2;
+    config.reward_address = 0x301;
+    config.reward_bytes = 1;
+    
+    // The size has to be set
+    assert(!C8EnvCreate(rom, sizeof(rom), 3, &config));
+    config.size = sizeof(config) + 4;
+    assert(!C8EnvCreate(rom, sizeof(rom), 3, &config));
+    config.size = sizeof(config);
+    
+    C8Env* env = C8EnvCreate(rom, sizeof(rom), 3, &config);
+    assert(env);
+    assert(C8EnvObservationSize(env) == SCREEN_WIDTH * SCREEN_HEIGHT);
+    
+    static uint8_t observations[3][SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint16_t actions[3] = {};
+    float rewards[3];
+    uint8_t dones[3];
+    
+    C8EnvStep(env, actions, 1, &observations[0][0], rewards, dones);
+    
+    for(int i = 0; i < 3; ++i)
+    {
+        // 4 setup instructions, then 32 cycles of the 3 instruction loop
+        // store 11 times
+        assert(rewards[i] == 11);
+        assert(dones[i] == 0);
+        
+        // The top row of the 0 is 0xF0
+        assert(observations[i][0] == 255 && observations[i][3] == 255);
+        assert(observations[i][4] == 0);
+    }
+    
+    // Resetting one environment leaves the others alone
+    uint8_t reset[3] = { 0, 1, 0 };
+    C8EnvReset(env, reset, &observations[0][0]);
+    assert(observations[1][0] == 0);
+    
+    C8EnvStep(env, actions, 2, &observations[0][0], rewards, dones);
+    // 72 cycles of the loop, the reset one runs the setup again first
+    assert(rewards[0] == 24);
+    assert(rewards[1] == 23);
+    assert(rewards[2] == 24);
+    
+    C8EnvDestroy(env);
+    
+    printf("PASS\n");
+}
+
+void Test_EnvFrameStack()
+{
+    printf("Testing Environment frame stack...");
+    
+    // With 2 cycles a frame the 0 from the font flickers, drawn every other
+    // frame after the first
+    const uint8_t rom[] = {
+        0x60, 0x00, // V0 = 0
+        0xF0, 0x29, // I = font 0
+        0xD0, 0x05, // Draw at (0, 0)
+        0x12, 0x04, // Jump back to the draw
+    };
+    
+    C8EnvConfig config = {};
+    config.size = sizeof(config);
+    config.cycles_per_frame = 2;
+    config.threads = 1;
+    config.max_pool = 1;
+    config.frame_stack = 2;
+    
+    C8Env* env = C8EnvCreate(rom, sizeof(rom), 1, &config);
+    assert(env);
+    assert(C8EnvObservationSize(env) == SCREEN_WIDTH * SCREEN_HEIGHT * 2);
+    
+    static uint8_t observation[2][SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint16_t action = 0;
+    float reward;
+    uint8_t done;
+    
+    C8EnvReset(env, nullptr, &observation[0][0]);
+    assert(observation[0][0] == 0 && observation[1][0] == 0);
+    
+    // Frame 1 is blank, frame 2 draws, frame 3 erases but pooling with frame
+    // 2 keeps the sprite
+    for(int step = 0; step < 3; ++step)
+    {
+        C8EnvStep(env, &action, 1, &observation[0][0], &reward, &done);
+    }
+    
+    assert(observation[0][0] == 255 && observation[0][3] == 255 && observation[0][4] == 0);
+    assert(observation[1][0] == 255 && observation[1][3] == 255 && observation[1][4] == 0);
+    
+    C8EnvDestroy(env);
+    
+    // Packed and downsampled to 32x16
+    config.observation = C8_ENV_OBSERVATION_BITS;
+    config.downsample = 1;
+    config.frame_stack = 1;
+    
+    env = C8EnvCreate(rom, sizeof(rom), 1, &config);
+    assert(C8EnvObservationSize(env) == (SCREEN_PITCH / 2) * (SCREEN_HEIGHT / 2));
+    
+    uint8_t half[(SCREEN_PITCH / 2) * (SCREEN_HEIGHT / 2)];
+    C8EnvStep(env, &action, 2, half, &reward, &done);
+    
+    // Rows 0xF0, 0x90, 0x90, 0x90, 0xF0 halve to 0xC0 in each of the top 3 rows
+    assert(half[0] == 0xC0 && half[4] == 0xC0 && half[8] == 0xC0);
+    assert(half[1] == 0 && half[12] == 0);
+    
+    C8EnvDestroy(env);
+    
+    printf("PASS\n");
+}
+
+Chip8 SetupTestProgram(const uint16_t* program, uint32_t length)
+{
+    Chip8 chip8 = {};
+    C8Initialise(&chip8, &test_image, &test_pool);
+    
+    // Place the program at 0x200
+    for(uint32_t i=0; i<length; ++i)
+    {
+        C8WriteMemory(&chip8, 0x200 + (i * 2), program[i] >> 8);
+        C8WriteMemory(&chip8, 0x201 + (i * 2), program[i] & 0x00FF);
+    }
+    
+    return chip8;
+}
+
+void TestIdleLoop(const char* name, const uint16_t* program, uint32_t length)
+{
+    printf("Testing %s...", name);
+    
+    // Each frame length leaves the loop at a different point
+    for(uint32_t cycles=10; cycles<13; ++cycles)
+    {
+        Chip8 input = SetupTestProgram(program, length);
+        Chip8 expected = SetupTestProgram(program, length);
+        
+        for(int frame=0; frame<20; ++frame)
+        {
+            C8EmulateFrame(&input, cycles);
+            
+            // Setup the expected result by running every instruction
+            for(uint32_t cycle=0; cycle<cycles; ++cycle)
+            {
+                C8EmulateCycle(&expected);
+            }
+            C8TickTimers(&expected);
+        }
+        
+        // Skipping cycles must not change the outcome
+        CheckC8Structures(&input, &expected);
+        assert(input.cycles == expected.cycles);
+        assert(input.cycles_skipped > 0);
+    }
+    
+    printf("PASS\n");
+}
+
+void Test_IdleLoop_3XKK()
+{
+    const uint16_t program[] = {
+        0x6105, // V1 = 5
+        0xF115, // Delay timer = V1
+        0xF007, // V0 = delay timer
+        0x3000, // Skip if V0 == 0
+        0x1204, // Jump back to the FX07
+        0x7201, // V2 += 1
+        0x1200, // Start again
+    };
+    
+    TestIdleLoop("Idle loop 3XKK", program, sizeof(program) / sizeof(program[0]));
+}
+
+void Test_IdleLoop_4XKK()
+{
+    const uint16_t program[] = {
+        0x6103, // V1 = 3
+        0xF115, // Delay timer = V1
+        0xF307, // V3 = delay timer
+        0x4303, // Skip if V3 != 3
+        0x1204, // Jump back to the FX07
+        0x7201, // V2 += 1
+        0x1200, // Start again
+    };
+    
+    TestIdleLoop("Idle loop 4XKK", program, sizeof(program) / sizeof(program[0]));
+}
+
+void Test_IdleKeyWait()
+{
+    printf("Testing Idle key wait...");
+    
+    const uint16_t program[] = {
+        0xF50A, // V5 = key
+        0x7601, // V6 += 1
+        0x1200, // Start again
+    };
+    
+    Chip8 input = SetupTestProgram(program, sizeof(program) / sizeof(program[0]));
+    Chip8 expected = SetupTestProgram(program, sizeof(program) / sizeof(program[0]));
+    
+    C8EmulateFrame(&input, 10);
+    
+    // Setup the expected result, still waiting on the key
+    expected.opcode = 0xF50A;
+    expected.cycles = 10;
+    
+    CheckC8Structures(&input, &expected);
+    assert(input.cycles == expected.cycles);
+    assert(input.cycles_skipped == 9);
+    assert(input.idle == C8_IDLE_KEY);
+    
+    // Once a key is down the program carries on
+    input.keys |= (1 << 4);
+    C8EmulateFrame(&input, 10);
+    
+    assert(input.V[5] == 4);
+    assert(input.V[6] == 3);
+    assert(input.idle == C8_IDLE_NONE);
+    
+    printf("PASS\n");
+}
+
 void TestAll()
 {
+    C8InitialiseImage(&test_image);
+    
     // Perform some tests based on the opcodes
     Test_0x00E0();
     Test_0x00EE();
     Test_0x1NNN();
     Test_0x2NNN();
+    Test_0x2NNN_Overflow();
     Test_0x3XNN_NotEqual();
     Test_0x3XNN_Equal();
     Test_0x4XNN_NotEqual();
@@ -806,20 +2105,59 @@ void TestAll()
     Test_0xANNN();
     Test_0xBNNN();
     // Can't test 0xCXNN
-    // TODO DXYN
+    Test_0xDXYN();
+    Test_0xDXYN_Collision();
+    Test_0xDXYN_Wrap();
     Test_0xEX9E_Pressed();
     Test_0xEX9E_NotPressed();
     Test_0xEXA1_Pressed();
     Test_0xEXA1_NotPressed();
     Test_0xFX07();
-    // TODO FX0A
+    Test_0xFX0A_Pressed();
+    Test_0xFX0A_NotPressed();
     Test_0xFX15();
     Test_0xFX18();
     Test_0xFX1E();
     Test_0xFX29();
     Test_0xFX33();
     Test_0xFX55();
+    Test_0xFX55_TopOfMemory();
     Test_0xFX65();
-    
-    //exit(0);
+    Test_BadOpcode();
+    
+    // Shared memory pages
+    Test_CopyOnWrite();
+    Test_InstancePool();
+    Test_KeysRead();
+    Test_Scheduler();
+    Test_SchedulerThreadKeys();
+    Test_SchedulerThread();
+    Test_Pacer();
+    Test_Metrics();
+    Test_Trace();
+    Test_Debugger();
+    Test_Decode();
+    Test_Disassembler();
+    Test_Cfg();
+    Test_PredecodeSelfModifying();
+    Test_Fused();
+    Test_Sequences();
+    Test_AotTranslate();
+    Test_Shadow();
+    Test_Env();
+    Test_EnvFrameStack();
+    
+    // Idle loop detection
+    Test_IdleLoop_3XKK();
+    Test_IdleLoop_4XKK();
+    Test_IdleKeyWait();
+    
+    C8DestroyPagePool(&test_pool);
 }
+
+int main()
+{
+    TestAll();
+    
+    return 0;
+}
\ No newline at end of file
@@ -1,7 +0,0 @@
-#ifndef _TESTS_H
-#define _TESTS_H
-
-void TestAll();
-
-#endif
-